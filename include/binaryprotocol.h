@@ -0,0 +1,146 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BINARYPROTOCOL_H
+#define BINARYPROTOCOL_H
+#include <stdint.h>
+#include "terminal.h"
+#include "canmap.h"
+
+#ifndef BINPROTO_MAX_PAYLOAD
+#define BINPROTO_MAX_PAYLOAD 128 //max. 252 so a frame fits one COBS block
+#endif
+
+#ifndef BINPROTO_MAX_SUBSCRIPTIONS
+#define BINPROTO_MAX_SUBSCRIPTIONS 16
+#endif
+
+#define BINPROTO_VERSION 1
+
+#if BINPROTO_MAX_SUBSCRIPTIONS * 4 + 2 > BINPROTO_MAX_PAYLOAD
+#error Stream frame of BINPROTO_MAX_SUBSCRIPTIONS values exceeds BINPROTO_MAX_PAYLOAD
+#endif
+
+/** @brief Framed binary protocol on the terminal link
+ *
+ * Entered with the terminal command "binary" (add BinaryProtocol::Enter to
+ * the command list). Create one instance per terminal that may use binary
+ * mode at the same time, Enter() takes one that is not active on another
+ * terminal. Every frame is the COBS encoded payload followed by a
+ * 0 byte. The payload ends with a CRC-16/CCITT-FALSE (little endian) over the
+ * preceding bytes, frames with wrong CRC are dropped and counted.
+ *
+ * Request:  seq cmd data...
+ * Response: seq cmd|0x80 status data...
+ * All numbers are little endian, values are raw s32fp.
+ *
+ * cmd  request data                             response data
+ * 0x00 HELLO                                    u8 version, u32 schema hash, u16 PARAM_LAST, u32 generation
+ * 0x01 GET by index   u16 idx...                s32 value...
+ * 0x02 GET by uid     u16 uid...                s32 value...
+ * 0x03 SET by index   (u16 idx, s32 value)...   u8 number of values set
+ * 0x04 SET by uid     (u16 uid, s32 value)...   u8 number of values set
+ * 0x05 READ range     u16 first idx, u8 count   s32 value...
+ * 0x06 SUBSCRIBE      u16 divider, u16 idx...   -, empty index list unsubscribes
+ * 0x07 MAP get        u8 rx, u8 msg, u8 item    u32 can id, u16 uid, u8 offset, s8 length, f32 gain, s8 offset
+ * 0x08 MAP add        u8 rx, u32 can id, u16 uid, u8 offset, s8 length, f32 gain, s8 offset   -
+ * 0x09 MAP remove     u8 rx, u8 msg, u8 item    -
+ * 0x0A SET multiple   (u16 uid, u8 element, s32 value)...   u8 status per value
+ *                     all or nothing, one Param::Change() call, status is the first error
+ * 0x0F EXIT                                     -, then back to text mode
+ *
+ * Subscribed values are sent every divider calls of Task() as
+ * seq 0x40 value... where seq counts stream frames.
+ * Get and set access element 0 of array parameters.
+ */
+class BinaryProtocol: public IRawReceiver
+{
+   public:
+      enum Command
+      {
+         CMD_HELLO = 0x00,
+         CMD_GET = 0x01,
+         CMD_GET_UID = 0x02,
+         CMD_SET = 0x03,
+         CMD_SET_UID = 0x04,
+         CMD_READ_RANGE = 0x05,
+         CMD_SUBSCRIBE = 0x06,
+         CMD_MAP_GET = 0x07,
+         CMD_MAP_ADD = 0x08,
+         CMD_MAP_REMOVE = 0x09,
+         CMD_SET_MULTI = 0x0A,
+         CMD_EXIT = 0x0F,
+         CMD_STREAM = 0x40,
+         CMD_REPLY = 0x80
+      };
+
+      enum Status
+      {
+         STATUS_OK = 0,
+         STATUS_UNKNOWN_CMD,
+         STATUS_INVALID_PARAM,
+         STATUS_OUT_OF_RANGE,
+         STATUS_READ_ONLY,
+         STATUS_LENGTH,
+         STATUS_MAP_ERROR
+      };
+
+      explicit BinaryProtocol(CanMap* canMap = 0, IPutChar* out = 0);
+      ~BinaryProtocol();
+      void Receive(char c) override;
+      /** @brief Send subscribed values, call periodically from the same context as Terminal::Run() */
+      void Task();
+      void Exit();
+      void SetOutput(IPutChar* o) { out = o; }
+      uint32_t GetFrameErrors() { return frameErrors; }
+
+      /** @brief Terminal command that switches the terminal to binary mode */
+      static void Enter(Terminal* term, char* arg);
+
+      static uint32_t CobsEncode(const uint8_t* in, uint32_t len, uint8_t* out);
+      static int CobsDecode(const uint8_t* in, uint32_t len, uint8_t* out);
+      static uint16_t Crc16(const uint8_t* data, uint32_t len);
+
+   private:
+      void HandleFrame();
+      uint32_t HandleCommand(uint8_t cmd, const uint8_t* data, uint32_t len, uint8_t* reply, uint8_t& status);
+      uint32_t HandleMap(uint8_t cmd, const uint8_t* data, uint32_t len, uint8_t* reply, uint8_t& status);
+      void SendFrame(uint8_t* payload, uint32_t len);
+
+      static BinaryProtocol* first; //!< All instances, for Enter()
+
+      BinaryProtocol* next;
+
+      CanMap* canMap;
+      IPutChar* out;
+      Terminal* terminal;
+      bool active;
+      bool rxOverflow;
+      uint32_t rxLen;
+      uint32_t frameErrors;
+      uint16_t divider;
+      uint16_t ticks;
+      uint8_t streamSeq;
+      uint8_t numSubscribed;
+      uint16_t subscribed[BINPROTO_MAX_SUBSCRIPTIONS];
+      uint8_t rxBuf[BINPROTO_MAX_PAYLOAD + 3]; //+2 CRC, +1 COBS overhead, decoded in place
+      uint8_t reply[BINPROTO_MAX_PAYLOAD + 2];
+      uint8_t frame[BINPROTO_MAX_PAYLOAD + 3];
+};
+
+#endif // BINARYPROTOCOL_H
@@ -0,0 +1,64 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BOOTPROFILE_H
+#define BOOTPROFILE_H
+#include <stdint.h>
+#include "params.h"
+
+/** @brief Measures start-up phases with the DWT cycle counter
+ *
+ * Each phase is reported in microseconds to a spot value of the project, e.g.
+ * VALUE_ENTRY(tbootparam, "us", 2090). A typical start-up looks like
+ *
+ * BootProfile::Start();
+ * parm_load();
+ * BootProfile::Mark(Param::tbootparam);
+ * can->BeginFilterUpdate();
+ * canMap = new CanMap(can);
+ * canSdo = new CanSdo(can, canMap);
+ * can->EndFilterUpdate();
+ * BootProfile::Mark(Param::tbootcan);
+ * BootProfile::Total(Param::tboot);
+ */
+class BootProfile
+{
+   public:
+      /** @brief Enable cycle counter and start first phase, call after clock setup */
+      static void Start();
+
+      /** @brief End current phase and start the next one
+       * @param param spot value that receives the duration of the phase in us
+       * @return duration of the phase in us
+       */
+      static uint32_t Mark(Param::PARAM_NUM param);
+
+      /** @brief Report time since Start()
+       * @param param spot value that receives the time in us
+       * @return time since Start() in us
+       */
+      static uint32_t Total(Param::PARAM_NUM param);
+
+   private:
+      static uint32_t CyclesToUs(uint32_t cycles);
+
+      static uint32_t startCycles;
+      static uint32_t lastCycles;
+};
+
+#endif // BOOTPROFILE_H
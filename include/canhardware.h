@@ -65,6 +65,8 @@ class CanHardware
       bool AddCallback(CanCallback* cb);
       bool RegisterUserMessage(uint32_t canId, uint32_t mask = 0);
       void ClearUserMessages();
+      void BeginFilterUpdate();
+      void EndFilterUpdate();
       /** \brief Get RTC time when last message was received
        *
        * \return uint32_t RTC time
@@ -80,6 +82,8 @@ class CanHardware
 
    private:
       int nextCallbackIndex;
+      int filterUpdateDepth;
+      bool filtersDirty;
       CanCallback* recvCallback[MAX_RECV_CALLBACKS];
 
       virtual void ConfigureFilters() = 0;
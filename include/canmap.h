@@ -76,6 +76,7 @@ class CanMap: CanCallback
       bool FindMap(Param::PARAM_NUM param, uint32_t& canId, uint8_t& start, int8_t& length, float& gain, int8_t& offset, bool& rx);
       const CANPOS* GetMap(bool rx, uint8_t ididx, uint8_t itemidx, uint32_t& canId);
       void IterateCanMap(void (*callback)(Param::PARAM_NUM, uint32_t, uint8_t, int8_t, float, int8_t, bool));
+      void IterateCanMap(void (*callback)(void*, Param::PARAM_NUM, uint32_t, uint8_t, int8_t, float, int8_t, bool), void* context);
 
    protected:
 
@@ -107,7 +108,9 @@ class CanMap: CanCallback
       int CopyIdMapExcept(CANIDMAP *source, CANIDMAP *dest, Param::PARAM_NUM param);
       void ReplaceParamEnumByUid(CANIDMAP *canMap);
       void ReplaceParamUidByEnum(CANIDMAP *canMap);
-      uint32_t GetFlashAddress();
+      int FindNewestSlot();
+      uint32_t GetSequence(uint32_t baseAddress);
+      uint32_t GetFlashAddress(int slot);
 };
 
 #endif // CANMAP_H
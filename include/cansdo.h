@@ -20,8 +20,10 @@
 #define CANSDO_H
 #include "params.h"
 #include "printf.h"
+#include "coroutine.h"
 #include "canhardware.h"
 #include "canmap.h"
+#include "workqueue.h"
 
 #define SDO_REQUEST_DOWNLOAD  (1 << 5)
 #define SDO_REQUEST_UPLOAD    (2 << 5)
@@ -36,10 +38,15 @@
 #define SDO_ABORT             0x80
 #define SDO_WRITE_REPLY       SDO_RESPONSE_DOWNLOAD
 #define SDO_READ_REPLY        (SDO_RESPONSE_UPLOAD | SDO_EXPEDITED | SDO_SIZE_SPECIFIED)
+#define SDO_SEGMENT_LAST      (1)
+#define SDO_ERR_CMD           0x05040001
 #define SDO_ERR_INVIDX        0x06020000
+#define SDO_ERR_LENGTH        0x06070010
 #define SDO_ERR_RANGE         0x06090030
 #define SDO_ERR_GENERAL       0x08000000
 
+class Stm32Scheduler;
+
 class CanSdo: CanCallback, public IPutChar
 {
    public:
@@ -61,18 +68,40 @@ class CanSdo: CanCallback, public IPutChar
       bool SDOReadReply(uint32_t& data);
       void RemoteMap(uint8_t nodeId, bool rx, uint32_t cobId, CanMap::CANPOS mapping);
       void SetNodeId(uint8_t id);
+      /** @brief Serve task statistics of sch at index 0x51tt, tt = task, subindex = Stm32Scheduler::Statistic */
+      void SetScheduler(Stm32Scheduler* sch) { scheduler = sch; }
+      /** @brief Process SDO requests from the WorkQueue instead of the CAN receive interrupt
+       * Without WorkQueue::UsePendSV() requests are only processed while the main loop
+       * runs WorkQueue::Run(). Print string uploads with SetPrintJob() then, PutChar()
+       * and PutBuffer() can't wait for the host. When the buffer is full they abort
+       * the upload, the host receives an SDO abort instead of the next segment.
+       */
+      void SetDeferred(bool defer, WorkQueue::Priority prio = WorkQueue::PRIO_LOW) { deferred = defer; deferPriority = prio; }
       int GetPrintRequest() { return printRequest; }
+      const Param::Query& GetPrintQuery() { return printQuery; }
+      /** @brief Serve the running string upload from job, the main loop resumes it with RunPrintJob() */
+      void SetPrintJob(Resumable* job) { printJob = job; printRequest = -1; }
+      void RunPrintJob();
       SdoFrame* GetPendingUserspaceSdo() { return pendingUserSpaceSdo ? &pendingUserSpaceSdoFrame : 0; }
       void SendSdoReply(SdoFrame* sdoFrame);
       void PutChar(char c) override;
+      bool TryPutChar(char c) override;
+      void PutBuffer(const char* buf, int len) override;
+      int TryPutBuffer(const char* buf, int len) override;
       void TriggerTimeout(int callingFrequency);
 
    private:
       CanHardware* canHardware;
       CanMap* canMap;
+      Stm32Scheduler* scheduler;
       uint8_t nodeId;
       uint8_t remoteNodeId;
       int printRequest;
+      Resumable* volatile printJob; //!< Fills the print buffer of the running string upload
+      volatile bool segmentPending; //!< Segment request waits for printJob
+      uint8_t segmentCmd;
+      Param::Query printQuery;   //!< Query of the running string transfer
+      Param::Query pendingQuery; //!< Query for the next string transfer, set via SDO
       //We use a ring buffer with non-wrapping index. This limits us to 4 GB, huh!
       //In the beginning printBufIn starts at 0 and printBufOut at sizeof(printBuffer) (e.g. 64)
       //All addressing of printBuffer is modulo buffer size
@@ -80,6 +109,7 @@ class CanSdo: CanCallback, public IPutChar
       volatile uint32_t printByteIn;
       volatile uint32_t printByteOut;
       volatile int printTimeout; //remaining time to wait
+      volatile bool printAborted; //!< PutBuffer() couldn't wait, abort the upload
       Param::PARAM_NUM mapParam;
       uint32_t mapId;
       CanMap::CANPOS mapInfo;
@@ -87,9 +117,25 @@ class CanSdo: CanCallback, public IPutChar
       uint32_t sdoReplyData;
       SdoFrame pendingUserSpaceSdoFrame;
       bool pendingUserSpaceSdo;
+      Param::PARAM_NUM arrayParam; //!< Array parameter of running segmented transfer, PARAM_INVALID for print buffer
+      bool arrayUpload; //!< Direction of the running segmented array transfer
+      uint32_t arrayByte;
+      uint32_t arrayWord;
+      bool deferred;
+      WorkQueue::Priority deferPriority;
+      volatile bool deferredSdoPending;
+      uint32_t deferredSdo[2];
 
       void ProcessSDO(uint32_t data[2]);
+      void DeferSDO(uint32_t data[2]);
+      static void ProcessDeferredSDO(void* canSdo);
       bool ProcessSpecialSDOObjects(SdoFrame *sdo);
+      void ProcessArraySDO(SdoFrame *sdo);
+      void ProcessQuerySDO(SdoFrame *sdo);
+      void ProcessTaskStatsSDO(SdoFrame *sdo);
+      void UploadPrintSegment(uint8_t* bytes);
+      void UploadArraySegment(uint8_t* bytes);
+      void DownloadArraySegment(uint8_t* bytes);
       void ReadOrDeleteCanMap(SdoFrame *sdo);
       void AddCanMap(SdoFrame *sdo, bool rx);
       void InitiateSDOTransfer(uint8_t req, uint8_t nodeId, uint16_t index, uint8_t subIndex, uint32_t data);
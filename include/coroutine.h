@@ -0,0 +1,118 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef COROUTINE_H
+#define COROUTINE_H
+#include <stdint.h>
+#include "printf.h"
+
+/** @brief Stackless coroutines in the style of protothreads
+ *
+ * The state is the source line to resume at, so a coroutine costs two bytes.
+ * Local variables are not preserved across CR_YIELD/CR_WAIT_UNTIL, keep them
+ * in members. The function using these macros returns true when finished.
+ *
+ * bool Job::Resume()
+ * {
+ *    CR_BEGIN(state);
+ *    for (idx = 0; idx < 10; idx++)
+ *       CR_WAIT_UNTIL(state, PrintItem(idx));
+ *    CR_END(state);
+ * }
+ */
+typedef uint16_t CoState;
+
+#define CR_BEGIN(s)           switch (s) { case 0:
+#define CR_YIELD(s)           do { (s) = __LINE__; return false; case __LINE__:; } while (0)
+#define CR_WAIT_UNTIL(s, c)   do { (s) = __LINE__; case __LINE__: if (!(c)) return false; } while (0)
+#define CR_END(s)             } (s) = 0; return true
+
+/** @brief Job that produces output in steps */
+class Resumable
+{
+public:
+   /** @brief Continue producing output
+    * @param out output to print to
+    * @return true when finished
+    */
+   virtual bool Resume(IPutChar* out) = 0;
+};
+
+/** @brief Output for resumable producers
+ *
+ * Output is produced in chunks, e.g. one JSON entry. When the sink runs full
+ * during a chunk, EndChunk() returns false and the producer yields. When
+ * resumed it prints the same chunk again, the characters that already went
+ * out are skipped. So a chunk must print the same text again, producers keep
+ * values that may change in a member while IsResumedChunk() is true.
+ */
+class ResumableOutput: public IPutChar
+{
+public:
+   ResumableOutput(): sink(0), skip(0), count(0), blocked(false), blocking(false) {}
+   void SetSink(IPutChar* s) { sink = s; }
+   /** @brief Wait in PutChar() of the sink instead of yielding */
+   void SetBlocking(bool b) { blocking = b; }
+   void StartChunk() { count = 0; blocked = false; }
+   /** @return true if the chunk was completely sent, false if it must be printed again */
+   bool EndChunk() { if (blocked) return false; skip = 0; return true; }
+   bool IsResumedChunk() { return skip > 0; }
+
+   void PutChar(char c) { PutBuffer(&c, 1); }
+
+   void PutBuffer(const char* buf, int len)
+   {
+      uint16_t pos = count;
+
+      count += len;
+      if (blocked) return;
+
+      if (pos < skip) //part of this was already sent
+      {
+         int sent = skip - pos;
+         if (sent >= len) return;
+         buf += sent;
+         len -= sent;
+         pos = skip;
+      }
+
+      if (blocking)
+      {
+         sink->PutBuffer(buf, len);
+      }
+      else
+      {
+         int put = sink->TryPutBuffer(buf, len);
+
+         if (put < len)
+         {
+            blocked = true;
+            skip = pos + put;
+         }
+      }
+   }
+
+private:
+   IPutChar* sink;
+   uint16_t skip;
+   uint16_t count;
+   bool blocked;
+   bool blocking;
+};
+
+#endif // COROUTINE_H
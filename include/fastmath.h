@@ -0,0 +1,68 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FASTMATH_H_INCLUDED
+#define FASTMATH_H_INCLUDED
+
+/* Constant time math kernels for control and measurement paths.
+ *
+ * All kernels normalize their argument with CLZ and then run a fixed number
+ * of steps without divisions, so run time does not depend on the value.
+ * Fixed point arguments and results use FRAC_DIGITS like the rest of my_fp.h.
+ * Error bounds are checked by test_fastmath, "make bench" compares speed and
+ * accuracy with the previous loop based implementations.
+ */
+#include <stdint.h>
+#include "my_fp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Integer square root, exact: floor(sqrt(x)) */
+uint32_t fm_isqrt(uint32_t x);
+/** @brief Fixed point square root, exact: floor of the true result */
+u32fp fm_sqrt(u32fp x);
+/** @brief Fixed point reciprocal square root, within 1/2 LSB of the true result
+ * @return 1/sqrt(x) or UINT32_MAX for x = 0 */
+u32fp fm_rsqrt(u32fp x);
+/** @brief sqrt(a² + b²) without overflow for any input.
+ * Exact floor while a² + b² < 2^48, that is for results up to 2^24 LSB,
+ * above that the result is below the true value by less than 2^-23 relative */
+u32fp fm_hypot2(s32fp a, s32fp b);
+/** @brief sqrt(a² + b² + c²), same bounds as fm_hypot2() */
+u32fp fm_hypot3(s32fp a, s32fp b, s32fp c);
+/** @brief Binary logarithm of an integer, within 1 LSB of the true result
+ * @return log2(x) or INT32_MIN for x = 0 */
+s32fp fm_log2(uint32_t x);
+/** @brief Natural logarithm of an integer, within 1 LSB of the true result
+ * @return ln(x) or INT32_MIN for x = 0 */
+s32fp fm_ln(uint32_t x);
+/** @brief Exponential function, relative error below 2^-12 plus 1/2 LSB.
+ * Saturates to INT32_MAX when the result is not representable */
+s32fp fm_exp(s32fp x);
+/** @brief Square root of a float, relative error below 2^-20.
+ * Division free so it is cheap on the M4F too. Returns 0 for x <= 0 */
+float fm_sqrtf(float x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FASTMATH_H_INCLUDED
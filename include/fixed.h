@@ -0,0 +1,130 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FIXED_H_INCLUDED
+#define FIXED_H_INCLUDED
+
+#include <stdint.h>
+
+/** @brief Signed Q format fixed point number in an int32_t
+ *
+ * Fixed<IntBits, FracBits> holds a sign bit, IntBits integer and FracBits
+ * fractional bits, so Fixed<26, 5> is the classic s32fp. The format is part of
+ * the type, all shifts for conversions are resolved at compile time.
+ *
+ * Unlike FP_MUL() and FP_DIV() all arithmetic uses a 64 bit intermediate and
+ * saturates to the range of the result format instead of wrapping. Results are
+ * truncated towards minus infinity like the macros, so code converted from
+ * the macros gives the same values as long as nothing overflowed.
+ *
+ * Everything is constexpr, constants like Fixed<1, 15>::FromFloat(0.57735)
+ * cost nothing at run time. Mixed formats are multiplied and divided with
+ * Mul<Result>() and Div<Result>().
+ */
+template <int IntBits, int FracBits>
+class Fixed
+{
+   static_assert(IntBits >= 0 && FracBits >= 0 && IntBits + FracBits <= 31, "Fixed: format must fit int32_t including the sign");
+
+public:
+   static const int INT_BITS = IntBits;
+   static const int FRAC_BITS = FracBits;
+
+   constexpr Fixed(): raw(0) {}
+
+   /** @brief Convert from other format, saturating */
+   template <int I, int F>
+   explicit constexpr Fixed(Fixed<I, F> other): raw(Saturate(Rescale(other.Raw(), F, FracBits))) {}
+
+   static constexpr Fixed FromRaw(int32_t raw) { return Fixed(raw, 0); }
+   static constexpr Fixed FromInt(int64_t i) { return Fixed(Saturate(i * ((int64_t)1 << FracBits)), 0); }
+   /** @brief Rounds to the nearest representable value */
+   static constexpr Fixed FromFloat(double f) { return Fixed(SaturateFloat(f * ((int64_t)1 << FracBits)), 0); }
+   static constexpr Fixed Max() { return Fixed(MaxRaw(), 0); }
+   static constexpr Fixed Min() { return Fixed(MinRaw(), 0); }
+
+   constexpr int32_t Raw() const { return raw; }
+   /** @brief Integer part, rounded towards minus infinity like FP_TOINT() */
+   constexpr int32_t ToInt() const { return raw >> FracBits; }
+   constexpr float ToFloat() const { return (float)raw / ((int64_t)1 << FracBits); }
+
+   constexpr Fixed operator+(Fixed b) const { return Fixed(Saturate((int64_t)raw + b.raw), 0); }
+   constexpr Fixed operator-(Fixed b) const { return Fixed(Saturate((int64_t)raw - b.raw), 0); }
+   constexpr Fixed operator-() const { return Fixed(Saturate(-(int64_t)raw), 0); }
+   constexpr Fixed operator*(Fixed b) const { return Fixed(Saturate(((int64_t)raw * b.raw) >> FracBits), 0); }
+   constexpr Fixed operator*(int32_t b) const { return Fixed(Saturate((int64_t)raw * b), 0); }
+   /** @brief Division, saturates on division by 0 */
+   constexpr Fixed operator/(Fixed b) const { return Fixed(Divide((int64_t)raw * ((int64_t)1 << FracBits), b.raw), 0); }
+   /** @brief Division by integer, rounds towards 0 like the / operator */
+   constexpr Fixed operator/(int32_t b) const { return Fixed(Divide(raw, b), 0); }
+
+   Fixed& operator+=(Fixed b) { return *this = *this + b; }
+   Fixed& operator-=(Fixed b) { return *this = *this - b; }
+   Fixed& operator*=(Fixed b) { return *this = *this * b; }
+   Fixed& operator*=(int32_t b) { return *this = *this * b; }
+   Fixed& operator/=(int32_t b) { return *this = *this / b; }
+
+   constexpr bool operator==(Fixed b) const { return raw == b.raw; }
+   constexpr bool operator!=(Fixed b) const { return raw != b.raw; }
+   constexpr bool operator<(Fixed b) const { return raw < b.raw; }
+   constexpr bool operator>(Fixed b) const { return raw > b.raw; }
+   constexpr bool operator<=(Fixed b) const { return raw <= b.raw; }
+   constexpr bool operator>=(Fixed b) const { return raw >= b.raw; }
+
+   static constexpr int32_t MaxRaw() { return (int32_t)(INT32_MAX >> (31 - IntBits - FracBits)); }
+   static constexpr int32_t MinRaw() { return -MaxRaw() - 1; }
+   static constexpr int32_t Saturate(int64_t v) { return v > MaxRaw() ? MaxRaw() : v < MinRaw() ? MinRaw() : (int32_t)v; }
+   /** @brief Move binary point from fractional bits "from" to "to" */
+   static constexpr int64_t Rescale(int64_t v, int from, int to)
+   {
+      return to >= from ? v * ((int64_t)1 << (to >= from ? to - from : 0)) : v >> (to >= from ? 0 : from - to);
+   }
+
+private:
+   constexpr Fixed(int32_t r, int): raw(r) {}
+
+   static constexpr int32_t SaturateFloat(double v)
+   {
+      return v >= MaxRaw() ? MaxRaw() : v <= MinRaw() ? MinRaw() : (int32_t)(v < 0 ? v - 0.5 : v + 0.5);
+   }
+
+   static constexpr int32_t Divide(int64_t n, int32_t d)
+   {
+      return d != 0 ? Saturate(n / d) : n < 0 ? MinRaw() : MaxRaw();
+   }
+
+   int32_t raw;
+};
+
+/** @brief a * b in the result format R, no overflow in between */
+template <class R, int IA, int FA, int IB, int FB>
+constexpr R Mul(Fixed<IA, FA> a, Fixed<IB, FB> b)
+{
+   return R::FromRaw(R::Saturate(R::Rescale((int64_t)a.Raw() * b.Raw(), FA + FB, R::FRAC_BITS)));
+}
+
+/** @brief a / b in the result format R, saturates on division by 0 */
+template <class R, int IA, int FA, int IB, int FB>
+constexpr R Div(Fixed<IA, FA> a, Fixed<IB, FB> b)
+{
+   static_assert(R::FRAC_BITS + FB - FA <= 32, "Div: dividend would need more than 64 bit");
+   return b.Raw() != 0 ? R::FromRaw(R::Saturate(R::Rescale(a.Raw(), FA, R::FRAC_BITS + FB) / b.Raw()))
+                       : a.Raw() < 0 ? R::Min() : R::Max();
+}
+
+#endif // FIXED_H_INCLUDED
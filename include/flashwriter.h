@@ -0,0 +1,102 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLASHWRITER_H
+#define FLASHWRITER_H
+#include <stdint.h>
+
+#ifndef FLASHWRITER_MAX_JOBS
+#define FLASHWRITER_MAX_JOBS 4 //Must be a power of 2
+#endif
+
+#ifndef FLASHWRITER_WORDS_PER_RUN
+#define FLASHWRITER_WORDS_PER_RUN 8 //about 0.5 ms on STM32F1
+#endif
+
+/** @brief Erases and programs flash in small steps with interrupts enabled
+ *
+ * Jobs are queued and processed by Run() which must be called periodically,
+ * e.g. from a 10 ms scheduler task. Each call programs at most
+ * FLASHWRITER_WORDS_PER_RUN words or checks on a running page erase.
+ * Note that on single bank parts like the STM32F1 the CPU stalls on any
+ * flash access while the flash is busy. A page erase blocks code execution
+ * from flash, including interrupts, for up to 40 ms, so erase jobs must not
+ * be queued while the motor is running. Programming stalls for about 50 us
+ * per word.
+ */
+class FlashWriter
+{
+   public:
+      /** @brief Called when a job has finished
+       * @param ok true when all words read back correctly
+       * @param crc CRC of the programmed range, 0 for erase jobs
+       */
+      typedef void (*Callback)(bool ok, uint32_t crc);
+
+      /** @brief Queue erase of one flash page
+       * @return true if queued, false if queue is full
+       */
+      static bool Erase(uint32_t address, Callback callback = 0);
+
+      /** @brief Queue programming of words to flash
+       * @param address destination address, must be erased
+       * @param data source data, must stay valid until the callback is called
+       * @param words number of words to program
+       * @return true if queued, false if queue is full
+       */
+      static bool Program(uint32_t address, const uint32_t* data, uint32_t words, Callback callback = 0);
+
+      /** @brief Process queued jobs in bounded steps, call periodically */
+      static void Run();
+
+      /** @brief Process all queued jobs to completion, blocking
+       * Must be called from the main loop, Run() does nothing while flushing
+       */
+      static void Flush();
+
+      /** @return true if jobs are pending */
+      static bool IsBusy() { return jobIn != jobOut; }
+
+   private:
+      enum JobType { JOB_ERASE, JOB_PROGRAM };
+      enum State { IDLE, ERASING, PROGRAMMING };
+
+      struct Job
+      {
+         JobType type;
+         uint32_t address;
+         const uint32_t* data;
+         uint32_t words;
+         Callback callback;
+      };
+
+      static bool Queue(JobType type, uint32_t address, const uint32_t* data, uint32_t words, Callback callback);
+      static void Step();
+      static void Complete(bool ok, uint32_t crc);
+      static uint32_t Crc32(const uint32_t* data, uint32_t words);
+
+      static Job jobs[FLASHWRITER_MAX_JOBS];
+      //Non-wrapping indexes, jobIn is only written by Queue(), jobOut only by Run()
+      static volatile uint8_t jobIn;
+      static volatile uint8_t jobOut;
+      static State state;
+      static uint32_t position;
+      static volatile bool flushing;
+};
+
+#endif // FLASHWRITER_H
@@ -0,0 +1,161 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FMT_H
+#define FMT_H
+#include <stdint.h>
+#include "printf.h"
+#include "my_fp.h"
+
+/** @brief Type checked formatting with the format string parsed at compile time
+ *
+ * FORMAT(out, "\"%s\":%f,\"id\":%u", name, Fmt::Fixed(value), id);
+ *
+ * Supports the conversions of printf.cpp: %s %c %d %u %x %X %f and %%, with
+ * optional '-', '0' and width. The format string is split into literal runs
+ * and conversions by the compiler, at run time only the arguments are
+ * converted and every piece goes to IPutChar::PutBuffer().
+ *
+ * Arguments must match their conversion, otherwise compilation fails:
+ * %s takes a string, %c a char, %d signed integers, %u unsigned integers,
+ * %x/%X any integer. %f takes Fmt::Fixed, so a plain integer can no longer be
+ * printed as fixed point by mistake. The number of arguments is checked, too.
+ */
+#define FORMAT(out, ...) \
+   Fmt::Format(out, []() { struct S { static constexpr const char* Get() { return FMT_FIRST(__VA_ARGS__, 0); } }; return S(); }(), __VA_ARGS__)
+
+/* The format string is part of __VA_ARGS__, so calls without arguments are valid C++11 */
+#define FMT_FIRST(fmt, ...) fmt
+
+namespace Fmt
+{
+   /** @brief Fixed point argument for %f */
+   struct Fixed
+   {
+      explicit Fixed(s32fp v): value(v) {}
+      s32fp value;
+   };
+
+   enum { LEFT = 1, ZERO = 2 };
+
+   /* Run time part, see fmt.cpp */
+   void PutPadded(IPutChar* out, const char* str, int len, int width, int flags);
+   void PutString(IPutChar* out, const char* str, int width, int flags);
+   void PutInt(IPutChar* out, uint32_t value, bool negative, int base, bool upper, int width, int flags);
+   void PutFixed(IPutChar* out, s32fp value, int width, int flags);
+
+   /* Compile time format string parser. C++11 constexpr, so recursion instead of loops */
+   constexpr int FindSpec(const char* s, int i) { return s[i] == 0 || s[i] == '%' ? i : FindSpec(s, i + 1); }
+   constexpr int SkipMinus(const char* s, int i) { return s[i] == '-' ? i + 1 : i; }
+   constexpr int SkipZeros(const char* s, int i) { return s[i] == '0' ? SkipZeros(s, i + 1) : i; }
+   constexpr int SkipDigits(const char* s, int i) { return s[i] >= '0' && s[i] <= '9' ? SkipDigits(s, i + 1) : i; }
+   constexpr int Width(const char* s, int i, int acc) { return s[i] >= '0' && s[i] <= '9' ? Width(s, i + 1, acc * 10 + s[i] - '0') : acc; }
+   /** Index of conversion character of the spec starting at '%' at index i */
+   constexpr int ConvPos(const char* s, int i) { return SkipDigits(s, SkipZeros(s, SkipMinus(s, i + 1))); }
+   constexpr int SpecWidth(const char* s, int i) { return Width(s, SkipZeros(s, SkipMinus(s, i + 1)), 0); }
+   constexpr int SpecFlags(const char* s, int i)
+   {
+      return (s[i + 1] == '-' ? LEFT : 0) | (s[SkipMinus(s, i + 1)] == '0' ? ZERO : 0);
+   }
+   /** Conversion character, 0 at end of format string */
+   constexpr char Conv(const char* s, int i) { return s[i] == 0 ? 0 : s[ConvPos(s, i)]; }
+
+   template <char C> struct ConvTag {};
+
+   /* Which argument types a conversion accepts */
+   template <char C, typename T> struct Accepts { static const bool value = false; };
+   template <> struct Accepts<'s', const char*> { static const bool value = true; };
+   template <> struct Accepts<'s', char*> { static const bool value = true; };
+   template <> struct Accepts<'c', char> { static const bool value = true; };
+   template <> struct Accepts<'f', Fixed> { static const bool value = true; };
+
+   template <typename T> struct IntType { static const bool isInt = false; static const bool isSigned = false; };
+   template <> struct IntType<signed char> { static const bool isInt = true; static const bool isSigned = true; };
+   template <> struct IntType<short> { static const bool isInt = true; static const bool isSigned = true; };
+   template <> struct IntType<int> { static const bool isInt = true; static const bool isSigned = true; };
+   template <> struct IntType<long> { static const bool isInt = true; static const bool isSigned = true; };
+   template <> struct IntType<unsigned char> { static const bool isInt = true; static const bool isSigned = false; };
+   template <> struct IntType<unsigned short> { static const bool isInt = true; static const bool isSigned = false; };
+   template <> struct IntType<unsigned int> { static const bool isInt = true; static const bool isSigned = false; };
+   template <> struct IntType<unsigned long> { static const bool isInt = true; static const bool isSigned = false; };
+
+   template <typename T> struct Accepts<'d', T> { static const bool value = IntType<T>::isSigned || (IntType<T>::isInt && sizeof(T) < sizeof(int)); };
+   template <typename T> struct Accepts<'u', T> { static const bool value = IntType<T>::isInt && !IntType<T>::isSigned; };
+   template <typename T> struct Accepts<'x', T> { static const bool value = IntType<T>::isInt; };
+   template <typename T> struct Accepts<'X', T> { static const bool value = IntType<T>::isInt; };
+
+   inline void Put(ConvTag<'s'>, IPutChar* out, const char* v, int w, int f) { PutString(out, v ? v : "(null)", w, f); }
+   inline void Put(ConvTag<'c'>, IPutChar* out, char v, int w, int f) { PutPadded(out, &v, 1, w, f); }
+   inline void Put(ConvTag<'f'>, IPutChar* out, Fixed v, int w, int f) { PutFixed(out, v.value, w, f); }
+   template <typename T> void Put(ConvTag<'d'>, IPutChar* out, T v, int w, int f) { PutInt(out, v < 0 ? 0u - (uint32_t)v : (uint32_t)v, v < 0, 10, false, w, f); }
+   template <typename T> void Put(ConvTag<'u'>, IPutChar* out, T v, int w, int f) { PutInt(out, v, false, 10, false, w, f); }
+   template <typename T> void Put(ConvTag<'x'>, IPutChar* out, T v, int w, int f) { PutInt(out, v, false, 16, false, w, f); }
+   template <typename T> void Put(ConvTag<'X'>, IPutChar* out, T v, int w, int f) { PutInt(out, v, false, 16, true, w, f); }
+
+   template <class S, int Pos, typename... Args> void Emit(IPutChar* out, Args... args);
+
+   /* End of format string */
+   template <class S, int Spec> void EmitConv(ConvTag<0>, IPutChar*) {}
+
+   template <class S, int Spec, typename T, typename... Rest>
+   void EmitConv(ConvTag<0>, IPutChar*, T, Rest...)
+   {
+      static_assert(sizeof(T) == 0, "FORMAT: more arguments than conversions");
+   }
+
+   template <class S, int Spec, typename... Args>
+   void EmitConv(ConvTag<'%'>, IPutChar* out, Args... args)
+   {
+      out->PutChar('%');
+      Emit<S, ConvPos(S::Get(), Spec) + 1>(out, args...);
+   }
+
+   template <class S, int Spec, char C>
+   void EmitConv(ConvTag<C>, IPutChar*)
+   {
+      static_assert(C == 0, "FORMAT: fewer arguments than conversions");
+   }
+
+   template <class S, int Spec, char C, typename T, typename... Rest>
+   void EmitConv(ConvTag<C>, IPutChar* out, T arg, Rest... rest)
+   {
+      static_assert(Accepts<C, T>::value, "FORMAT: argument type does not match conversion");
+      Put(ConvTag<C>(), out, arg, SpecWidth(S::Get(), Spec), SpecFlags(S::Get(), Spec));
+      Emit<S, ConvPos(S::Get(), Spec) + 1>(out, rest...);
+   }
+
+   /** Put literal run up to next conversion, then the conversion */
+   template <class S, int Pos, typename... Args>
+   void Emit(IPutChar* out, Args... args)
+   {
+      const int spec = FindSpec(S::Get(), Pos);
+
+      if (spec > Pos)
+         out->PutBuffer(S::Get() + Pos, spec - Pos);
+      EmitConv<S, FindSpec(S::Get(), Pos)>(ConvTag<Conv(S::Get(), FindSpec(S::Get(), Pos))>(), out, args...);
+   }
+
+   /** The format string is passed again at run time and ignored, S has it at compile time */
+   template <class S, typename... Args>
+   void Format(IPutChar* out, S, const char*, Args... args)
+   {
+      Emit<S, 0>(out, args...);
+   }
+}
+
+#endif // FMT_H
@@ -21,10 +21,13 @@
 
 #include <stdint.h>
 #include "my_fp.h"
+#include "fixed.h"
 
 class FOC
 {
    public:
+      typedef Fixed<1, 15> Unit; //sine, cosine and constants below 2
+
       static void SetAngle(uint16_t angle);
       static void ParkClarke(s32fp il1, s32fp il2);
       static int32_t GetQLimit(int32_t maxVd);
@@ -40,11 +43,8 @@ class FOC
 
    protected:
    private:
-      static uint32_t sqrt(uint32_t rad);
-      static float floatSqrt(float rad);
-      static int getexp(float f);
-      static s32fp sin;
-      static s32fp cos;
+      static Unit sin;
+      static Unit cos;
 };
 
 #endif // FOC_H
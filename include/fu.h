@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include "my_fp.h"
+#include "fixed.h"
 
 class MotorVoltage
 {
@@ -32,9 +33,12 @@ public:
    static uint32_t GetAmpPerc(u32fp frq, u32fp perc);
 
 private:
+   typedef Fixed<31 - FRAC_DIGITS, FRAC_DIGITS> Frq;
+   typedef Fixed<21, 10> Slope; //digit per Hz, up to 2^21 for weakening frequencies down to 1 LSB
+
    static void CalcFac();
    static uint32_t boost;
-   static u32fp fac;
+   static Slope fac;
    static uint32_t maxAmp;
    static u32fp endFrq;
    static u32fp maxFrq;
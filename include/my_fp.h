@@ -33,7 +33,12 @@
 #define CST_ICONVERT(a) ((a) >> (CST_DIGITS - FRAC_DIGITS))
 
 #define UTOA_FRACDEC 100
+#ifndef FP_DECIMALS
 #define FP_DECIMALS 2
+#endif
+#define FP_MAX_DECIMALS 9
+/** Buffer size for fp_itoa_dec(), sign, 10 digits, point, decimals and terminator */
+#define FP_ITOA_BUFSIZE(decimals) (13 + (decimals))
 
 #define FP_TOFLOAT(a) (((float)a) / FRAC_FAC)
 #define FP_FROMINT(a) ((s32fp)((a) << CST_DIGITS))
@@ -53,7 +58,12 @@ extern "C"
 {
 #endif
 
+/** @brief Convert to string with FP_DECIMALS decimals, rounded half away from zero */
 char* fp_itoa(char * buf, s32fp a);
+/** @brief Convert to string with 0 to FP_MAX_DECIMALS decimals, rounded half away from zero
+ * @param buf at least FP_ITOA_BUFSIZE(decimals) bytes */
+char* fp_itoa_dec(char * buf, s32fp a, int decimals);
+/** @brief Parse decimal string, rounded to the nearest value with fracDigits fractional bits */
 s32fp fp_atoi(const char *str, int fracDigits);
 u32fp fp_sqrt(u32fp rad);
 s32fp fp_ln(unsigned int x);
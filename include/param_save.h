@@ -24,7 +24,10 @@ extern "C"
 {
 #endif
 
+typedef void (*parm_save_callback)(int ok, uint32_t crc);
+
 uint32_t parm_save(void);
+int parm_save_async(parm_save_callback done);
 int parm_load(void);
 
 #ifdef __cplusplus
@@ -28,6 +28,7 @@ namespace Param
    #define PARAM_ENTRY(category, name, unit, min, max, def, id) name,
    #define TESTP_ENTRY(category, name, unit, min, max, def, id) name,
    #define VALUE_ENTRY(name, unit, id) name,
+   #define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) name,
    typedef enum
    {
        PARAM_LIST
@@ -37,6 +38,7 @@ namespace Param
    #undef PARAM_ENTRY
    #undef TESTP_ENTRY
    #undef VALUE_ENTRY
+   #undef ARRAY_ENTRY
 
    typedef enum
    {
@@ -51,6 +53,44 @@ namespace Param
       TYPE_SPOTVALUE,
    } PARAM_TYPE;
 
+   typedef enum
+   {
+      QUERY_ALL = 0,
+      QUERY_HIDDEN = 1,     //!< Include hidden parameters
+      QUERY_VALUES = 2,     //!< Only output values
+      QUERY_META = 4,       //!< Only output metadata, no values
+      QUERY_CATEGORIES = 8  //!< Only output list of category names
+   } QUERY_FLAG;
+
+   #define CATEGORY_ALL  0xFF
+   #define CATEGORY_NONE 0xFE
+
+   /** Selects part of the parameter database for output */
+   typedef struct
+   {
+      uint8_t flags;    //!< Combination of QUERY_FLAG
+      uint8_t category; //!< Category index or CATEGORY_ALL
+      uint16_t first;   //!< First parameter index
+      uint16_t last;    //!< Last parameter index (inclusive)
+      uint32_t since;   //!< Only parameters changed after this generation, 0 for all
+   } Query;
+
+   typedef enum
+   {
+      UPDATE_OK = 0,
+      UPDATE_INVALID_PARAM,
+      UPDATE_INVALID_ELEMENT,
+      UPDATE_OUT_OF_RANGE
+   } UPDATE_STATUS; //!< Result of one value in SetMultiple()
+
+   /** One value for SetMultiple() */
+   typedef struct
+   {
+      PARAM_NUM param;
+      uint8_t element; //!< Element index, 0 for scalar parameters
+      s32fp value;
+   } Update;
+
    typedef struct
    {
       char const *category;
@@ -60,7 +100,8 @@ namespace Param
       s32fp max;
       s32fp def;
       uint16_t id;
-      uint16_t type;
+      uint8_t type;
+      uint8_t length; //!< Number of elements, 1 for scalar parameters
    } Attributes;
 
    int    Set(PARAM_NUM ParamNum, s32fp ParamVal);
@@ -71,6 +112,13 @@ namespace Param
    void   SetInt(PARAM_NUM ParamNum, int ParamVal);
    void   SetFixed(PARAM_NUM ParamNum, s32fp ParamVal);
    void   SetFloat(PARAM_NUM ParamNum, float ParamVal);
+   int    SetElement(PARAM_NUM ParamNum, uint32_t element, s32fp ParamVal);
+   void   SetElementFixed(PARAM_NUM ParamNum, uint32_t element, s32fp ParamVal);
+   int    CheckMultiple(const Update* updates, uint32_t count, uint8_t* status);
+   int    SetMultiple(const Update* updates, uint32_t count, uint8_t* status);
+   s32fp  GetElement(PARAM_NUM ParamNum, uint32_t element);
+   const s32fp* GetArray(PARAM_NUM ParamNum, uint32_t& length);
+   uint32_t GetLength(PARAM_NUM ParamNum);
    PARAM_NUM NumFromString(const char *name);
    PARAM_NUM NumFromId(uint32_t id);
    const Attributes *GetAttrib(PARAM_NUM ParamNum);
@@ -81,6 +129,15 @@ namespace Param
    PARAM_FLAG GetFlag(PARAM_NUM param);
    PARAM_TYPE GetType(PARAM_NUM param);
    uint32_t GetIdSum();
+   uint32_t GetSchemaHash();
+   uint32_t GetGeneration();
+   uint32_t GetParamGeneration(PARAM_NUM param);
+   uint8_t GetCategory(PARAM_NUM param);
+   const char* GetCategoryName(uint8_t category);
+   uint8_t GetNumCategories();
+   uint8_t CategoryFromString(const char* name);
+   void InitQuery(Query& query);
+   bool MatchesQuery(PARAM_NUM param, const Query& query);
 
    //User defined callback
    void Change(Param::PARAM_NUM ParamNum);
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PARAMSTREAMER_H
+#define PARAMSTREAMER_H
+#include <stdint.h>
+#include "params.h"
+#include "terminal.h"
+
+#ifndef PARAMSTREAM_MAX_VALUES
+#define PARAMSTREAM_MAX_VALUES 32
+#endif
+
+#ifndef PARAMSTREAM_KEYFRAME_INTERVAL
+#define PARAMSTREAM_KEYFRAME_INTERVAL 50 //Delta format sends absolute values every n samples
+#endif
+
+#ifndef PARAMSTREAM_BUFSIZE
+#define PARAMSTREAM_BUFSIZE 256 //Sample buffer in words, must be a power of 2
+#endif
+
+/** @brief Streams parameter values in the background
+ *
+ * Values are sampled by Tick() which must be called from a periodic scheduler
+ * task. Every decimation-th call takes a sample with the number of Tick()
+ * calls since Start() as time stamp. Samples are buffered and printed from
+ * Terminal::Run(), so the terminal keeps accepting commands while streaming.
+ *
+ * Text samples are printed as "tick,value1,value2...\r\n", binary samples as
+ * one uint32_t time stamp followed by one raw s32fp per value.
+ *
+ * In delta format all numbers are sent as varint, 7 bits per byte LSB first
+ * with bit 7 set on all but the last byte. A keyframe is 0xA5 followed by the
+ * time stamp and the zigzag encoded ((v << 1) ^ (v >> 31)) values. All other
+ * samples start with the time stamp difference shifted left by one, so the
+ * first byte is even, followed by the zigzag encoded differences to the
+ * previous values. A value that changes by a few LSB takes one byte instead
+ * of four. tools/streamdecode.py decodes this format.
+ */
+class ParamStreamer
+{
+   public:
+      enum Format
+      {
+         FORMAT_TEXT,
+         FORMAT_BINARY,
+         FORMAT_DELTA
+      };
+
+      enum { DELTA_KEYFRAME = 0xA5 };
+
+      /** @brief Start streaming, replaces a running stream
+       * @param term terminal to print to, 0 to only buffer samples for Print()
+       * @param params parameters to stream
+       * @param numParams number of parameters, at most PARAMSTREAM_MAX_VALUES
+       * @param decimation sample every n-th call of Tick()
+       * @param repetitions number of samples, -1 for continuous streaming
+       * @param format output format
+       */
+      static void Start(Terminal* term, const Param::PARAM_NUM* params, int numParams, uint16_t decimation, int32_t repetitions, Format format);
+      static void Stop();
+      /** @brief Take a sample if due, call from a periodic scheduler task */
+      static void Tick();
+      /** @brief Print buffered samples, called from Terminal::Run() */
+      static void Run(Terminal* term);
+      /** @brief Print buffered samples to out */
+      static void Print(IPutChar* out);
+      static bool IsRunning() { return running; }
+      /** @brief Number of samples dropped because the buffer was full */
+      static uint32_t GetOverruns() { return overruns; }
+
+   private:
+      static void PrintDelta(IPutChar* out, uint32_t t);
+      static void PutVarint(IPutChar* out, uint32_t value);
+
+      static volatile bool running;
+      static Format format;
+      static uint32_t lastValues[PARAMSTREAM_MAX_VALUES];
+      static uint32_t lastTick;
+      static uint16_t samplesToKeyframe;
+      static Terminal* terminal;
+      static Param::PARAM_NUM params[PARAMSTREAM_MAX_VALUES];
+      static int numParams;
+      static uint16_t decimation;
+      static uint16_t ticksToSample;
+      static int32_t repetitions;
+      static uint32_t ticks;
+      static uint32_t overruns;
+      static volatile uint32_t head;
+      static volatile uint32_t tail;
+      static uint32_t samples[PARAMSTREAM_BUFSIZE];
+};
+
+#endif // PARAMSTREAMER_H
@@ -29,6 +29,12 @@ class IPutChar
 {
 public:
    virtual void PutChar(char c) = 0;
+   /** Put character if there is room, never waits. Returns false when full */
+   virtual bool TryPutChar(char c) { PutChar(c); return true; }
+   /** Put len characters, override to copy blocks instead of calling PutChar() for each */
+   virtual void PutBuffer(const char* buf, int len) { for (int i = 0; i < len; i++) PutChar(buf[i]); }
+   /** Put as many characters as there is room for, never waits. Returns number of characters put */
+   virtual int TryPutBuffer(const char* buf, int len) { int i = 0; while (i < len && TryPutChar(buf[i])) i++; return i; }
 };
 
 
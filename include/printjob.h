@@ -0,0 +1,80 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PRINTJOB_H
+#define PRINTJOB_H
+#include <stdint.h>
+#include "coroutine.h"
+#include "params.h"
+#include "canmap.h"
+
+/** @brief Prints parameter JSON or the CAN map without waiting for the output
+ *
+ * Resume() prints until the output is full and continues where it left off on
+ * the next call. For CAN SDO string transfers hand the job to CanSdo and resume
+ * it from the main loop:
+ *
+ * if (canSdo->GetPrintRequest() == PRINT_JSON)
+ * {
+ *    sdoJob.StartJson(canSdo->GetPrintQuery(), canMap);
+ *    canSdo->SetPrintJob(&sdoJob);
+ * }
+ * canSdo->RunPrintJob();
+ *
+ * TerminalCommands::PrintParamsJson(CanSdo*, query) does exactly that.
+ */
+class PrintJob: public Resumable
+{
+public:
+   PrintJob(): state(0), type(JOB_NONE) {}
+   /** @brief Start printing parameters as JSON, see TerminalCommands::PrintParamsJson() */
+   void StartJson(const Param::Query& query, CanMap* canMap);
+   /** @brief Start printing CAN map as terminal commands */
+   void StartCanMap(CanMap* canMap);
+   bool Resume(IPutChar* out) override;
+   /** @brief Print everything, waiting for the output when it is full */
+   void RunBlocking(IPutChar* out);
+   bool IsRunning() { return type != JOB_NONE; }
+
+private:
+   enum Type { JOB_NONE, JOB_JSON, JOB_VALUES, JOB_CATEGORIES, JOB_CANMAP };
+
+   bool Header();
+   bool EntryStart();
+   bool Element();
+   bool EntryEnd();
+   bool Footer();
+   bool Category();
+   bool CanMapEntry();
+   uint32_t NumElements();
+
+   CoState state;
+   uint8_t type;
+   char comma;
+   bool rx;
+   uint8_t message;
+   uint8_t item;
+   uint16_t idx;
+   uint8_t element;
+   s32fp value; //!< value of current chunk, must not change when it is printed again
+   Param::Query query;
+   CanMap* canMap;
+   ResumableOutput out;
+};
+
+#endif // PRINTJOB_H
@@ -29,11 +29,23 @@ class SdoCommands
       static void ProcessStandardCommands(CanSdo::SdoFrame* sdoFrame);
       static void EnableSaving() { saveEnabled = true; }
       static void DisableSaving() { saveEnabled = false; }
+      /** @brief Allow saving parameters in run mode through FlashWriter
+       * Only call this once FlashWriter::Run() is called periodically.
+       * The save command is acknowledged when queued, reading subindex 0
+       * of SDO_INDEX_COMMANDS returns the result: 0 stored, 1 running, 2 failed
+       */
+      static void EnableAsyncSave() { asyncSaveEnabled = true; }
       static void SetCanMap(CanMap* m) { canMap = m; }
 
    private:
+      enum { SAVE_DONE, SAVE_RUNNING, SAVE_FAILED };
+
+      static void AsyncSaveDone(int ok, uint32_t crc);
+
       static CanMap* canMap;
       static bool saveEnabled;
+      static bool asyncSaveEnabled;
+      static volatile uint8_t asyncSaveState;
 };
 
 #endif // SDOCOMMANDS_H
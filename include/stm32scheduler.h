@@ -20,24 +20,73 @@
 #define STM32SCHEDULER_H
 #include <stdint.h>
 #include <libopencm3/stm32/timer.h>
+#include "errormessage.h"
 
-#define MAX_TASKS 4
+#ifndef MAX_TASKS
+#define MAX_TASKS 16
+#endif
 
-/** @brief Schedules up to 4 tasks using a timer peripheral */
+/** @brief Schedules up to MAX_TASKS periodic tasks using one timer channel
+ *
+ * Compare channel 1 generates a 1 ms tick. Tasks are kept in a hierarchical
+ * timing wheel of WHEEL_LEVELS levels with WHEEL_SLOTS slots each, level 0
+ * covers the next 32 ms, every further level 32 times as much. A slot is a bit
+ * mask of due tasks, so each tick costs one slot lookup plus the tasks that
+ * are due, and tasks due at the same tick run in the order they were added.
+ * Every 32 ms the next slot of the level above is moved down.
+ *
+ * Every task run is timed with the DWT cycle counter where the core has one,
+ * otherwise with the scheduler timer at 10 us resolution. Per task statistics
+ * are read with GetStatistic(), e.g. to publish them as spot values, or via
+ * SDO when the scheduler is passed to CanSdo::SetScheduler().
+ *
+ * When the tasks of a tick take longer than the tick, the following ticks
+ * are late. Run() checks this once per tick after all tasks ran and then
+ * handles the missed ticks according to SetOverrunPolicy(), so the compare
+ * value never falls behind the counter.
+ */
 class Stm32Scheduler
 {
    public:
-      /** @brief construct a new scheduler using given timer
+      /** @brief construct a new scheduler using given timer and start the tick
        * @pre Timer clock and NVIC interrupt must be enabled
        * @param timer Address of timer peripheral to use
        */
       Stm32Scheduler(uint32_t timer);
 
-      /** @brief Add a periodic task, can be called up to 4 times
+      /** @brief Statistics of a task, all times in us */
+      enum Statistic
+      {
+         STAT_PERIOD,      //!< Calling period in ms
+         STAT_RUNS,        //!< Number of runs since last reset
+         STAT_EXEC_MIN,    //!< Shortest execution time
+         STAT_EXEC_MAX,    //!< Longest execution time
+         STAT_EXEC_MEAN,   //!< Mean execution time
+         STAT_EXEC_LAST,   //!< Execution time of last run
+         STAT_JITTER_MAX,  //!< Longest delay of start after the tick it was due at
+         STAT_JITTER_MEAN, //!< Mean delay of start
+         STAT_OVERRUNS,    //!< Runs that took longer than the period
+         STAT_SKIPPED,     //!< Releases dropped because their tick was missed
+         STAT_HISTOGRAM,   //!< First of HIST_BINS jitter histogram bins, see HistogramBin()
+         STAT_LAST = STAT_HISTOGRAM + 8
+      };
+
+      static const int HIST_BINS = STAT_LAST - STAT_HISTOGRAM;
+
+      /** @brief What to do with ticks that passed while tasks were still running */
+      enum OverrunPolicy
+      {
+         OVERRUN_SKIP,    //!< Drop the releases of all missed ticks
+         OVERRUN_CATCHUP  //!< Run missed ticks back to back, up to a limit
+      };
+
+      /** @brief Add a periodic task
        * @param function the task function
-       * @param period The calling period in ms, maximum 655
+       * @param period The calling period in ms, maximum MAX_PERIOD
+       * @param offset Delay of the first call in ms, spreads tasks of the same period over different ticks
+       * @return task number for GetStatistic() or -1 if MAX_TASKS are already added
        */
-      void AddTask(void (*function)(void), uint16_t period);
+      int AddTask(void (*function)(void), uint32_t period, uint32_t offset = 0);
 
       /** @brief Run the scheduler, must be called by the scheduler timer ISR */
       void Run();
@@ -47,13 +96,81 @@ class Stm32Scheduler
        */
       int GetCpuLoad();
 
+      /** @brief Return number of added tasks */
+      int GetNumTasks() { return nextTask; }
+
+      /** @brief Return a timing statistic of a task
+       * Briefly masks the tick interrupt to read a consistent record
+       * @param task task number as returned by AddTask()
+       * @param stat which statistic, STAT_HISTOGRAM + n for histogram bin n
+       * @return statistic value or 0 for invalid task or statistic
+       */
+      uint32_t GetStatistic(int task, int stat);
+
+      /** @brief Set handling of missed ticks, default is catching up one tick
+       * @param policy skip or catch up missed ticks
+       * @param maxCatchUp catch up at most this many ticks per overrun, the rest is skipped
+       * @param error posted via ErrorMessage on every overrun, ERROR_NONE to not post anything
+       */
+      void SetOverrunPolicy(OverrunPolicy policy, int maxCatchUp = 1, ERROR_MESSAGE_NUM error = ERROR_NONE);
+
+      /** @brief Return number of ticks that started late since last reset */
+      uint32_t GetLateTicks() { return lateTicks; }
+
+      /** @brief Restart statistics of all tasks at the next tick, e.g. after changing their load */
+      void ResetStatistics();
+
+      /** @brief Histogram bin of a start delay
+       * Bin 0 counts delays below 16 us, bin n delays from 2^(n+3) us on,
+       * the last bin everything from 1024 us on
+       */
+      static int HistogramBin(uint32_t jitterUs);
+
+      static const int WHEEL_BITS = 5;
+      static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+      static const int WHEEL_LEVELS = 4;
+      static const uint32_t MAX_PERIOD = (1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1; //about 17 minutes
+
    protected:
    private:
-      static const enum tim_oc_id ocMap[MAX_TASKS];
+      struct TaskStats
+      {
+         uint32_t runs;
+         uint32_t execMin;
+         uint32_t execMax;
+         uint32_t execLast;
+         uint64_t execSum;
+         uint32_t jitterMax;
+         uint64_t jitterSum;
+         uint32_t overruns;
+         uint32_t skipped;
+         uint16_t histogram[HIST_BINS];
+      };
+
+      void StartTick();
+      void Tick(bool execute);
+      void HandleOverrun();
+      void Insert(int task);
+      uint32_t Timestamp();
+      uint32_t ElapsedUs(uint32_t from, uint32_t to);
+      void Record(int task, uint32_t jitterUs, uint32_t execUs);
+
       void (*functions[MAX_TASKS]) (void);
-      uint16_t periods[MAX_TASKS];
-      uint16_t execTicks[MAX_TASKS];
+      uint32_t periods[MAX_TASKS];
+      uint32_t dueTimes[MAX_TASKS];
+      TaskStats stats[MAX_TASKS];
+      uint32_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
       uint32_t timer;
+      uint32_t now;
+      uint16_t nextCompare;
+      bool useCycles;
+      uint32_t cyclesPerUs;
+      uint32_t tickStart; //!< Timestamp of the compare match of the current tick
+      OverrunPolicy overrunPolicy;
+      int maxCatchUp;
+      ERROR_MESSAGE_NUM overrunError;
+      uint32_t lateTicks;
+      volatile bool resetRequested;
       int nextTask;
 };
 
@@ -20,6 +20,19 @@
 #define TERMINAL_H
 #include <stdint.h>
 #include "printf.h"
+#include "coroutine.h"
+
+#ifndef TERMINAL_TX_BUFSIZE
+#define TERMINAL_TX_BUFSIZE 512 //Must be a power of 2
+#endif
+
+#ifndef TERMINAL_RX_BUFSIZE
+#define TERMINAL_RX_BUFSIZE 256 //Must be a power of 2
+#endif
+
+#ifndef TERMINAL_LINE_BUFSIZE
+#define TERMINAL_LINE_BUFSIZE 128 //Longest command line, raise for long "set a=1 b=2 ..." lines
+#endif
 
 class Terminal;
 
@@ -29,19 +42,60 @@ typedef struct
    void (*CmdFunc)(Terminal*, char*);
 } TERM_CMD;
 
+/** Receives all terminal input while in raw mode, e.g. a binary protocol */
+class IRawReceiver
+{
+public:
+   virtual void Receive(char c) = 0;
+};
+
 class Terminal: public IPutChar
 {
 public:
+   /** What PutChar() does when the transmit ring is full */
+   enum TxOverflow
+   {
+      TX_BLOCK, //wait until DMA has made room
+      TX_DROP   //discard the character and count it
+   };
+
    Terminal(uint32_t usart, const TERM_CMD* commands, bool remap = false, bool echo = true, bool allowFastUart = true);
    void SetNodeId(uint8_t id);
    void Run();
    void PutChar(char c);
+   bool TryPutChar(char c);
+   void PutBuffer(const char* buf, int len);
+   int TryPutBuffer(const char* buf, int len);
    void SendBinary(const uint8_t* data, uint32_t length);
    void SendBinary(const uint32_t* data, uint32_t length);
    bool KeyPressed();
    void FlushInput();
    void DisableTxDMA();
-   static Terminal* defaultTerminal;
+   /** \brief Pass all received bytes to receiver instead of the command interpreter */
+   void EnterRawMode(IRawReceiver* receiver) { rawReceiver = receiver; lineLen = 0; }
+   void LeaveRawMode() { rawReceiver = 0; }
+   /** \brief Set function that is called on every Run(), e.g. to print buffered data */
+   void SetBackgroundTask(void (*task)(Terminal*)) { backgroundTask = task; }
+   /** \brief Resume job on every Run() until finished, input is not processed meanwhile */
+   void SetJob(Resumable* j) { job = j; }
+   bool IsBusy() { return 0 != job; }
+   void SetTxOverflow(TxOverflow policy) { txOverflow = policy; }
+   /** \brief Get the maximum number of bytes that were waiting in the transmit ring */
+   uint32_t GetTxHighWater() { return txHighWater; }
+   /** \brief Get the number of bytes discarded with TX_DROP */
+   uint32_t GetTxDropped() { return txDropped; }
+   /** \brief Get the number of times received data was lost because Run() wasn't called often enough */
+   uint32_t GetRxOverruns() { return rxOverruns; }
+   void HandleTxComplete();
+   /** \brief Call from the TX DMA channel interrupt of the UART with the given index.
+    * Only needed when the project overrides the weak handlers defined in terminal.cpp
+    */
+   static void DmaIsr(int index);
+   /** \brief Index of the UART in the hardware table, 0 for USART1. Use it to keep per terminal state */
+   int GetIndex() { return hw - hwInfo; }
+   static Terminal* GetInterface(int index) { return interfaces[index]; }
+   static Terminal* defaultTerminal; //!< Output of printf()
+   static const int MAX_INTERFACES = 4;
 
 private:
    struct HwInfo
@@ -50,22 +104,29 @@ private:
       uint32_t dmactl;
       uint8_t dmatx;
       uint8_t dmarx;
+      uint8_t irqtx;
       uint32_t port;
       uint16_t pin;
       uint32_t port_re;
       uint16_t pin_re;
    };
 
-   void ResetDMA();
+   uint32_t RxHead();
+   void ExecuteLine();
    const TERM_CMD *CmdLookup(char *buf);
    void EnableUart(char* arg);
    void FastUart(char* arg);
    void Echo(char* arg);
    void Send(const char *str);
-   void SendCurrentBuffer(uint32_t len);
+   bool Enqueue(char c);
+   int CopyToRing(const char* buf, int len, bool& newline);
+   void StartTx();
+   void WaitTxSpace();
+   void FlushTx();
 
-   static const int bufSize = 128;
-   static const HwInfo hwInfo[];
+   static const int bufSize = TERMINAL_LINE_BUFSIZE;
+   static const HwInfo hwInfo[MAX_INTERFACES];
+   static Terminal* interfaces[MAX_INTERFACES];
    const HwInfo* hw;
    uint32_t usart;
    bool remap;
@@ -74,13 +135,23 @@ private:
    bool enabled;
    bool txDmaEnabled;
    const TERM_CMD *pCurCmd;
-   int lastIdx;
-   uint8_t curBuf;
-   uint32_t curIdx;
-   bool firstSend;
+   IRawReceiver* rawReceiver;
+   void (*backgroundTask)(Terminal*);
+   Resumable* job;
+   uint32_t rxTail;
+   uint32_t rxLastHead; //DMA position seen on the last RxHead() call
+   uint32_t rxOverruns;
+   int lineLen;
    bool echo;
-   char inBuf[bufSize];
-   char outBuf[2][bufSize]; //double buffering
+   TxOverflow txOverflow;
+   volatile uint32_t txHead; //free running, written by producer
+   volatile uint32_t txTail; //free running, written by DMA complete interrupt
+   volatile uint32_t txDmaLen; //bytes of current DMA transfer, 0 when idle
+   uint32_t txHighWater;
+   uint32_t txDropped;
+   char rxBuf[TERMINAL_RX_BUFSIZE]; //written by circular DMA
+   char inBuf[bufSize]; //line being assembled
+   char txBuf[TERMINAL_TX_BUFSIZE];
    char args[bufSize];
    bool allowFastUart;
 };
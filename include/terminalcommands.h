@@ -19,6 +19,15 @@
 #ifndef TERMINALCOMMANDS_H
 #define TERMINALCOMMANDS_H
 #include "canmap.h"
+#include "terminal.h"
+#include "paramstreamer.h"
+#include "printjob.h"
+
+class CanSdo;
+
+#ifndef PARAMSET_MAX_VALUES
+#define PARAMSET_MAX_VALUES 32 //!< Values per "set a=1 b=2" line, array elements count individually
+#endif
 
 class TerminalCommands
 {
@@ -28,8 +37,14 @@ class TerminalCommands
       static void ParamFlag(Terminal* term, char *arg);
       static void ParamStream(Terminal* term, char *arg);
       static void ParamStreamBinary(Terminal* term, char *arg);
+      static void ParamStreamDelta(Terminal* term, char *arg);
       static void PrintParamsJson(IPutChar* term, char *arg);
-      static void PrintParamsJson(Terminal* term, char *arg) { PrintParamsJson((IPutChar*)term, arg); }
+      static void PrintParamsJson(IPutChar* term, const Param::Query& query);
+      static void PrintParamsJson(Terminal* term, char *arg);
+      static void PrintParamsJson(CanSdo* sdo, const Param::Query& query);
+      static void PrintValuesJson(IPutChar* term, const Param::Query& query);
+      static void PrintValuesJson(CanSdo* sdo, const Param::Query& query);
+      static void PrintSchemaHash(Terminal* term, char *arg);
       static void MapCan(Terminal* term, char *arg);
       static void SaveParameters(Terminal* term, char *arg);
       static void LoadParameters(Terminal* term, char *arg);
@@ -37,14 +52,25 @@ class TerminalCommands
       static void SetCanMap(CanMap* m) { canMap = m; }
       static void EnableSaving() { saveEnabled = true; }
       static void DisableSaving() { saveEnabled = false; }
+      /** @brief Allow saving parameters in run mode through FlashWriter
+       * Only call this once FlashWriter::Run() is called periodically
+       */
+      static void EnableAsyncSave() { asyncSaveEnabled = true; }
 
    protected:
 
    private:
-      static void PrintCanMap(Param::PARAM_NUM param, uint32_t canid, uint8_t offsetBits, int8_t length, float gain, int8_t offset, bool rx);
+      static void ParamSetMultiple(Terminal* term, char* arg);
+      static void StartStream(Terminal* term, char* arg, ParamStreamer::Format format);
+      static bool ParseQuery(char* arg, Param::Query& query);
       static int ParamNamesToIndexes(char* names, Param::PARAM_NUM* indexes, uint32_t maxIndexes);
+      static Param::PARAM_NUM ParamNameToIndex(char* name, int& element);
+      static void PrintElements(IPutChar* term, Param::PARAM_NUM idx, const char* terminator);
       static CanMap* canMap;
+      static PrintJob jobs[Terminal::MAX_INTERFACES]; //!< One background job per terminal
+      static PrintJob sdoJob; //!< Job of the running SDO string upload
       static bool saveEnabled;
+      static bool asyncSaveEnabled;
 };
 
 #endif // TERMINALCOMMANDS_H
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+#include <stdint.h>
+
+#ifndef WORKQUEUE_SIZE
+#define WORKQUEUE_SIZE 16 //Items per priority level, must be a power of 2
+#endif
+
+/** @brief Deferred work posted by interrupt handlers
+ *
+ * An ISR posts a function and argument with Post() and returns, the function
+ * is called later from either the PendSV interrupt or the main loop. That
+ * keeps slow work like SDO processing out of the high priority interrupts
+ * of the current control loop.
+ *
+ * There is one queue per priority level. Run() always calls the oldest item
+ * of the highest non-empty level next. Post() is lock-free and can be called
+ * from any interrupt priority and the main loop, it reserves a slot with
+ * LDREX/STREX and publishes it with a sequence number, so it needs a
+ * Cortex-M3 or higher. Run() must only be called from one context:
+ *
+ * - PendSV: call UsePendSV() once and WorkQueue::Run() from pend_sv_handler().
+ *   Post() then pends PendSV, which runs as soon as no interrupt of higher
+ *   priority than the one given to UsePendSV() is active.
+ * - Main loop: call WorkQueue::Run() from the main loop.
+ */
+class WorkQueue
+{
+   public:
+      enum Priority
+      {
+         PRIO_HIGH,
+         PRIO_NORMAL,
+         PRIO_LOW,
+         PRIO_LAST
+      };
+
+      typedef void (*Function)(void* arg);
+
+      /** @brief Queue a function call
+       * @param function function to call
+       * @param arg argument passed to function
+       * @param prio priority level
+       * @return true if queued, false if the queue of that level is full
+       */
+      static bool Post(Function function, void* arg, Priority prio = PRIO_NORMAL);
+
+      /** @brief Drain queues from PendSV from now on
+       * @param nvicPriority NVIC priority of PendSV, lowest is 0xF0 on STM32
+       */
+      static void UsePendSV(uint8_t nvicPriority);
+
+      /** @return true when the queues are drained from PendSV, false when from the main loop */
+      static bool UsesPendSV() { return pendSV; }
+
+      /** @brief Call all queued functions, highest priority first
+       * @return number of functions called
+       */
+      static int Run();
+
+      /** @return Number of items that did not fit into their queue */
+      static uint32_t GetDropped() { return dropped; }
+
+   private:
+      struct Item
+      {
+         /** Round of the position this item is free for, round + 1 while filled.
+          * The round is the position without its low bits, so 0 means free at start */
+         uint32_t sequence;
+         Function function;
+         void* arg;
+      };
+
+      struct Queue
+      {
+         Item items[WORKQUEUE_SIZE];
+         uint32_t in;  //!< next position to fill, advanced by compare and swap
+         uint32_t out; //!< next position to call, only written by Run()
+      };
+
+      static bool Pop(Queue& queue);
+
+      static Queue queues[PRIO_LAST];
+      static bool pendSV;
+      static uint32_t dropped;
+};
+
+#endif // WORKQUEUE_H
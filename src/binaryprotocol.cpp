@@ -0,0 +1,474 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "binaryprotocol.h"
+#include "params.h"
+
+//See terminalcommands.cpp
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wregister"
+#include <libopencm3/cm3/cortex.h>
+#pragma GCC diagnostic pop
+
+#define HEADER_SIZE 2 //seq, cmd
+#define REPLY_HEADER_SIZE 3 //seq, cmd, status
+#define MAX_REPLY_DATA (BINPROTO_MAX_PAYLOAD - REPLY_HEADER_SIZE)
+
+#if BINPROTO_MAX_PAYLOAD > 252
+#error BINPROTO_MAX_PAYLOAD must be 252 or less
+#endif
+
+BinaryProtocol* BinaryProtocol::first;
+
+static uint16_t Get16(const uint8_t* d) { return d[0] | (d[1] << 8); }
+static uint32_t Get32(const uint8_t* d) { return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24); }
+static void Put16(uint8_t* d, uint16_t v) { d[0] = v; d[1] = v >> 8; }
+static void Put32(uint8_t* d, uint32_t v) { d[0] = v; d[1] = v >> 8; d[2] = v >> 16; d[3] = v >> 24; }
+
+BinaryProtocol::BinaryProtocol(CanMap* canMap, IPutChar* out)
+   : canMap(canMap), out(out), terminal(0), active(out != 0), rxOverflow(false), rxLen(0),
+     frameErrors(0), divider(1), ticks(0), streamSeq(0), numSubscribed(0)
+{
+   next = first;
+   first = this;
+}
+
+BinaryProtocol::~BinaryProtocol()
+{
+   for (BinaryProtocol** p = &first; 0 != *p; p = &(*p)->next)
+   {
+      if (*p == this)
+      {
+         *p = next;
+         break;
+      }
+   }
+}
+
+void BinaryProtocol::Enter(Terminal* term, char* arg)
+{
+   arg = arg;
+   BinaryProtocol* proto = first;
+
+   //Prefer the instance that last served this terminal, else any idle one
+   for (BinaryProtocol* p = first; 0 != p; p = p->next)
+   {
+      if (p->terminal == term) { proto = p; break; }
+   }
+
+   while (0 != proto && proto->active && proto->terminal != term)
+      proto = proto->next;
+
+   if (0 == proto) return;
+
+   proto->terminal = term;
+   proto->out = term;
+   proto->rxLen = 0;
+   proto->rxOverflow = false;
+   proto->numSubscribed = 0;
+   proto->active = true;
+   term->EnterRawMode(proto);
+}
+
+void BinaryProtocol::Exit()
+{
+   active = false;
+   numSubscribed = 0;
+
+   if (0 != terminal)
+      terminal->LeaveRawMode();
+}
+
+void BinaryProtocol::Receive(char c)
+{
+   if (0 == c) //frame delimiter
+   {
+      if (rxOverflow)
+         frameErrors++;
+      else if (rxLen > 0)
+         HandleFrame();
+
+      rxLen = 0;
+      rxOverflow = false;
+   }
+   else if (rxLen < sizeof(rxBuf))
+   {
+      rxBuf[rxLen++] = c;
+   }
+   else
+   {
+      rxOverflow = true;
+   }
+}
+
+void BinaryProtocol::Task()
+{
+   if (!active || 0 == numSubscribed) return;
+
+   if (++ticks < divider) return;
+
+   ticks = 0;
+   reply[0] = streamSeq++;
+   reply[1] = CMD_STREAM;
+
+   for (int i = 0; i < numSubscribed; i++)
+      Put32(&reply[HEADER_SIZE + 4 * i], Param::Get((Param::PARAM_NUM)subscribed[i]));
+
+   SendFrame(reply, HEADER_SIZE + 4 * numSubscribed);
+}
+
+void BinaryProtocol::HandleFrame()
+{
+   int len = CobsDecode(rxBuf, rxLen, rxBuf);
+
+   if (len < (HEADER_SIZE + 2) || Crc16(rxBuf, len - 2) != Get16(&rxBuf[len - 2]))
+   {
+      frameErrors++;
+      return;
+   }
+
+   uint8_t cmd = rxBuf[1];
+   uint8_t status = STATUS_OK;
+   uint32_t replyLen = HandleCommand(cmd, &rxBuf[HEADER_SIZE], len - HEADER_SIZE - 2, &reply[REPLY_HEADER_SIZE], status);
+
+   reply[0] = rxBuf[0];
+   reply[1] = cmd | CMD_REPLY;
+   reply[2] = status;
+   SendFrame(reply, REPLY_HEADER_SIZE + replyLen);
+
+   if (CMD_EXIT == cmd)
+      Exit();
+}
+
+uint32_t BinaryProtocol::HandleCommand(uint8_t cmd, const uint8_t* data, uint32_t len, uint8_t* reply, uint8_t& status)
+{
+   uint32_t replyLen = 0;
+
+   switch (cmd)
+   {
+   case CMD_HELLO:
+      reply[0] = BINPROTO_VERSION;
+      Put32(&reply[1], Param::GetSchemaHash());
+      Put16(&reply[5], Param::PARAM_LAST);
+      Put32(&reply[7], Param::GetGeneration());
+      replyLen = 11;
+      break;
+   case CMD_GET:
+   case CMD_GET_UID:
+      if ((len / 2) * 4 > MAX_REPLY_DATA)
+      {
+         status = STATUS_LENGTH;
+         break;
+      }
+
+      for (uint32_t i = 0; i + 1 < len; i += 2)
+      {
+         uint16_t key = Get16(&data[i]);
+         Param::PARAM_NUM idx = cmd == CMD_GET_UID ? Param::NumFromId(key) : (Param::PARAM_NUM)key;
+
+         if (idx >= Param::PARAM_LAST)
+         {
+            status = STATUS_INVALID_PARAM;
+            return replyLen;
+         }
+         Put32(&reply[replyLen], Param::Get(idx));
+         replyLen += 4;
+      }
+      break;
+   case CMD_SET:
+   case CMD_SET_UID:
+      reply[0] = 0;
+      replyLen = 1;
+
+      for (uint32_t i = 0; i + 5 < len; i += 6)
+      {
+         uint16_t key = Get16(&data[i]);
+         Param::PARAM_NUM idx = cmd == CMD_SET_UID ? Param::NumFromId(key) : (Param::PARAM_NUM)key;
+
+         if (idx >= Param::PARAM_LAST)
+            status = STATUS_INVALID_PARAM;
+         else if (Param::GetType(idx) == Param::TYPE_SPOTVALUE)
+            status = STATUS_READ_ONLY;
+         else if (Param::SetElement(idx, 0, (s32fp)Get32(&data[i + 2])) != 0)
+            status = STATUS_OUT_OF_RANGE;
+
+         if (STATUS_OK != status) break; //reply tells how many were set before
+         reply[0]++;
+      }
+      break;
+   case CMD_SET_MULTI:
+   {
+      Param::Update updates[BINPROTO_MAX_PAYLOAD / 7];
+      uint8_t results[BINPROTO_MAX_PAYLOAD / 7];
+      uint32_t count = len / 7;
+      int errors = 0;
+
+      if ((len % 7) != 0 || 0 == count)
+      {
+         status = STATUS_LENGTH;
+         break;
+      }
+
+      for (uint32_t i = 0; i < count; i++)
+      {
+         updates[i].param = Param::NumFromId(Get16(&data[7 * i]));
+         updates[i].element = data[7 * i + 2];
+         updates[i].value = (s32fp)Get32(&data[7 * i + 3]);
+         reply[i] = STATUS_OK;
+
+         if (updates[i].param < Param::PARAM_LAST && Param::GetType(updates[i].param) == Param::TYPE_SPOTVALUE)
+         {
+            reply[i] = STATUS_READ_ONLY;
+            errors++;
+         }
+      }
+
+      if (errors > 0)
+      {
+         errors += Param::CheckMultiple(updates, count, results);
+      }
+      else
+      {
+         cm_disable_interrupts();
+         errors = Param::SetMultiple(updates, count, results);
+         cm_enable_interrupts();
+      }
+
+      for (uint32_t i = 0; i < count; i++)
+      {
+         if (STATUS_OK == reply[i] && Param::UPDATE_INVALID_PARAM == results[i])
+            reply[i] = STATUS_INVALID_PARAM;
+         else if (STATUS_OK == reply[i] && Param::UPDATE_OK != results[i])
+            reply[i] = STATUS_OUT_OF_RANGE;
+
+         if (STATUS_OK == status) status = reply[i];
+      }
+      replyLen = count;
+
+      if (0 == errors)
+      {
+         bool single = true;
+
+         for (uint32_t i = 1; i < count; i++)
+            single &= updates[i].param == updates[0].param;
+         Param::Change(single ? updates[0].param : Param::PARAM_LAST);
+      }
+      break;
+   }
+   case CMD_READ_RANGE:
+   {
+      uint32_t first = len >= 2 ? Get16(data) : (uint32_t)Param::PARAM_LAST;
+      uint32_t count = len >= 3 ? data[2] : 0;
+
+      if (first >= Param::PARAM_LAST)
+      {
+         status = STATUS_INVALID_PARAM;
+         break;
+      }
+      if (first + count > Param::PARAM_LAST) count = Param::PARAM_LAST - first;
+      if (count > MAX_REPLY_DATA / 4) count = MAX_REPLY_DATA / 4;
+
+      for (uint32_t i = 0; i < count; i++)
+         Put32(&reply[4 * i], Param::Get((Param::PARAM_NUM)(first + i)));
+      replyLen = 4 * count;
+      break;
+   }
+   case CMD_SUBSCRIBE:
+      if (len < 2 || (len - 2) / 2 > BINPROTO_MAX_SUBSCRIPTIONS)
+      {
+         status = STATUS_LENGTH;
+         break;
+      }
+
+      numSubscribed = 0;
+      for (uint32_t i = 2; i + 1 < len; i += 2)
+      {
+         if (Get16(&data[i]) >= Param::PARAM_LAST)
+         {
+            numSubscribed = 0;
+            status = STATUS_INVALID_PARAM;
+            break;
+         }
+         subscribed[numSubscribed++] = Get16(&data[i]);
+      }
+      divider = Get16(data) > 0 ? Get16(data) : 1;
+      ticks = 0;
+      break;
+   case CMD_MAP_GET:
+   case CMD_MAP_ADD:
+   case CMD_MAP_REMOVE:
+      replyLen = HandleMap(cmd, data, len, reply, status);
+      break;
+   case CMD_EXIT:
+      break;
+   default:
+      status = STATUS_UNKNOWN_CMD;
+      break;
+   }
+   return replyLen;
+}
+
+uint32_t BinaryProtocol::HandleMap(uint8_t cmd, const uint8_t* data, uint32_t len, uint8_t* reply, uint8_t& status)
+{
+   if (0 == canMap)
+   {
+      status = STATUS_UNKNOWN_CMD;
+      return 0;
+   }
+
+   if (CMD_MAP_ADD == cmd)
+   {
+      float gain;
+
+      if (len < 14)
+      {
+         status = STATUS_LENGTH;
+         return 0;
+      }
+
+      Param::PARAM_NUM param = Param::NumFromId(Get16(&data[5]));
+      uint32_t gainBits = Get32(&data[9]);
+      memcpy(&gain, &gainBits, sizeof(gain));
+
+      if (Param::PARAM_INVALID == param)
+         status = STATUS_INVALID_PARAM;
+      else if (data[0])
+         status = canMap->AddRecv(param, Get32(&data[1]), data[7], data[8], gain, data[13]) < 0 ? STATUS_MAP_ERROR : STATUS_OK;
+      else
+         status = canMap->AddSend(param, Get32(&data[1]), data[7], data[8], gain, data[13]) < 0 ? STATUS_MAP_ERROR : STATUS_OK;
+      return 0;
+   }
+
+   if (len < 3)
+   {
+      status = STATUS_LENGTH;
+      return 0;
+   }
+
+   if (CMD_MAP_REMOVE == cmd)
+   {
+      status = canMap->Remove(data[0] != 0, data[1], data[2]) > 0 ? STATUS_OK : STATUS_MAP_ERROR;
+      return 0;
+   }
+
+   uint32_t canId;
+   const CanMap::CANPOS* pos = canMap->GetMap(data[0] != 0, data[1], data[2], canId);
+
+   if (0 == pos)
+   {
+      status = STATUS_MAP_ERROR; //also marks end of list
+      return 0;
+   }
+
+   uint32_t gainBits;
+   memcpy(&gainBits, &pos->gain, sizeof(gainBits));
+   Put32(&reply[0], canId);
+   Put16(&reply[4], Param::GetAttrib((Param::PARAM_NUM)pos->mapParam)->id);
+   reply[6] = pos->offsetBits;
+   reply[7] = pos->numBits;
+   Put32(&reply[8], gainBits);
+   reply[12] = pos->offset;
+   return 13;
+}
+
+void BinaryProtocol::SendFrame(uint8_t* data, uint32_t len)
+{
+   if (0 == out) return;
+
+   Put16(&data[len], Crc16(data, len));
+   len = CobsEncode(data, len + 2, frame);
+
+   for (uint32_t i = 0; i < len; i++)
+      out->PutChar(frame[i]);
+   out->PutChar(0);
+}
+
+/** @brief Encode data with consistent overhead byte stuffing
+ * @param in data to encode
+ * @param len length of data
+ * @param out encoded data, must hold len + len / 254 + 1 bytes
+ * @return length of encoded data, excluding the 0 delimiter
+ */
+uint32_t BinaryProtocol::CobsEncode(const uint8_t* in, uint32_t len, uint8_t* out)
+{
+   uint32_t codeIdx = 0, outIdx = 1;
+   uint8_t code = 1;
+
+   for (uint32_t i = 0; i < len; i++)
+   {
+      if (in[i] != 0)
+      {
+         out[outIdx++] = in[i];
+         code++;
+      }
+
+      if (in[i] == 0 || code == 0xFF)
+      {
+         out[codeIdx] = code;
+         codeIdx = outIdx++;
+         code = 1;
+      }
+   }
+   out[codeIdx] = code;
+   return outIdx;
+}
+
+/** @brief Decode COBS encoded data, in and out may be the same buffer
+ * @param in encoded data without the 0 delimiter
+ * @param len length of encoded data
+ * @param out decoded data
+ * @return length of decoded data or -1 if data is malformed
+ */
+int BinaryProtocol::CobsDecode(const uint8_t* in, uint32_t len, uint8_t* out)
+{
+   uint32_t inIdx = 0, outIdx = 0;
+
+   while (inIdx < len)
+   {
+      uint8_t code = in[inIdx++];
+
+      if (0 == code || inIdx + code - 1 > len) return -1;
+
+      for (uint8_t i = 1; i < code; i++)
+         out[outIdx++] = in[inIdx++];
+
+      if (code != 0xFF && inIdx < len)
+         out[outIdx++] = 0;
+   }
+   return outIdx;
+}
+
+/** @brief Calculate CRC-16/CCITT-FALSE, polynomial 0x1021, start value 0xFFFF */
+uint16_t BinaryProtocol::Crc16(const uint8_t* data, uint32_t len)
+{
+   static const uint16_t table[16] =
+   {
+      0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+      0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+   };
+   uint16_t crc = 0xFFFF;
+
+   //Nibble wise, a good compromise between table size and speed
+   for (uint32_t i = 0; i < len; i++)
+   {
+      crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+      crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0xF)];
+   }
+   return crc;
+}
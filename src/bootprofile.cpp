@@ -0,0 +1,55 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+#include "bootprofile.h"
+
+uint32_t BootProfile::startCycles;
+uint32_t BootProfile::lastCycles;
+
+void BootProfile::Start()
+{
+   dwt_enable_cycle_counter();
+   startCycles = dwt_read_cycle_counter();
+   lastCycles = startCycles;
+}
+
+uint32_t BootProfile::Mark(Param::PARAM_NUM param)
+{
+   uint32_t now = dwt_read_cycle_counter();
+   uint32_t us = CyclesToUs(now - lastCycles);
+
+   lastCycles = now;
+   Param::SetInt(param, us);
+   return us;
+}
+
+uint32_t BootProfile::Total(Param::PARAM_NUM param)
+{
+   uint32_t us = CyclesToUs(dwt_read_cycle_counter() - startCycles);
+
+   Param::SetInt(param, us);
+   return us;
+}
+
+uint32_t BootProfile::CyclesToUs(uint32_t cycles)
+{
+   //Counter wraps after 59 s at 72 MHz, plenty for start-up
+   return cycles / (rcc_ahb_frequency / 1000000);
+}
@@ -29,7 +29,7 @@ public:
 static NullCallback nullCallback;
 
 CanHardware::CanHardware()
-   : nextUserMessageIndex(0), nextCallbackIndex(0)
+   : nextUserMessageIndex(0), nextCallbackIndex(0), filterUpdateDepth(0), filtersDirty(false)
 {
    for (int i = 0; i < MAX_RECV_CALLBACKS; i++)
    {
@@ -73,7 +73,11 @@ bool CanHardware::RegisterUserMessage(uint32_t canId, uint32_t mask)
       userIds[nextUserMessageIndex] = canId;
       userMasks[nextUserMessageIndex] = mask;
       nextUserMessageIndex++;
-      ConfigureFilters();
+
+      if (filterUpdateDepth > 0)
+         filtersDirty = true;
+      else
+         ConfigureFilters();
       return true;
    }
    return false;
@@ -83,13 +87,41 @@ bool CanHardware::RegisterUserMessage(uint32_t canId, uint32_t mask)
  */
 void CanHardware::ClearUserMessages()
 {
+   BeginFilterUpdate();
    nextUserMessageIndex = 0;
-   ConfigureFilters();
+   filtersDirty = true;
 
    for (int i = 0; i < nextCallbackIndex; i++)
    {
       recvCallback[i]->HandleClear();
    }
+
+   EndFilterUpdate(); //Program all filters at once instead of once per re-registered message
+}
+
+/** \brief Defer filter configuration until EndFilterUpdate() is called
+ *
+ * Use this around registering many messages, e.g. on start-up.
+ * Calls may be nested, filters are configured when the outermost update ends.
+ */
+void CanHardware::BeginFilterUpdate()
+{
+   filterUpdateDepth++;
+}
+
+/** \brief End a filter update started with BeginFilterUpdate()
+ * and configure filters once if messages were registered meanwhile
+ */
+void CanHardware::EndFilterUpdate()
+{
+   if (filterUpdateDepth > 0)
+      filterUpdateDepth--;
+
+   if (filterUpdateDepth == 0 && filtersDirty)
+   {
+      filtersDirty = false;
+      ConfigureFilters();
+   }
 }
 
 void CanHardware::HandleRx(uint32_t canId, uint32_t data[2], uint8_t dlc)
@@ -20,6 +20,7 @@
 #include <libopencm3/stm32/crc.h>
 #include <libopencm3/stm32/desig.h>
 #include "canmap.h"
+#include "flashwriter.h"
 #include "hwdefs.h"
 #include "my_string.h"
 #include "my_math.h"
@@ -28,6 +29,7 @@
 #define RECVMAP_ADDRESS(b)    (b + sizeof(canSendMap))
 #define POSMAP_ADDRESS(b)     (b + sizeof(canSendMap) + sizeof(canRecvMap))
 #define CRC_ADDRESS(b)        (b + sizeof(canSendMap) + sizeof(canRecvMap) + sizeof(canPosMap))
+#define SEQ_ADDRESS(b)        (CRC_ADDRESS(b) + sizeof(uint32_t))
 #define SENDMAP_WORDS         (sizeof(canSendMap) / (sizeof(uint32_t)))
 #define RECVMAP_WORDS         (sizeof(canRecvMap) / (sizeof(uint32_t)))
 #define POSMAP_WORDS          ((sizeof(CANPOS) * MAX_ITEMS) / (sizeof(uint32_t)))
@@ -49,10 +51,35 @@
 #define IDMAPSIZE 4
 #define SHIFT_FORCE_FLAG(f) (f << 11)
 #endif // CAN_EXT
-#if (MAX_ITEMS * 12 + 2 * MAX_MESSAGES * IDMAPSIZE + 4) > FLASH_PAGE_SIZE
+#if ((MAX_ITEMS + 1) * 12 + 2 * MAX_MESSAGES * IDMAPSIZE + 8) > FLASH_PAGE_SIZE
 #error CANMAP will not fit in one flash page
 #endif
 
+//The map is saved alternately to two flash pages CAN1_BLKNUM and CAN1_BLKNUM_B,
+//counted from the end of flash like PARAM_BLKNUM. The sequence number is written
+//last and acts as commit, a power loss during save leaves the previous map intact.
+//With 1 kB pages the usual layout is parameters in pages 1 and 2, bootloader
+//pin definitions in page 3 and CAN1_BLKNUM 4 / CAN1_BLKNUM_B 5.
+//Maps written by older versions have no sequence number and are read as sequence 0.
+//When such a map lives in a page that is now used otherwise (it used to be in
+//page 2, which now belongs to the parameter log) define CAN1_BLKNUM_LEGACY to
+//that page. The map is then read from there and copied to the A/B slots when
+//the CanMap is constructed, so construct it before the first parm_save().
+#ifndef CAN1_BLKNUM_B
+#error CAN1_BLKNUM_B must be defined in hwdefs.h, the CAN map needs two flash pages
+#endif
+#if CAN1_BLKNUM_B == CAN1_BLKNUM
+#error CAN1_BLKNUM_B must be a different page than CAN1_BLKNUM
+#endif
+#define NUM_SLOTS 2
+#if defined(CAN1_BLKNUM_LEGACY) && CAN1_BLKNUM_LEGACY != CAN1_BLKNUM && CAN1_BLKNUM_LEGACY != CAN1_BLKNUM_B
+#define LEGACY_SLOT NUM_SLOTS //Only read, never written
+#define NUM_READ_SLOTS (NUM_SLOTS + 1)
+#else
+#define LEGACY_SLOT 0 //Legacy maps are in slot A
+#define NUM_READ_SLOTS NUM_SLOTS
+#endif
+
 volatile bool CanMap::isSaving = false;
 
 CanMap::CanMap(CanHardware* hw, bool loadFromFlash)
@@ -69,11 +96,15 @@ CanMap::CanMap(CanHardware* hw, bool loadFromFlash)
 //Somebody (perhaps us) has cleared all user messages. Register them again
 void CanMap::HandleClear()
 {
+   canHardware->BeginFilterUpdate();
+
    forEachCanMap(curMap, canRecvMap)
    {
       bool forceExtended = IS_EXT_FORCE(curMap->canId);
       canHardware->RegisterUserMessage((curMap->canId & ~SHIFT_FORCE_FLAG(1)) + (forceExtended * CAN_FORCE_EXTENDED));
    }
+
+   canHardware->EndFilterUpdate();
 }
 
 void CanMap::HandleRx(uint32_t canId, uint32_t data[2], uint8_t)
@@ -354,10 +385,13 @@ void CanMap::Save()
 {
    uint32_t crc;
    uint32_t check = 0xFFFFFFFF;
-   uint32_t baseAddress = GetFlashAddress();
-   uint32_t *checkAddress = (uint32_t*)baseAddress;
-
    isSaving = true;
+   FlashWriter::Flush(); //Finish background writes before we erase and lock flash
+
+   int newest = FindNewestSlot();
+   uint32_t sequence = newest < 0 ? 1 : GetSequence(GetFlashAddress(newest)) + 1;
+   uint32_t baseAddress = GetFlashAddress((newest + 1) % NUM_SLOTS); //always write the older slot
+   uint32_t *checkAddress = (uint32_t*)baseAddress;
 
    for (int i = 0; i < FLASH_PAGE_SIZE / 4; i++, checkAddress++)
       check &= *checkAddress;
@@ -377,6 +411,7 @@ void CanMap::Save()
    crc = SaveToFlash(RECVMAP_ADDRESS(baseAddress), (uint32_t *)canRecvMap, RECVMAP_WORDS);
    crc = SaveToFlash(POSMAP_ADDRESS(baseAddress), (uint32_t *)canPosMap, POSMAP_WORDS);
    SaveToFlash(CRC_ADDRESS(baseAddress), &crc, 1);
+   SaveToFlash(SEQ_ADDRESS(baseAddress), &sequence, 1);
    flash_lock();
 
    ReplaceParamUidByEnum(canSendMap);
@@ -451,7 +486,28 @@ const CanMap::CANPOS* CanMap::GetMap(bool rx, uint8_t ididx, uint8_t itemidx, ui
    return 0;
 }
 
+struct LegacyIterator
+{
+   void (*callback)(Param::PARAM_NUM, uint32_t, uint8_t, int8_t, float, int8_t, bool);
+};
+
+static void CallLegacyIterator(void* context, Param::PARAM_NUM param, uint32_t canId, uint8_t offsetBits, int8_t numBits, float gain, int8_t offset, bool rx)
+{
+   ((LegacyIterator*)context)->callback(param, canId, offsetBits, numBits, gain, offset, rx);
+}
+
 void CanMap::IterateCanMap(void (*callback)(Param::PARAM_NUM, uint32_t, uint8_t, int8_t, float, int8_t, bool))
+{
+   LegacyIterator it = { callback };
+   IterateCanMap(CallLegacyIterator, &it);
+}
+
+/** \brief Call callback for every mapped item, first send then receive map
+ *
+ * \param callback called with context and the item
+ * \param context passed to callback unchanged, e.g. the output to print to
+ */
+void CanMap::IterateCanMap(void (*callback)(void*, Param::PARAM_NUM, uint32_t, uint8_t, int8_t, float, int8_t, bool), void* context)
 {
    bool done = false, rx = false;
 
@@ -465,7 +521,7 @@ void CanMap::IterateCanMap(void (*callback)(Param::PARAM_NUM, uint32_t, uint8_t,
             uint32_t canId = curMap->canId;
             canId = MASK_EXT_FORCE(canId);
             canId |= forceExt * CAN_FORCE_EXTENDED;
-            callback((Param::PARAM_NUM)curPos->mapParam, canId, curPos->offsetBits, curPos->numBits, curPos->gain, curPos->offset, rx);
+            callback(context, (Param::PARAM_NUM)curPos->mapParam, canId, curPos->offsetBits, curPos->numBits, curPos->gain, curPos->offset, rx);
          }
       }
       done = rx;
@@ -652,26 +708,32 @@ uint32_t CanMap::SaveToFlash(uint32_t baseAddress, uint32_t* data, int len)
  */
 int CanMap::LoadFromFlash()
 {
-   uint32_t baseAddress = GetFlashAddress();
-   uint32_t storedCrc = *(uint32_t*)CRC_ADDRESS(baseAddress);
-   uint32_t crc;
-
-   crc_reset();
-   crc = crc_calculate_block((uint32_t*)baseAddress, SENDMAP_WORDS + RECVMAP_WORDS + POSMAP_WORDS);
+   int newest = FindNewestSlot();
+   int result;
 
-   if (storedCrc == crc)
+   if (newest >= 0)
    {
+      uint32_t baseAddress = GetFlashAddress(newest);
+
       memcpy32((int*)canSendMap, (int*)SENDMAP_ADDRESS(baseAddress), SENDMAP_WORDS);
       memcpy32((int*)canRecvMap, (int*)RECVMAP_ADDRESS(baseAddress), RECVMAP_WORDS);
       memcpy32((int*)canPosMap, (int*)POSMAP_ADDRESS(baseAddress), POSMAP_WORDS);
       ReplaceParamUidByEnum(canSendMap);
       ReplaceParamUidByEnum(canRecvMap);
-      return 1;
+      result = 1;
    }
    else
    {
-      return LegacyLoadFromFlash();
+      result = LegacyLoadFromFlash();
    }
+
+#if LEGACY_SLOT >= NUM_SLOTS
+   //Move map out of the legacy page before somebody else reuses it
+   if (result && (newest < 0 || newest == LEGACY_SLOT))
+      Save();
+#endif
+
+   return result;
 }
 
 /** \brief Loads the old-style message definitions from flash
@@ -709,7 +771,7 @@ int CanMap::LegacyLoadFromFlash()
       }
    };
 
-   uint32_t data = GetFlashAddress();
+   uint32_t data = GetFlashAddress(LEGACY_SLOT);
    const int size = sizeof(LEGACY_CANIDMAP) * LEGACY_MAX_MESSAGES * 2;
    uint32_t storedCrc = *(uint32_t*)(data + size);
 
@@ -736,11 +798,49 @@ CanMap::CANIDMAP* CanMap::FindById(CANIDMAP *canMap, uint32_t canId)
    return 0;
 }
 
-uint32_t CanMap::GetFlashAddress()
+/** \brief Find the slot with valid CRC and highest sequence number
+ *
+ * Maps saved before sequence numbers were introduced have sequence 0
+ * \return slot number, LEGACY_SLOT for CAN1_BLKNUM_LEGACY, or -1 if no slot is valid
+ */
+int CanMap::FindNewestSlot()
+{
+   int newest = -1;
+   uint32_t newestSequence = 0;
+
+   for (int slot = 0; slot < NUM_READ_SLOTS; slot++)
+   {
+      uint32_t baseAddress = GetFlashAddress(slot);
+      uint32_t storedCrc = *(uint32_t*)CRC_ADDRESS(baseAddress);
+
+      crc_reset();
+      uint32_t crc = crc_calculate_block((uint32_t*)baseAddress, SENDMAP_WORDS + RECVMAP_WORDS + POSMAP_WORDS);
+
+      if (storedCrc == crc && (newest < 0 || GetSequence(baseAddress) > newestSequence))
+      {
+         newest = slot;
+         newestSequence = GetSequence(baseAddress);
+      }
+   }
+   return newest;
+}
+
+uint32_t CanMap::GetSequence(uint32_t baseAddress)
+{
+   uint32_t sequence = *(uint32_t*)SEQ_ADDRESS(baseAddress);
+   return sequence == 0xFFFFFFFF ? 0 : sequence;
+}
+
+uint32_t CanMap::GetFlashAddress(int slot)
 {
    uint32_t flashSize = desig_get_flash_size();
+   uint32_t blockNum = slot == 0 ? CAN1_BLKNUM : CAN1_BLKNUM_B;
+
+#if LEGACY_SLOT >= NUM_SLOTS
+   if (slot == LEGACY_SLOT) blockNum = CAN1_BLKNUM_LEGACY;
+#endif
 
-   return FLASH_BASE + flashSize * 1024 - FLASH_PAGE_SIZE * CAN1_BLKNUM;
+   return FLASH_BASE + flashSize * 1024 - FLASH_PAGE_SIZE * blockNum;
 }
 
 void CanMap::ReplaceParamEnumByUid(CANIDMAP *canMap)
@@ -19,6 +19,7 @@
 #include "cansdo.h"
 #include "my_math.h"
 #include "errormessage.h"
+#include "stm32scheduler.h"
 
 #define SDO_REQ_ID_BASE       0x600U
 #define SDO_REP_ID_BASE       0x580U
@@ -26,17 +27,21 @@
 #define SDO_INDEX_PARAMS      0x2000
 #define SDO_INDEX_PARAM_UID   0x2100
 #define SDO_INDEX_PARAM_FLAGS 0x2200
+#define SDO_INDEX_PARAM_ARRAY 0x2300
 #define SDO_INDEX_MAP_TX      0x3000
 #define SDO_INDEX_MAP_RX      0x3001
 #define SDO_INDEX_MAP_RD      0x3100
 #define SDO_INDEX_STRINGS     0x5001
+#define SDO_INDEX_STRING_QUERY 0x5005
 #define SDO_INDEX_ERROR_NUM   0x5003
 #define SDO_INDEX_ERROR_TIME  0x5004
+#define SDO_INDEX_TASK_STATS  0x5100
 
 
 #define PRINT_BUF_ENQUEUE(c)  printBuffer[(printByteIn++) & (sizeof(printBuffer) - 1)] = c
 #define PRINT_BUF_DEQUEUE()   printBuffer[(printByteOut++) & (sizeof(printBuffer) - 1)]
 #define PRINT_BUF_EMPTY()     ((printByteOut - printByteIn) == sizeof(printBuffer))
+#define PRINT_BUF_FULL()      (printByteIn == printByteOut)
 #define PRINT_TIMEOUT         1000
 
 /** \brief
@@ -46,11 +51,14 @@
  *
  */
 CanSdo::CanSdo(CanHardware* hw, CanMap* cm)
- : canHardware(hw), canMap(cm), nodeId(1), remoteNodeId(255), printRequest(-1),
-   printByteIn(0), printByteOut(sizeof(printBuffer)), printTimeout(PRINT_TIMEOUT),
+ : canHardware(hw), canMap(cm), scheduler(0), nodeId(1), remoteNodeId(255), printRequest(-1), printJob(0),
+   printByteIn(0), printByteOut(sizeof(printBuffer)), printTimeout(PRINT_TIMEOUT), printAborted(false),
    mapParam(Param::PARAM_INVALID), mapId(0xFFFFFFFF), mapInfo{}, sdoReplyValid(false), sdoReplyData(0),
-   pendingUserSpaceSdo(false)
+   segmentPending(false), segmentCmd(0), pendingUserSpaceSdo(false), arrayParam(Param::PARAM_INVALID), arrayUpload(false), arrayByte(0), arrayWord(0),
+   deferred(false), deferPriority(WorkQueue::PRIO_LOW), deferredSdoPending(false), deferredSdo{}
 {
+   Param::InitQuery(printQuery);
+   Param::InitQuery(pendingQuery);
    canHardware->AddCallback(this);
    HandleClear();
 }
@@ -68,7 +76,10 @@ void CanSdo::HandleRx(uint32_t canId, uint32_t data[2], uint8_t)
 {
    if (canId == (SDO_REQ_ID_BASE + nodeId)) //SDO request
    {
-      ProcessSDO(data);
+      if (deferred)
+         DeferSDO(data);
+      else
+         ProcessSDO(data);
    }
    else if (canId == (SDO_REP_ID_BASE + remoteNodeId))
    {
@@ -141,22 +152,40 @@ void CanSdo::ProcessSDO(uint32_t data[2])
 {
    SdoFrame *sdo = (SdoFrame*)data;
 
-   if ((sdo->cmd & SDO_REQUEST_SEGMENT) == SDO_REQUEST_SEGMENT)
-   {
-      const int bytesPerMessage = 7;
-      uint8_t *bytes = (uint8_t*)data;
-      int i = 1;
-
-      sdo->cmd = sdo->cmd & SDO_TOGGLE_BIT;
+   bool uploadSegment = (sdo->cmd & SDO_REQUEST_SEGMENT) == SDO_REQUEST_SEGMENT;
+   bool downloadSegment = (sdo->cmd & (SDO_ABORT | SDO_REQUEST_SEGMENT)) == 0;
 
-      for (; i <= bytesPerMessage && !PRINT_BUF_EMPTY(); i++)
-         bytes[i] = PRINT_BUF_DEQUEUE();
-
-      if (PRINT_BUF_EMPTY())
+   if (uploadSegment && arrayParam != Param::PARAM_INVALID && arrayUpload)
+   {
+      UploadArraySegment((uint8_t*)data);
+   }
+   else if (downloadSegment && arrayParam != Param::PARAM_INVALID && !arrayUpload)
+   {
+      DownloadArraySegment((uint8_t*)data);
+   }
+   else if ((uploadSegment || downloadSegment) && arrayParam != Param::PARAM_INVALID)
+   {
+      //Segment doesn't match the direction of the running array transfer
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_CMD;
+      arrayParam = Param::PARAM_INVALID;
+   }
+   else if ((sdo->cmd & SDO_REQUEST_SEGMENT) == SDO_REQUEST_SEGMENT && printAborted)
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_GENERAL;
+   }
+   else if ((sdo->cmd & SDO_REQUEST_SEGMENT) == SDO_REQUEST_SEGMENT)
+   {
+      //The job is resumed from the main loop, RunPrintJob() sends the reply
+      if (0 != printJob)
       {
-         sdo->cmd |= SDO_SIZE_SPECIFIED;
-         sdo->cmd |= (bytesPerMessage - i + 1) << 1; //specify how many bytes do NOT contain data
+         segmentCmd = sdo->cmd;
+         segmentPending = true;
+         return;
       }
+
+      UploadPrintSegment((uint8_t*)data);
    }
    else if (sdo->index == SDO_INDEX_PARAMS || (sdo->index & 0xFF00) == SDO_INDEX_PARAM_UID)
    {
@@ -216,6 +245,14 @@ void CanSdo::ProcessSDO(uint32_t data[2])
          sdo->data = SDO_ERR_INVIDX;
       }
    }
+   else if ((sdo->index & 0xFF00) == SDO_INDEX_PARAM_ARRAY)
+   {
+      ProcessArraySDO(sdo);
+   }
+   else if (sdo->index == SDO_INDEX_STRING_QUERY)
+   {
+      ProcessQuerySDO(sdo);
+   }
    else if (0 != canMap && sdo->index == SDO_INDEX_MAP_TX)
    {
       AddCanMap(sdo, false);
@@ -254,6 +291,10 @@ void CanSdo::ProcessSDO(uint32_t data[2])
          sdo->data = SDO_ERR_INVIDX;
       }
    }
+   else if (0 != scheduler && (sdo->index & 0xFF00) == SDO_INDEX_TASK_STATS)
+   {
+      ProcessTaskStatsSDO(sdo);
+   }
    else
    {
       if (!ProcessSpecialSDOObjects(sdo))
@@ -262,6 +303,84 @@ void CanSdo::ProcessSDO(uint32_t data[2])
    canHardware->Send(0x580 + nodeId, data);
 }
 
+/** \brief Resume the print job set with SetPrintJob() and answer the pending segment request
+ * Call this from the main loop, the job is never resumed from the CAN receive
+ * interrupt. A segment request is answered once the job has filled the print
+ * buffer or has finished.
+ */
+void CanSdo::RunPrintJob()
+{
+   Resumable* job = printJob;
+
+   if (0 == job) return;
+
+   bool done = job->Resume(this);
+
+   //Clear before checking segmentPending, later requests are answered right away
+   if (done) printJob = 0;
+
+   if (segmentPending && (done || PRINT_BUF_FULL()))
+   {
+      uint32_t data[2] = { segmentCmd, 0 };
+
+      UploadPrintSegment((uint8_t*)data);
+      segmentPending = false;
+      canHardware->Send(0x580 + nodeId, data);
+   }
+}
+
+void CanSdo::UploadPrintSegment(uint8_t* bytes)
+{
+   const int bytesPerMessage = 7;
+   int i = 1;
+
+   bytes[0] = bytes[0] & SDO_TOGGLE_BIT;
+
+   for (; i <= bytesPerMessage && !PRINT_BUF_EMPTY(); i++)
+      bytes[i] = PRINT_BUF_DEQUEUE();
+
+   if (PRINT_BUF_EMPTY())
+   {
+      bytes[0] |= SDO_SIZE_SPECIFIED;
+      bytes[0] |= (bytesPerMessage - i + 1) << 1; //specify how many bytes do NOT contain data
+   }
+}
+
+/** \brief Copy request and have the WorkQueue process it
+ * SDO clients wait for the reply before sending the next request, so one
+ * buffer is enough. Requests that arrive anyway are aborted.
+ *
+ * \param data uint32_t[2] request, reused for the abort reply
+ */
+void CanSdo::DeferSDO(uint32_t data[2])
+{
+   if (!deferredSdoPending)
+   {
+      deferredSdo[0] = data[0];
+      deferredSdo[1] = data[1];
+      deferredSdoPending = true;
+
+      if (WorkQueue::Post(ProcessDeferredSDO, this, deferPriority))
+         return;
+      deferredSdoPending = false;
+   }
+
+   SdoFrame *sdo = (SdoFrame*)data;
+   sdo->cmd = SDO_ABORT;
+   sdo->data = SDO_ERR_GENERAL;
+   canHardware->Send(0x580 + nodeId, data);
+}
+
+void CanSdo::ProcessDeferredSDO(void* canSdo)
+{
+   CanSdo* self = (CanSdo*)canSdo;
+   uint32_t data[2] = { self->deferredSdo[0], self->deferredSdo[1] };
+
+   //Free the buffer before replying, the client may send its next request right away
+   self->deferredSdoPending = false;
+   self->ProcessSDO(data);
+}
+
 /** \brief count down PutChar character send timeout
  *
  * \param callingFrequency in ms. This is subtracted from the remaining wait time
@@ -282,14 +401,73 @@ void CanSdo::TriggerTimeout(int callingFrequency)
 
 void CanSdo::PutChar(char c)
 {
-   if (printTimeout == 0) return; //last call to PutChar resulted in a timeout. Do not recover until the next burst
+   PutBuffer(&c, 1);
+}
 
-   printTimeout = PRINT_TIMEOUT;
-   //When print buffer is full, wait
-   while (printByteIn == printByteOut && printTimeout > 0);
+/** \brief Non-blocking variant of PutChar() for resumable print jobs
+ *
+ * \return false when the print buffer is full, the caller must try again later.
+ * After a timeout characters are discarded like in PutChar()
+ */
+bool CanSdo::TryPutChar(char c)
+{
+   if (printTimeout == 0) return true; //Discard, the host has stopped reading
+   if (printByteIn == printByteOut) return false; //print buffer is full
 
+   printTimeout = PRINT_TIMEOUT;
    PRINT_BUF_ENQUEUE(c);
-   printRequest = -1; //We can clear the print start trigger as we've obviously started printing
+   printRequest = -1;
+   return true;
+}
+
+/** \brief Copy buf to the print buffer, wait for the host when it is full
+ * Everything that fits is copied at once, so we only wait once per buffer
+ * full. When the host stops reading the rest is discarded, as are all
+ * following characters until the next string upload starts.
+ */
+void CanSdo::PutBuffer(const char* buf, int len)
+{
+   while (len > 0)
+   {
+      int sent = TryPutBuffer(buf, len);
+
+      buf += sent;
+      len -= sent;
+
+      if (len > 0)
+      {
+         //Segment requests are processed by the main loop that is waiting here
+         //right now, so the buffer would never drain. Abort this upload.
+         if (deferred && !WorkQueue::UsesPendSV())
+         {
+            printTimeout = 0;
+            printAborted = true;
+         }
+         else
+         {
+            printTimeout = PRINT_TIMEOUT;
+         }
+
+         while (printByteIn == printByteOut && printTimeout > 0);
+      }
+   }
+}
+
+int CanSdo::TryPutBuffer(const char* buf, int len)
+{
+   if (printTimeout == 0) return len; //Discard, the host has stopped reading
+
+   int room = printByteOut - printByteIn;
+
+   if (len > room) len = room;
+   if (len == 0) return 0;
+
+   for (int i = 0; i < len; i++)
+      PRINT_BUF_ENQUEUE(buf[i]);
+
+   printTimeout = PRINT_TIMEOUT;
+   printRequest = -1;
+   return len;
 }
 
 void CanSdo::SendSdoReply(SdoFrame* sdoFrame)
@@ -310,6 +488,12 @@ bool CanSdo::ProcessSpecialSDOObjects(SdoFrame* sdo)
          printByteIn = 0;
          printByteOut = sizeof(printBuffer); //both point to the beginning of the physical buffer but virtually they are 64 bytes apart
          printRequest = sdo->subIndex;
+         printJob = 0;
+         segmentPending = false;
+         printAborted = false;
+         printQuery = pendingQuery;
+         Param::InitQuery(pendingQuery); //query only applies to one transfer
+         arrayParam = Param::PARAM_INVALID;
          return true;
       }
    }
@@ -324,6 +508,185 @@ bool CanSdo::ProcessSpecialSDOObjects(SdoFrame* sdo)
    return false;
 }
 
+/** \brief Start segmented transfer of all elements of a parameter
+ * Index 0x23xx, sub index is the low byte of the parameter index and xx the
+ * high byte. So 0x2300 reaches the first 256 parameters. Data is transferred
+ * as little endian fixed point words, one per element.
+ *
+ * \param sdo SdoFrame*
+ */
+void CanSdo::ProcessArraySDO(SdoFrame* sdo)
+{
+   Param::PARAM_NUM paramIdx = (Param::PARAM_NUM)(sdo->subIndex + ((sdo->index & 0xFF) << 8));
+   uint32_t size = Param::GetLength(paramIdx) * sizeof(s32fp);
+
+   arrayParam = Param::PARAM_INVALID;
+
+   if (paramIdx >= Param::PARAM_LAST)
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_INVIDX;
+   }
+   else if (sdo->cmd == SDO_READ)
+   {
+      sdo->data = size;
+      sdo->cmd = SDO_RESPONSE_UPLOAD | SDO_SIZE_SPECIFIED;
+      arrayParam = paramIdx;
+      arrayUpload = true;
+      arrayByte = 0;
+   }
+   else if (sdo->cmd == (SDO_REQUEST_DOWNLOAD | SDO_SIZE_SPECIFIED) && Param::GetType(paramIdx) == Param::TYPE_PARAM)
+   {
+      if (sdo->data == size)
+      {
+         sdo->cmd = SDO_WRITE_REPLY;
+         arrayParam = paramIdx;
+         arrayUpload = false;
+         arrayByte = 0;
+         arrayWord = 0;
+      }
+      else
+      {
+         sdo->cmd = SDO_ABORT;
+         sdo->data = SDO_ERR_LENGTH;
+      }
+   }
+   else
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_INVIDX;
+   }
+}
+
+/** \brief Set up query for the next string upload
+ * Sub index 0: query flags, see Param::QUERY_FLAG
+ * Sub index 1: category index
+ * Sub index 2: first parameter index in low word, last in high word
+ * Sub index 4: only parameters changed after this generation
+ * The query is reset to default once the string upload has been started
+ *
+ * \param sdo SdoFrame*
+ */
+void CanSdo::ProcessQuerySDO(SdoFrame* sdo)
+{
+   if (sdo->cmd == SDO_WRITE && sdo->subIndex != 3 && sdo->subIndex <= 4)
+   {
+      if (sdo->subIndex == 0)
+         pendingQuery.flags = sdo->data;
+      else if (sdo->subIndex == 1)
+         pendingQuery.category = sdo->data;
+      else if (sdo->subIndex == 2)
+      {
+         pendingQuery.first = sdo->data & 0xFFFF;
+         pendingQuery.last = sdo->data >> 16;
+      }
+      else
+         pendingQuery.since = sdo->data;
+      sdo->cmd = SDO_WRITE_REPLY;
+   }
+   else if (sdo->cmd == SDO_READ && sdo->subIndex == 3)
+   {
+      sdo->data = Param::GetNumCategories();
+      sdo->cmd = SDO_READ_REPLY;
+   }
+   else
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_INVIDX;
+   }
+}
+
+/** \brief Read scheduler task statistics
+ * Index 0x51tt with tt the task number as returned by AddTask()
+ * Sub index: Stm32Scheduler::Statistic, times in us
+ * Writing any sub index of any task restarts the statistics of all tasks
+ * with the next scheduler tick
+ *
+ * \param sdo SdoFrame*
+ */
+void CanSdo::ProcessTaskStatsSDO(SdoFrame* sdo)
+{
+   int task = sdo->index & 0xFF;
+
+   if (task >= scheduler->GetNumTasks())
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_INVIDX;
+   }
+   else if (sdo->cmd == SDO_WRITE)
+   {
+      scheduler->ResetStatistics();
+      sdo->cmd = SDO_WRITE_REPLY;
+   }
+   else if (sdo->cmd == SDO_READ && sdo->subIndex < Stm32Scheduler::STAT_LAST)
+   {
+      sdo->data = scheduler->GetStatistic(task, sdo->subIndex);
+      sdo->cmd = SDO_READ_REPLY;
+   }
+   else
+   {
+      sdo->cmd = SDO_ABORT;
+      sdo->data = SDO_ERR_INVIDX;
+   }
+}
+
+void CanSdo::UploadArraySegment(uint8_t* bytes)
+{
+   const uint32_t bytesPerMessage = 7;
+   uint32_t size = Param::GetLength(arrayParam) * sizeof(s32fp);
+   uint32_t i = 1;
+
+   bytes[0] &= SDO_TOGGLE_BIT;
+
+   for (; i <= bytesPerMessage && arrayByte < size; i++, arrayByte++)
+      bytes[i] = Param::GetElement(arrayParam, arrayByte / 4) >> (8 * (arrayByte & 3));
+
+   for (uint32_t j = i; j <= bytesPerMessage; j++)
+      bytes[j] = 0;
+
+   if (arrayByte == size)
+   {
+      bytes[0] |= SDO_SEGMENT_LAST;
+      bytes[0] |= (bytesPerMessage - i + 1) << 1; //specify how many bytes do NOT contain data
+      arrayParam = Param::PARAM_INVALID;
+   }
+}
+
+void CanSdo::DownloadArraySegment(uint8_t* bytes)
+{
+   SdoFrame* sdo = (SdoFrame*)bytes;
+   uint32_t size = Param::GetLength(arrayParam) * sizeof(s32fp);
+   uint32_t numBytes = 7 - ((bytes[0] >> 1) & 7);
+   bool last = (bytes[0] & SDO_SEGMENT_LAST) != 0;
+
+   for (uint32_t i = 1; i <= numBytes && arrayByte < size; i++, arrayByte++)
+   {
+      arrayWord |= (uint32_t)bytes[i] << (8 * (arrayByte & 3));
+
+      if ((arrayByte & 3) == 3)
+      {
+         if (Param::SetElement(arrayParam, arrayByte / 4, arrayWord) != 0)
+         {
+            sdo->cmd = SDO_ABORT;
+            sdo->index = SDO_INDEX_PARAM_ARRAY | (arrayParam >> 8);
+            sdo->subIndex = arrayParam & 0xFF;
+            sdo->data = SDO_ERR_RANGE;
+            arrayParam = Param::PARAM_INVALID;
+            return;
+         }
+         arrayWord = 0;
+      }
+   }
+
+   sdo->cmd = SDO_RESPONSE_DOWNLOAD | (bytes[0] & SDO_TOGGLE_BIT);
+   sdo->index = 0;
+   sdo->subIndex = 0;
+   sdo->data = 0;
+
+   if (last)
+      arrayParam = Param::PARAM_INVALID;
+}
+
 void CanSdo::ReadOrDeleteCanMap(SdoFrame* sdo)
 {
    bool rx = (sdo->index & 0x80) != 0;
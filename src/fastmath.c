@@ -0,0 +1,185 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fastmath.h"
+
+#define RSQRT_ITERATIONS 3
+#define Q16_LOG2E        94548 //log2(e)
+#define Q16_LN2          45426 //ln(2)
+
+/* 1/sqrt(x) at the centre of [k/8, (k+1)/8), k = 8..31, in Q1.31.
+ * Worst relative error is 3%, three Newton steps bring it below 2^-29 */
+static const uint32_t rsqrtSeed[24] =
+{
+   0x7c3b6670, 0x7580675c, 0x6fc25ede, 0x6ac8dd5a, 0x666ba585, 0x628d2560,
+   0x5f171432, 0x5bf84a24, 0x5923539a, 0x568d7926, 0x542e127c, 0x51fe0af2,
+   0x4ff787a6, 0x4e15a4ec, 0x4c54443a, 0x4aafe5f4, 0x49258be3, 0x47b2a221,
+   0x4654ecd6, 0x450a79ad, 0x43d1941b, 0x42a8bbd9, 0x418e9d1f, 0x40820a39
+};
+
+/* log2(1 + i/32) in Q16, linear interpolation error is below 2^-12 */
+static const uint32_t log2Table[33] =
+{
+   0, 2909, 5732, 8473, 11136, 13727, 16248, 18704, 21098, 23433, 25711,
+   27936, 30109, 32234, 34312, 36346, 38336, 40286, 42196, 44068, 45904,
+   47705, 49472, 51207, 52911, 54584, 56229, 57845, 59434, 60997, 62534,
+   64047, 65536
+};
+
+/* 2^(i/32) in Q16, linear interpolation error is below 2^-14 relative */
+static const uint32_t exp2Table[33] =
+{
+   65536, 66971, 68438, 69936, 71468, 73032, 74632, 76266, 77936, 79642,
+   81386, 83169, 84990, 86851, 88752, 90696, 92682, 94711, 96785, 98905,
+   101070, 103283, 105545, 107856, 110218, 112631, 115098, 117618, 120194,
+   122825, 125515, 128263, 131072
+};
+
+/** 1/sqrt(m) for m in [2^30, 2^32) read as Q2.30, result in Q1.31 and never
+ * above the true value because Newton approaches it from below */
+static uint32_t rsqrt_norm(uint32_t m)
+{
+   uint32_t y = rsqrtSeed[(m >> 27) - 8];
+
+   for (int i = 0; i < RSQRT_ITERATIONS; i++)
+   {
+      //y = y * (3 - m * y²) / 2
+      uint32_t y2 = ((uint64_t)y * y) >> 31;
+      uint32_t my2 = ((uint64_t)m * y2) >> 31;
+      y = ((uint64_t)y * ((3u << 30) - my2)) >> 31;
+   }
+   return y;
+}
+
+/** floor(sqrt(x)), exact for x < 2^48 */
+static uint32_t isqrt64(uint64_t x)
+{
+   if (x == 0) return 0;
+
+   int n = __builtin_clzll(x) & ~1; //even shift so the exponent halves
+   uint32_t m = (x << n) >> 32;
+   //m * 1/sqrt(m) = sqrt(m) = sqrt(x) * 2^(n/2 - 31) in Q.61
+   uint64_t r = ((uint64_t)m * rsqrt_norm(m)) >> (30 + n / 2);
+
+   //Estimate is at most one below, and the dropped bits of x may cost one more
+   if ((r + 1) * (r + 1) <= x) r++;
+   if ((r + 1) * (r + 1) <= x) r++;
+   if (r * r > x) r--;
+   return r;
+}
+
+/** log2(x) in Q16.16, x != 0 */
+static uint32_t log2_q16(uint32_t x)
+{
+   int n = __builtin_clz(x);
+   uint32_t m = x << n; //1.fraction in Q1.31
+   uint32_t idx = (m >> 26) & 31;
+   uint32_t weight = (m >> 10) & 0xFFFF;
+   uint32_t frac = log2Table[idx] + (((log2Table[idx + 1] - log2Table[idx]) * weight) >> 16);
+
+   return ((31 - n) << 16) + frac;
+}
+
+uint32_t fm_isqrt(uint32_t x)
+{
+   return isqrt64(x);
+}
+
+u32fp fm_sqrt(u32fp x)
+{
+   //sqrt(x / 2^F) * 2^F = sqrt(x * 2^F)
+   return isqrt64((uint64_t)x << FRAC_DIGITS);
+}
+
+u32fp fm_rsqrt(u32fp x)
+{
+   if (x == 0) return UINT32_MAX;
+
+   //2^F / sqrt(x / 2^F) = 2^2F / sqrt(x * 2^F)
+   uint64_t xs = (uint64_t)x << FRAC_DIGITS;
+   int n = __builtin_clzll(xs) & ~1;
+   uint32_t m = (xs << n) >> 32;
+   int shift = 62 - 2 * FRAC_DIGITS - n / 2;
+
+   return ((uint64_t)rsqrt_norm(m) + (1ull << (shift - 1))) >> shift;
+}
+
+u32fp fm_hypot2(s32fp a, s32fp b)
+{
+   uint64_t sum = (uint64_t)((int64_t)a * a) + (uint64_t)((int64_t)b * b);
+   //Keep the exact range, scale down larger sums by an even power of two
+   int shift = sum >> 48 ? (17 - __builtin_clzll(sum)) & ~1 : 0;
+
+   return isqrt64(sum >> shift) << (shift / 2);
+}
+
+u32fp fm_hypot3(s32fp a, s32fp b, s32fp c)
+{
+   uint64_t sum = (uint64_t)((int64_t)a * a) + (uint64_t)((int64_t)b * b) + (uint64_t)((int64_t)c * c);
+   int shift = sum >> 48 ? (17 - __builtin_clzll(sum)) & ~1 : 0;
+
+   return isqrt64(sum >> shift) << (shift / 2);
+}
+
+s32fp fm_log2(uint32_t x)
+{
+   if (x == 0) return INT32_MIN;
+
+   return (log2_q16(x) + (1 << (15 - FRAC_DIGITS))) >> (16 - FRAC_DIGITS);
+}
+
+s32fp fm_ln(uint32_t x)
+{
+   if (x == 0) return INT32_MIN;
+
+   uint64_t ln = (uint64_t)log2_q16(x) * Q16_LN2;
+   return (ln + (1u << (31 - FRAC_DIGITS))) >> (32 - FRAC_DIGITS);
+}
+
+s32fp fm_exp(s32fp x)
+{
+   //e^x = 2^(x * log2(e)) = 2^k * 2^f
+   int64_t y = ((int64_t)x * Q16_LOG2E) >> FRAC_DIGITS;
+   int32_t k = y >> 16;
+   uint32_t f = y & 0xFFFF;
+   uint32_t idx = f >> 11;
+   uint32_t weight = (f & 0x7FF) << 5;
+   uint32_t p = exp2Table[idx] + (((exp2Table[idx + 1] - exp2Table[idx]) * weight) >> 16);
+   int32_t shift = k + FRAC_DIGITS - 16; //p is in [2^16, 2^17)
+
+   if (shift > 14) return INT32_MAX;
+   if (shift >= 0) return p << shift;
+   if (shift < -17) return 0;
+   return (p + (1u << (-shift - 1))) >> -shift;
+}
+
+float fm_sqrtf(float x)
+{
+   union { float f; uint32_t i; } u = { x };
+
+   if (!(x > 0)) return 0;
+
+   //Halving the exponent gives 1/sqrt(x) within 0.2%, then three Newton steps
+   u.i = 0x5f375a86 - (u.i >> 1);
+   float y = u.f;
+   y = y * (1.5f - 0.5f * x * y * y);
+   y = y * (1.5f - 0.5f * x * y * y);
+   y = y * (1.5f - 0.5f * x * y * y);
+
+   return x * y;
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/stm32/flash.h>
+#include "flashwriter.h"
+
+FlashWriter::Job FlashWriter::jobs[FLASHWRITER_MAX_JOBS];
+volatile uint8_t FlashWriter::jobIn = 0;
+volatile uint8_t FlashWriter::jobOut = 0;
+FlashWriter::State FlashWriter::state = FlashWriter::IDLE;
+uint32_t FlashWriter::position = 0;
+volatile bool FlashWriter::flushing = false;
+
+bool FlashWriter::Erase(uint32_t address, Callback callback)
+{
+   return Queue(JOB_ERASE, address, 0, 0, callback);
+}
+
+bool FlashWriter::Program(uint32_t address, const uint32_t* data, uint32_t words, Callback callback)
+{
+   return Queue(JOB_PROGRAM, address, data, words, callback);
+}
+
+void FlashWriter::Run()
+{
+   //Flush() owns the state machine, don't step it from the interrupt
+   if (flushing) return;
+
+   Step();
+}
+
+/** \brief Advance the current job by one step
+ * Erase is started by setting up FLASH_CR/FLASH_AR directly and then polled
+ * via the busy flag so that we never wait here for the erase to finish
+ */
+void FlashWriter::Step()
+{
+   if (!IsBusy()) return;
+
+   Job& job = jobs[jobOut & (FLASHWRITER_MAX_JOBS - 1)];
+
+   switch (state)
+   {
+   case IDLE:
+      flash_unlock();
+
+      if (job.type == JOB_ERASE)
+      {
+         FLASH_CR |= FLASH_CR_PER;
+         FLASH_AR = job.address;
+         FLASH_CR |= FLASH_CR_STRT;
+         state = ERASING;
+      }
+      else
+      {
+         position = 0;
+         state = PROGRAMMING;
+      }
+      break;
+   case ERASING:
+      if ((FLASH_SR & FLASH_SR_BSY) == 0)
+      {
+         FLASH_CR &= ~FLASH_CR_PER;
+         Complete(*(uint32_t*)job.address == 0xFFFFFFFF, 0);
+      }
+      break;
+   case PROGRAMMING:
+      for (int i = 0; i < FLASHWRITER_WORDS_PER_RUN && position < job.words; i++, position++)
+         flash_program_word(job.address + position * sizeof(uint32_t), job.data[position]);
+
+      if (position == job.words)
+      {
+         const uint32_t* flashData = (const uint32_t*)job.address;
+         bool ok = true;
+
+         for (uint32_t i = 0; i < job.words; i++)
+            ok &= flashData[i] == job.data[i];
+
+         Complete(ok, Crc32(flashData, job.words));
+      }
+      break;
+   }
+}
+
+/** \brief Process all jobs from the main loop
+ * Run() might preempt us from an interrupt. It can only do so before the
+ * flag is set or after it is cleared, in both cases the state machine is
+ * consistent.
+ */
+void FlashWriter::Flush()
+{
+   flushing = true;
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+   while (IsBusy())
+      Step();
+
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+   flushing = false;
+}
+
+bool FlashWriter::Queue(JobType type, uint32_t address, const uint32_t* data, uint32_t words, Callback callback)
+{
+   if ((uint8_t)(jobIn - jobOut) >= FLASHWRITER_MAX_JOBS) return false;
+
+   Job& job = jobs[jobIn & (FLASHWRITER_MAX_JOBS - 1)];
+   job.type = type;
+   job.address = address;
+   job.data = data;
+   job.words = words;
+   job.callback = callback;
+   jobIn = jobIn + 1; //Publish job last, Run() might be called from an interrupt
+
+   return true;
+}
+
+/** \brief Calculate the same CRC-32 as the STM32 CRC unit in software
+ * We run from an interrupt and must not disturb a CRC the main loop is
+ * calculating with the CRC unit, e.g. in parm_load() or CanMap.
+ */
+uint32_t FlashWriter::Crc32(const uint32_t* data, uint32_t words)
+{
+   static const uint32_t table[16] =
+   {
+      0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+      0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
+   };
+   uint32_t crc = 0xFFFFFFFF;
+
+   //Nibble wise like BinaryProtocol::Crc16(), most significant nibble first
+   for (uint32_t i = 0; i < words; i++)
+   {
+      crc ^= data[i];
+
+      for (int n = 0; n < 8; n++)
+         crc = (crc << 4) ^ table[crc >> 28];
+   }
+   return crc;
+}
+
+void FlashWriter::Complete(bool ok, uint32_t crc)
+{
+   Callback callback = jobs[jobOut & (FLASHWRITER_MAX_JOBS - 1)].callback;
+
+   state = IDLE;
+   jobOut = jobOut + 1;
+
+   if (!IsBusy())
+      flash_lock();
+
+   if (0 != callback)
+      callback(ok, crc);
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fmt.h"
+
+namespace Fmt
+{
+
+static void PutFill(IPutChar* out, char c, int count)
+{
+   for (; count > 0; count--)
+      out->PutChar(c);
+}
+
+void PutPadded(IPutChar* out, const char* str, int len, int width, int flags)
+{
+   int fill = width - len;
+
+   if (!(flags & LEFT))
+      PutFill(out, (flags & ZERO) ? '0' : ' ', fill);
+   out->PutBuffer(str, len);
+   if (flags & LEFT)
+      PutFill(out, ' ', fill);
+}
+
+void PutString(IPutChar* out, const char* str, int width, int flags)
+{
+   int len = 0;
+
+   while (str[len] != 0) len++;
+
+   PutPadded(out, str, len, width, flags);
+}
+
+void PutInt(IPutChar* out, uint32_t value, bool negative, int base, bool upper, int width, int flags)
+{
+   char buf[12];
+   char* p = buf + sizeof(buf);
+   const char letter = upper ? 'A' : 'a';
+
+   do
+   {
+      uint32_t digit = value % base;
+      *--p = digit < 10 ? '0' + digit : letter + digit - 10;
+      value /= base;
+   } while (value > 0);
+
+   if (negative)
+   {
+      if ((flags & ZERO) && !(flags & LEFT) && width > 0)
+      {
+         //Sign goes before the zeros
+         out->PutChar('-');
+         width--;
+      }
+      else
+      {
+         *--p = '-';
+      }
+   }
+
+   PutPadded(out, p, buf + sizeof(buf) - p, width, flags);
+}
+
+void PutFixed(IPutChar* out, s32fp value, int width, int flags)
+{
+   char buf[FP_ITOA_BUFSIZE(FP_DECIMALS)];
+
+   fp_itoa(buf, value);
+   PutString(out, buf, width, flags);
+}
+
+}
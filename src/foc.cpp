@@ -16,37 +16,38 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#define CST_DIGITS 15
 #include "my_fp.h"
 #include "my_math.h"
 #include "foc.h"
+#include "fastmath.h"
 #include "sine_core.h"
 
-#define SQRT3 FP_FROMFLT(1.732050807568877293527446315059)
+typedef Fixed<16, 15> Modulation; //modulation index and duty cycles, 1.0 is half the PWM range
+typedef Fixed<31 - FRAC_DIGITS, FRAC_DIGITS> Current;
 
-static const u32fp sqrt3 = SQRT3;
-static const s32fp sqrt3inv1 = FP_FROMFLT(0.57735026919); //1/sqrt(3)
-static const s32fp zeroOffset = FP_FROMINT(1);
+static constexpr FOC::Unit sqrt3 = FOC::Unit::FromFloat(1.732050807568877293527446315059);
+static constexpr FOC::Unit sqrt3inv1 = FOC::Unit::FromFloat(0.57735026919); //1/sqrt(3)
+static constexpr Modulation zeroOffset = Modulation::FromInt(1);
 static const int32_t minPulse = 1000;
-static const int32_t maxPulse = FP_FROMINT(2) - 1000;
+static const int32_t maxPulse = Modulation::FromInt(2).Raw() - 1000;
 
 static float term1 = 15, term2 = 240;
-static int32_t modMax = FP_DIV(FP_FROMINT(2U), sqrt3) - 200;
+static int32_t modMax = (Modulation::FromInt(2) / Modulation(sqrt3)).Raw() - 200;
 static int32_t modMaxPow2 = modMax * modMax;
 
 s32fp FOC::id;
 s32fp FOC::iq;
 s32fp FOC::DutyCycles[3];
-s32fp FOC::sin;
-s32fp FOC::cos;
+FOC::Unit FOC::sin;
+FOC::Unit FOC::cos;
 
 /** @brief Set angle for Park und inverse Park transformation
  *  @param angle uint16_t rotor angle
  */
 void FOC::SetAngle(uint16_t angle)
 {
-   sin = SineCore::Sine(angle);
-   cos = SineCore::Cosine(angle);
+   sin = Unit::FromRaw(SineCore::Sine(angle));
+   cos = Unit::FromRaw(SineCore::Cosine(angle));
 }
 
 /** @brief Transform current to rotor system using Clarke and Park transformation
@@ -57,11 +58,11 @@ void FOC::SetAngle(uint16_t angle)
 void FOC::ParkClarke(s32fp il1, s32fp il2)
 {
    //Clarke transformation
-   s32fp ia = il1;
-   s32fp ib = FP_MUL(sqrt3inv1, il1 + 2 * il2);
+   Current ia = Current::FromRaw(il1);
+   Current ib = Mul<Current>(sqrt3inv1, ia + Current::FromRaw(il2) * 2);
    //Park transformation
-   id = FP_MUL(cos, ia) + FP_MUL(sin, ib);
-   iq = FP_MUL(cos, ib) - FP_MUL(sin, ia);
+   id = (Mul<Current>(cos, ia) + Mul<Current>(sin, ib)).Raw();
+   iq = (Mul<Current>(cos, ib) - Mul<Current>(sin, ia)).Raw();
 }
 
 /** \brief distribute motor current in magnetic torque and reluctance torque with the least total current
@@ -75,8 +76,8 @@ void FOC::Mtpa(float is, float& idref, float& iqref)
 {
    float isSquared = is * is;
 
-   idref = term1 == 0 ? 0 : term1 - floatSqrt(term2 + isSquared / 2);
-   iqref = SIGN(is) * floatSqrt(isSquared - idref * idref);
+   idref = term1 == 0 ? 0 : term1 - fm_sqrtf(term2 + isSquared / 2);
+   iqref = SIGN(is) * fm_sqrtf(isSquared - idref * idref);
 }
 
 /** \brief Set motor inductance difference between Ld and Lq and flux linkage
@@ -103,7 +104,7 @@ void FOC::SetMotorParameters(float lqminusld, float fluxLinkage)
 
 int32_t FOC::GetQLimit(int32_t ud)
 {
-   return sqrt(modMaxPow2 - ud * ud);
+   return fm_isqrt(modMaxPow2 - ud * ud);
 }
 
 /** \brief Returns the resulting modulation index from uq and ud
@@ -115,7 +116,7 @@ int32_t FOC::GetQLimit(int32_t ud)
  */
 int32_t FOC::GetTotalVoltage(int32_t ud, int32_t uq)
 {
-   return sqrt((uint32_t)(ud * ud) + (uint32_t)(uq * uq));
+   return fm_isqrt((uint32_t)(ud * ud) + (uint32_t)(uq * uq));
 }
 
 /** \brief Calculate duty cycles for generating ud and uq at given angle
@@ -128,15 +129,17 @@ int32_t FOC::GetTotalVoltage(int32_t ud, int32_t uq)
  */
 void FOC::InvParkClarke(int32_t ud, int32_t uq)
 {
+   Modulation d = Modulation::FromRaw(ud);
+   Modulation q = Modulation::FromRaw(uq);
    //Inverse Park transformation
-   s32fp ua = FP_MUL(cos, ud) - FP_MUL(sin, uq);
-   s32fp ub = FP_MUL(cos, uq) + FP_MUL(sin, ud);
+   Modulation ua = Mul<Modulation>(cos, d) - Mul<Modulation>(sin, q);
+   Modulation ub = Mul<Modulation>(cos, q) + Mul<Modulation>(sin, d);
    //Inverse Clarke transformation
-   DutyCycles[0] = ua;
+   DutyCycles[0] = ua.Raw();
    ua /= 2;
    ub /= 2;
-   DutyCycles[1] = (-ua + FP_MUL(SQRT3, ub));
-   DutyCycles[2] = (-ua - FP_MUL(SQRT3, ub));
+   DutyCycles[1] = (-ua + Mul<Modulation>(sqrt3, ub)).Raw();
+   DutyCycles[2] = (-ua - Mul<Modulation>(sqrt3, ub)).Raw();
 
    int32_t offset = SineCore::CalcSVPWMOffset(DutyCycles[0], DutyCycles[1], DutyCycles[2]);
 
@@ -145,7 +148,7 @@ void FOC::InvParkClarke(int32_t ud, int32_t uq)
       /* subtract it from all 3 phases -> no difference in phase-to-phase voltage */
       DutyCycles[i] -= offset;
       /* Shift above 0 */
-      DutyCycles[i] += zeroOffset;
+      DutyCycles[i] += zeroOffset.Raw();
       /* Short pulse suppression */
       if (DutyCycles[i] < minPulse)
       {
@@ -153,7 +156,7 @@ void FOC::InvParkClarke(int32_t ud, int32_t uq)
       }
       else if (DutyCycles[i] > maxPulse)
       {
-         DutyCycles[i] = FP_FROMINT(2);
+         DutyCycles[i] = Modulation::FromInt(2).Raw();
       }
    }
 }
@@ -168,50 +171,3 @@ void FOC::SetMaximumModulationIndex(uint32_t m)
    modMax = m;
    modMaxPow2 = m * m;
 }
-
-uint32_t FOC::sqrt(uint32_t rad)
-{
-   uint32_t radshift = (rad < 10000 ? 5 : (rad < 10000000 ? 9 : (rad < 1000000000 ? 13 : 15)));
-   uint32_t sqrt = (rad >> radshift) + 1; //Starting value for newton iteration
-   uint32_t sqrtl;
-
-   do {
-      sqrtl = sqrt;
-      sqrt = (sqrt + rad / sqrt) / 2;
-   } while ((sqrtl - sqrt) > 1);
-
-   return sqrt;
-}
-
-float FOC::floatSqrt(float rad)
-{
-	int exp = getexp(rad);
-	//Approximate start value as 2^(log2(rad) / 2 - 1) * 3
-	uint32_t approx = 1 << (16 + (exp / 2 - 1)); //approximation only works from 2^-32 to 2^32
-	float sqrt = approx > 0 ? 3.0f / 65536.0f * approx : 1;
-	float sqrtl;
-	float maxDiff = rad / 10000; //The greater the radiant, the less absolute accuracy we aim for
-
-	if (rad <= 0) return 0;
-
-	do {
-	   sqrtl = sqrt;
-	   sqrt = (sqrt + rad / sqrt) / 2;
-	} while (ABS(sqrtl - sqrt) > maxDiff);
-
-	return sqrt;
-}
-
-int FOC::getexp(float f)
-{
-   union
-   {
-      float f;
-      struct {
-         unsigned int mantisa : 23;
-         unsigned int exponent : 8;
-         unsigned int sign : 1;
-      } parts;
-   } floatcast = { f };
-   return floatcast.parts.exponent - 127;
-}
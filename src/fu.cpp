@@ -20,7 +20,7 @@
 #include "fu.h"
 
 uint32_t MotorVoltage::boost = 0;
-u32fp MotorVoltage::fac;
+MotorVoltage::Slope MotorVoltage::fac;
 uint32_t MotorVoltage::maxAmp;
 u32fp MotorVoltage::endFrq = 1; //avoid division by 0 when not set
 
@@ -47,7 +47,8 @@ uint32_t MotorVoltage::GetAmp(u32fp frq)
 /** Get amplitude for given frequency multiplied with given percentage */
 uint32_t MotorVoltage::GetAmpPerc(u32fp frq, u32fp perc)
 {
-   uint32_t amp = FP_MUL(perc, (FP_TOINT(FP_MUL(fac, frq)) + boost)) / 100;
+   int32_t ampAtFrq = Mul<Frq>(fac, Frq::FromRaw(frq)).ToInt() + boost;
+   uint32_t amp = (Frq::FromRaw(perc) * ampAtFrq).ToInt() / 100;
    if (frq < FP_FROMFLT(0.2))
    {
       amp = 0;
@@ -69,5 +70,5 @@ void MotorVoltage::SetMaxAmp(uint32_t maxAmp)
 /** Calculate slope of u/f */
 void MotorVoltage::CalcFac()
 {
-   fac = FP_DIV(FP_FROMINT(maxAmp - boost), endFrq);
+   fac = Div<Slope>(Frq::FromInt((int32_t)(maxAmp - boost)), Frq::FromRaw(endFrq));
 }
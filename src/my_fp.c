@@ -16,45 +16,112 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include "my_string.h"
 #include "my_fp.h"
+#include "fastmath.h"
 
 #define FRAC_MASK ((1 << FRAC_DIGITS) - 1)
 
-static s32fp log2_approx(s32fp x, int loopLimit);
+static const char digitPairs[] =
+   "0001020304050607080910111213141516171819"
+   "2021222324252627282930313233343536373839"
+   "4041424344454647484950515253545556575859"
+   "6061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+static const uint32_t pow10[FP_MAX_DECIMALS + 1] =
+{
+   1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/* n / 100 by reciprocal multiplication, exact for all 32 bit values */
+#define DIV100(n) ((uint32_t)(((uint64_t)(n) * 0x51EB851Fu) >> 37))
+
+static int count_digits(uint32_t n)
+{
+   int digits = 1;
+
+   while (digits <= FP_MAX_DECIMALS && n >= pow10[digits])
+      digits++;
+
+   return digits;
+}
+
+/* Writes exactly "digits" digits with leading zeros, two at a time */
+static char* put_digits(char* p, uint32_t n, int digits)
+{
+   char* end = p + digits;
+
+   for (p = end; digits >= 2; digits -= 2)
+   {
+      uint32_t quot = DIV100(n);
+      const char* pair = &digitPairs[(n - quot * 100) * 2];
+      *--p = pair[1];
+      *--p = pair[0];
+      n = quot;
+   }
+   if (digits > 0)
+      *--p = '0' + n;
+
+   return end;
+}
+
+/* round(dec / 10^decimals * 2^fracDigits) with multiplications only */
+static uint32_t dec_to_frac(uint32_t dec, int decimals, int fracDigits)
+{
+   //In units of 10^-9, times 2^62 / 10^9 rounded up gives a Q32 estimate at most 1 too high
+   uint64_t x = (uint64_t)dec * pow10[FP_MAX_DECIMALS - decimals];
+   uint64_t q32 = (x * 4611686019u) >> 30;
+   uint32_t frac = (q32 + (1ull << (31 - fracDigits))) >> (32 - fracDigits);
+
+   //So the rounded result may be 1 too high right below a rounding boundary, check exactly
+   if (frac > 0 && (x << (fracDigits + 1)) < (2ull * frac - 1) * pow10[FP_MAX_DECIMALS])
+      frac--;
+
+   return frac;
+}
 
 char* fp_itoa(char * buf, s32fp a)
 {
-   int sign = a < 0?-1:1;
-   int32_t nat = (sign * a) >> FRAC_DIGITS;
-   uint32_t frac = ((UTOA_FRACDEC * ((sign * a) & FRAC_MASK))) >> FRAC_DIGITS;
+   return fp_itoa_dec(buf, a, FP_DECIMALS);
+}
+
+char* fp_itoa_dec(char * buf, s32fp a, int decimals)
+{
+   uint32_t mag = a < 0 ? 0u - (uint32_t)a : (uint32_t)a;
+   uint32_t nat = mag >> FRAC_DIGITS;
+   uint32_t frac;
    char *p = buf;
-   if (sign < 0)
+
+   decimals = decimals < 0 ? 0 : (decimals > FP_MAX_DECIMALS ? FP_MAX_DECIMALS : decimals);
+   //Round half away from zero, a carry goes to the integer part
+   frac = ((uint64_t)(mag & FRAC_MASK) * pow10[decimals] + (1u << (FRAC_DIGITS - 1))) >> FRAC_DIGITS;
+
+   if (frac >= pow10[decimals])
    {
-      *p = '-';
-      p++;
+      frac -= pow10[decimals];
+      nat++;
    }
-   p += my_ltoa(p, nat, 10);
-   *p = '.';
-   p++;
-   for (uint32_t dec = UTOA_FRACDEC / 10; dec > 1; dec /= 10)
+   if (a < 0 && (nat | frac) != 0)
+      *p++ = '-';
+
+   p = put_digits(p, nat, count_digits(nat));
+
+   if (decimals > 0)
    {
-      if ((frac / dec) == 0)
-      {
-         *p = '0';
-         p++;
-      }
+      *p++ = '.';
+      p = put_digits(p, frac, decimals);
    }
-   my_ltoa(p, frac, 10);
+   *p = 0;
    return buf;
 }
 
 s32fp fp_atoi(const char *str, int fracDigits)
 {
-   int nat = 0;
-   int frac = 0;
-   int div = 10;
+   uint32_t nat = 0;
+   uint32_t dec = 0;
+   int decimals = 0;
    int sign = 1;
+
    if ('-' == *str)
    {
       sign = -1;
@@ -62,109 +129,44 @@ s32fp fp_atoi(const char *str, int fracDigits)
    }
    for (; *str >= '0' && *str <= '9'; str++)
    {
-      nat *= 10;
-      nat += *str - '0';
+      nat = nat * 10 + (*str - '0');
    }
    if (*str != 0)
    {
       for (str++; *str >= '0' && *str <= '9'; str++)
       {
-         frac += (div / 2 + ((*str - '0') << fracDigits)) / div;
-         div *= 10;
+         //Digits beyond the 9th do not change the result at any useful precision
+         if (decimals < FP_MAX_DECIMALS)
+         {
+            dec = dec * 10 + (*str - '0');
+            decimals++;
+         }
       }
    }
 
-   return sign * ((nat << fracDigits) + frac);
+   uint32_t mag = (nat << fracDigits) + dec_to_frac(dec, decimals, fracDigits);
+   return sign < 0 ? (s32fp)(0u - mag) : (s32fp)mag;
 }
 
 u32fp fp_sqrt(u32fp rad)
 {
-   u32fp sqrt = rad >> (rad<1000?4:8); //Starting value for newton iteration
-   u32fp sqrtl;
-   sqrt = sqrt>FP_FROMINT(1)?sqrt:FP_FROMINT(1); //Must be > 0
-
-   do {
-      sqrtl = sqrt;
-      sqrt = (sqrt + FP_DIV(rad, sqrt)) >> 1;
-   } while ((sqrtl - sqrt) > 1);
-
-   return sqrt;
+   return fm_sqrt(rad);
 }
 
 s32fp fp_ln(unsigned int x)
 {
-   int n = 0;
-   const s32fp ln2 = FP_FROMFLT(0.6931471806);
-
-   if (x == 0)
-   {
-      return -1;
-   }
-   else
-   { //count leading zeros
-      uint32_t mask = 0xFFFFFFFF;
-      for (int i = 16; i > 0; i /= 2)
-      {
-         mask <<= i;
-         if ((x & mask) == 0)
-         {
-            n += i;
-            x <<= i;
-         }
-      }
-   }
-
-   s32fp ln = FP_FROMINT(31 - n);
-   x >>= 32 - FRAC_DIGITS - 1; //will result in fixed point number in [1,2)
-   ln += log2_approx(x, 5);
-   ln = FP_MUL(ln2, ln);
-   return ln;
-}
-
-static s32fp log2_approx(s32fp x, int loopLimit)
-{
-   int m = 0;
-   s32fp result = 0;
-
-   if (loopLimit == 0) return FP_FROMINT(1);
-   if (x == FP_FROMINT(1)) return 0;
-
-   while (x < FP_FROMINT(2))
-   {
-      x = FP_MUL(x, x);
-      m++;
-   }
-   s32fp p = FRAC_FAC >> m;
-   result = FP_MUL(p, FP_FROMINT(1) + log2_approx(x / 2, loopLimit - 1));
-
-   return result;
+   if (x == 0) return -1;
+   return fm_ln(x);
 }
 
 // Calculate the square root of the sum of two squares
-// This scales down the inputs as much as necessary to avoid overflow
 u32fp fp_hypot2(s32fp a, s32fp b)
 {
-  int n = 0;
-  while(a > 16383 || b > 16383 || a < -16383 || b < -16383) {
-    n++;
-    a /= 2;
-    b /= 2;
-  }
-  u32fp result = fp_sqrt(FP_MUL(a,a) + FP_MUL(b,b));
-  return result << n;
+   return fm_hypot2(a, b);
 }
 
 // Calculate the square root of the sum on three squares
-// This scales down the inputs as much as necessary to avoid overflow
 u32fp fp_hypot3(s32fp a, s32fp b, s32fp c)
 {
-  int n = 0;
-  while(a > 16383 || b > 16383 || c > 16383 || a < -16383 || b < -16383 || c < -16383) {
-    n++;
-    a /= 2;
-    b /= 2;
-    c /= 2;
-  }
-  u32fp result = fp_sqrt(FP_MUL(a,a) + FP_MUL(b,b) + FP_MUL(c,c));
-  return result << n;
+   return fm_hypot3(a, b, c);
 }
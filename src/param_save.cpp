@@ -24,14 +24,57 @@
 #include "param_save.h"
 #include "hwdefs.h"
 #include "my_string.h"
+#include "flashwriter.h"
+
+/* Parameters are stored as an append-only log. Each log page starts with a
+ * header carrying a sequence number followed by 8 byte records. Records are
+ * written in batches, each batch is closed by a commit record that holds the
+ * number of records in the batch and their CRC. A batch without a valid
+ * commit is ignored on load, so a power loss while saving only loses the
+ * batch that was being written.
+ * Saving appends the parameters that changed since the last save or load.
+ * When the page is full a complete snapshot is written to the next page,
+ * the previous page stays intact until the new one is committed. That is
+ * why at least two pages are needed.
+ * Log pages occupy PARAM_BLKNUM to PARAM_BLKNUM + PARAM_LOG_PAGES - 1,
+ * counted from the end of flash. With 1 kB pages a typical layout is
+ * PARAM_BLKNUM 1 (pages 1 and 2), the bootloader pin definitions in page 3
+ * and CAN1_BLKNUM 4 / CAN1_BLKNUM_B 5 for the CAN map. Units that used the
+ * old layout (PARAM_BLKNUM 1, CAN1_BLKNUM 2) are migrated on first boot: the
+ * legacy parameter page is converted on the first save and the CAN map is
+ * moved out of page 2 when CAN1_BLKNUM_LEGACY is 2, see canmap.cpp.
+ */
+#ifndef PARAM_LOG_PAGES
+#define PARAM_LOG_PAGES 2
+#endif
+
+#if PARAM_LOG_PAGES < 2
+#error PARAM_LOG_PAGES must be at least 2, otherwise a power loss during compaction loses all parameters
+#endif
+
+#if defined(CAN1_BLKNUM) && CAN1_BLKNUM >= PARAM_BLKNUM && CAN1_BLKNUM < (PARAM_BLKNUM + PARAM_LOG_PAGES)
+#error CAN1_BLKNUM overlaps parameter log pages, adjust PARAM_BLKNUM or PARAM_LOG_PAGES
+#endif
+#if defined(CAN1_BLKNUM_B) && CAN1_BLKNUM_B >= PARAM_BLKNUM && CAN1_BLKNUM_B < (PARAM_BLKNUM + PARAM_LOG_PAGES)
+#error CAN1_BLKNUM_B overlaps parameter log pages, adjust PARAM_BLKNUM or PARAM_LOG_PAGES
+#endif
+
+#ifndef PARAM_ASYNC_RECORDS
+#define PARAM_ASYNC_RECORDS 32 //Maximum number of records per background save
+#endif
 
 #define NUM_PARAMS ((PARAM_BLKSIZE - 8) / sizeof(PARAM_ENTRY))
 #define PARAM_WORDS (PARAM_BLKSIZE / 4)
 
+#define ELEMENT_FIRST 0xFF //element 0 is stored with the legacy filler value
+#define LOG_MAGIC     0x474F4C50 //"PLOG", can't collide with legacy pages as their 3rd byte is always 0xFF
+#define KEY_COMMIT    0xFFFE
+#define KEY_EMPTY     0xFFFF
+
 typedef struct
 {
    uint16_t key;
-   uint8_t dummy;
+   uint8_t element;
    uint8_t flags;
    uint32_t value;
 } PARAM_ENTRY;
@@ -43,70 +86,336 @@ typedef struct
    uint32_t padding;
 } PARAM_PAGE;
 
-static uint32_t GetFlashAddress()
+typedef struct
+{
+   uint32_t magic;
+   uint32_t sequence;
+   PARAM_ENTRY data[NUM_PARAMS];
+} LOG_PAGE;
+
+//A snapshot holds one record per parameter and array element plus the commit
+//record. It must fit one log page, a truncated snapshot would commit fine.
+#define PARAM_ENTRY(category, name, unit, min, max, def, id) + 1
+#define TESTP_ENTRY(category, name, unit, min, max, def, id)
+#define VALUE_ENTRY(name, unit, id)
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) + len
+static_assert((0 PARAM_LIST) + 1 <= NUM_PARAMS, "Parameters don't fit one log page, raise PARAM_BLKSIZE");
+#undef PARAM_ENTRY
+#undef TESTP_ENTRY
+#undef VALUE_ENTRY
+#undef ARRAY_ENTRY
+
+static uint32_t savedGeneration = 0;
+static PARAM_ENTRY asyncBatch[PARAM_ASYNC_RECORDS + 1]; //+1 for commit record
+static uint32_t asyncGeneration;
+static parm_save_callback asyncCallback;
+
+static uint32_t GetFlashAddress(uint32_t page)
 {
    uint32_t flashSize = desig_get_flash_size();
 
-   //Always save parameters to last flash page
-   return FLASH_BASE + flashSize * 1024 - PARAM_BLKNUM * PARAM_BLKSIZE;
+   //Always save parameters to last flash pages
+   return FLASH_BASE + flashSize * 1024 - (PARAM_BLKNUM + page) * PARAM_BLKSIZE;
 }
 
-/**
-* Save parameters to flash
-*
-* @return CRC of parameter flash page
-*/
-uint32_t parm_save()
+static LOG_PAGE* GetLogPage(uint32_t page)
 {
-   PARAM_PAGE parmPage;
-   uint32_t idx;
-   uint32_t paramAddress = GetFlashAddress();
-   uint32_t check = 0xFFFFFFFF;
-   uint32_t* baseAddress = (uint32_t*)paramAddress;
+   return (LOG_PAGE*)GetFlashAddress(page);
+}
 
-   for (int i = 0; i < PARAM_WORDS; i++, baseAddress++)
-      check &= *baseAddress;
+static uint32_t GetCommitCount(const PARAM_ENTRY* entry)
+{
+   return entry->element | (entry->flags << 8);
+}
+
+static bool IsEmpty(const PARAM_ENTRY* entry)
+{
+   return *(const uint32_t*)entry == 0xFFFFFFFF;
+}
+
+static bool IsValidCommit(const LOG_PAGE* logPage, uint32_t slot)
+{
+   const PARAM_ENTRY* entry = &logPage->data[slot];
+   uint32_t count = GetCommitCount(entry);
+
+   if (entry->key != KEY_COMMIT || count == 0 || count > slot)
+      return false;
 
    crc_reset();
-   memset32((int*)&parmPage, 0xFFFFFFFF, PARAM_WORDS);
+   return crc_calculate_block((uint32_t*)&logPage->data[slot - count], 2 * count) == entry->value;
+}
+
+static void LoadEntry(const PARAM_ENTRY* entry)
+{
+   Param::PARAM_NUM idx = Param::NumFromId(entry->key);
+
+   if (idx != Param::PARAM_INVALID && Param::GetType((Param::PARAM_NUM)idx) == Param::TYPE_PARAM)
+   {
+      if (ELEMENT_FIRST == entry->element)
+      {
+         Param::SetElementFixed(idx, 0, entry->value);
+         Param::SetFlagsRaw(idx, entry->flags);
+      }
+      else
+      {
+         Param::SetElementFixed(idx, entry->element, entry->value);
+      }
+   }
+}
+
+/** \brief Walk through log page and optionally replay all committed batches
+ *
+ * \param logPage page to scan
+ * \param apply true to load committed records into the parameter database
+ * \param[out] end first empty slot
+ * \param[out] lastCommit slot of last valid commit record
+ * \return number of valid commits
+ */
+static uint32_t ScanPage(const LOG_PAGE* logPage, bool apply, uint32_t& end, uint32_t& lastCommit)
+{
+   uint32_t commits = 0;
+
+   for (end = 0; end < NUM_PARAMS && !IsEmpty(&logPage->data[end]); end++)
+   {
+      //Records of torn batches are skipped as no valid commit covers them
+      if (IsValidCommit(logPage, end))
+      {
+         if (apply)
+         {
+            for (uint32_t slot = end - GetCommitCount(&logPage->data[end]); slot < end; slot++)
+               LoadEntry(&logPage->data[slot]);
+         }
+         lastCommit = end;
+         commits++;
+      }
+   }
+   return commits;
+}
+
+/** \brief Find the log page with the highest sequence number that holds at least one commit
+ *
+ * \param[out] end first empty slot of that page
+ * \param[out] lastCommit slot of its last valid commit record
+ * \return page number or -1 if there is no valid log page
+ */
+static int FindActivePage(uint32_t& end, uint32_t& lastCommit)
+{
+   int active = -1;
+   uint32_t sequence = 0;
+
+   for (uint32_t page = 0; page < PARAM_LOG_PAGES; page++)
+   {
+      const LOG_PAGE* logPage = GetLogPage(page);
+      uint32_t pageEnd, pageCommit;
+
+      if (logPage->magic == LOG_MAGIC && (active < 0 || logPage->sequence > sequence) &&
+          ScanPage(logPage, false, pageEnd, pageCommit) > 0)
+      {
+         active = page;
+         sequence = logPage->sequence;
+         end = pageEnd;
+         lastCommit = pageCommit;
+      }
+   }
+   return active;
+}
+
+static bool IsSelected(Param::PARAM_NUM idx, bool changedOnly)
+{
+   return Param::GetType(idx) == Param::TYPE_PARAM &&
+          (!changedOnly || Param::GetParamGeneration(idx) > savedGeneration);
+}
+
+static uint32_t CountRecords(bool changedOnly)
+{
+   uint32_t count = 0;
+
+   for (int idx = 0; idx < Param::PARAM_LAST; idx++)
+   {
+      if (IsSelected((Param::PARAM_NUM)idx, changedOnly))
+         count += Param::GetLength((Param::PARAM_NUM)idx);
+   }
+   return count;
+}
+
+static void MakeEntry(Param::PARAM_NUM idx, uint32_t element, PARAM_ENTRY& entry)
+{
+   entry.key = Param::GetAttrib(idx)->id;
+   entry.element = element == 0 ? ELEMENT_FIRST : element;
+   entry.flags = element == 0 ? (uint8_t)Param::GetFlag(idx) : 0xFF;
+   entry.value = Param::GetElement(idx, element);
+}
+
+static bool IsErased(uint32_t page)
+{
+   const uint32_t* pageWords = (const uint32_t*)GetLogPage(page);
+   uint32_t check = 0xFFFFFFFF;
+
+   for (int i = 0; i < PARAM_WORDS; i++)
+      check &= pageWords[i];
 
-   //Copy parameter values and keys to block structure
-   for (idx = 0; idx < NUM_PARAMS && idx < Param::PARAM_LAST; idx++)
+   return check == 0xFFFFFFFF;
+}
+
+static void MakeCommit(uint32_t count, uint32_t crc, PARAM_ENTRY& entry)
+{
+   entry.key = KEY_COMMIT;
+   entry.element = count & 0xFF;
+   entry.flags = count >> 8;
+   entry.value = crc;
+}
+
+static void WriteEntry(uint32_t address, const PARAM_ENTRY& entry)
+{
+   flash_program_word(address, *(const uint32_t*)&entry);
+   flash_program_word(address + 4, entry.value);
+}
+
+/** \brief Append one batch of records and its commit
+ *
+ * \param page log page to write to
+ * \param slot first empty slot
+ * \param changedOnly true to only write parameters changed since last save
+ * \return CRC of the batch
+ */
+static uint32_t AppendBatch(uint32_t page, uint32_t slot, bool changedOnly)
+{
+   LOG_PAGE* logPage = GetLogPage(page);
+   uint32_t first = slot;
+   PARAM_ENTRY entry;
+
+   for (int idx = 0; idx < Param::PARAM_LAST; idx++)
    {
-      if (Param::GetType((Param::PARAM_NUM)idx) == Param::TYPE_PARAM)
+      if (!IsSelected((Param::PARAM_NUM)idx, changedOnly)) continue;
+
+      //Callers made sure the batch and its commit fit, see static_assert for snapshots
+      for (uint32_t element = 0; element < Param::GetLength((Param::PARAM_NUM)idx); element++, slot++)
       {
-         const Param::Attributes *pAtr = Param::GetAttrib((Param::PARAM_NUM)idx);
-         parmPage.data[idx].flags = (uint8_t)Param::GetFlag((Param::PARAM_NUM)idx);
-         parmPage.data[idx].key = pAtr->id;
-         parmPage.data[idx].value = Param::Get((Param::PARAM_NUM)idx);
+         MakeEntry((Param::PARAM_NUM)idx, element, entry);
+         WriteEntry((uint32_t)&logPage->data[slot], entry);
       }
    }
 
-   parmPage.crc = crc_calculate_block(((uint32_t*)&parmPage), (2 * NUM_PARAMS));
+   //CRC is calculated from what actually ended up in flash
+   crc_reset();
+   MakeCommit(slot - first, crc_calculate_block((uint32_t*)&logPage->data[first], 2 * (slot - first)), entry);
+   WriteEntry((uint32_t)&logPage->data[slot], entry);
+
+   return entry.value;
+}
+
+/**
+* Save parameters to flash
+*
+* @return CRC of the written batch
+*/
+uint32_t parm_save()
+{
+   uint32_t end = 0, lastCommit = 0;
+   int page;
+   uint32_t changed = CountRecords(true);
+   uint32_t crc;
+
+   FlashWriter::Flush(); //Finish pending background save first
+   page = FindActivePage(end, lastCommit);
+
+   if (page >= 0 && changed == 0)
+      return GetLogPage(page)->data[lastCommit].value;
+
    flash_unlock();
 
-   if (check != 0xFFFFFFFF)
-      flash_erase_page(paramAddress);
+   if (page < 0 || (changed + 1) > (NUM_PARAMS - end))
+   {
+      //Compact: write a complete snapshot to the next page
+      uint32_t sequence = page < 0 ? 1 : GetLogPage(page)->sequence + 1;
+
+      //Without a log page 0 may still hold a legacy page. Leave it alone until
+      //the first snapshot is committed, a power loss would lose everything.
+      if (page < 0)
+         page = IsErased(0) ? 0 : 1;
+      else
+         page = (page + 1) % PARAM_LOG_PAGES;
+
+      if (!IsErased(page))
+         flash_erase_page(GetFlashAddress(page));
 
-   for (idx = 0; idx < PARAM_WORDS; idx++)
+      flash_program_word(GetFlashAddress(page), LOG_MAGIC);
+      flash_program_word(GetFlashAddress(page) + 4, sequence);
+      crc = AppendBatch(page, 0, false);
+   }
+   else
    {
-      uint32_t* pData = ((uint32_t*)&parmPage) + idx;
-      flash_program_word(paramAddress + idx * sizeof(uint32_t), *pData);
+      crc = AppendBatch(page, end, true);
    }
+
    flash_lock();
-   return parmPage.crc;
+   savedGeneration = Param::GetGeneration();
+   return crc;
+}
+
+static void AsyncSaveDone(bool ok, uint32_t crc)
+{
+   if (ok)
+      savedGeneration = asyncGeneration;
+
+   if (0 != asyncCallback)
+      asyncCallback(ok, crc);
 }
 
 /**
-* Load parameters from flash
+* Save changed parameters in the background via FlashWriter.
+* This never erases flash and is therefore safe to use while the motor
+* is running. It fails when the log page is full or more than
+* PARAM_ASYNC_RECORDS records would have to be written.
+* Like parm_save() this uses the CRC unit so call it with interrupts disabled
 *
-* @retval 0 Parameters loaded successfully
-* @retval -1 CRC error, parameters not loaded
+* @param done called from FlashWriter::Run() when the batch is in flash, may be 0
+* @retval 0 save has been queued or nothing needed saving
+* @retval -1 save needs erase or too many records, use parm_save() when stopped
+* @retval -2 a background save is still running
 */
-int parm_load()
+int parm_save_async(parm_save_callback done)
+{
+   uint32_t end = 0, lastCommit = 0, count = 0;
+   int page;
+
+   if (FlashWriter::IsBusy()) return -2;
+
+   page = FindActivePage(end, lastCommit);
+   uint32_t changed = CountRecords(true);
+
+   if (page < 0 || changed > PARAM_ASYNC_RECORDS || (changed + 1) > (NUM_PARAMS - end))
+      return -1;
+
+   if (changed == 0)
+   {
+      if (0 != done) done(true, GetLogPage(page)->data[lastCommit].value);
+      return 0;
+   }
+
+   for (int idx = 0; idx < Param::PARAM_LAST; idx++)
+   {
+      if (!IsSelected((Param::PARAM_NUM)idx, true)) continue;
+
+      for (uint32_t element = 0; element < Param::GetLength((Param::PARAM_NUM)idx); element++, count++)
+         MakeEntry((Param::PARAM_NUM)idx, element, asyncBatch[count]);
+   }
+
+   crc_reset();
+   MakeCommit(count, crc_calculate_block((uint32_t*)asyncBatch, 2 * count), asyncBatch[count]);
+
+   asyncGeneration = Param::GetGeneration();
+   asyncCallback = done;
+   //Commit record is the last word pair programmed, so a power loss leaves no valid partial batch
+   FlashWriter::Program((uint32_t)&GetLogPage(page)->data[end], (uint32_t*)asyncBatch, 2 * (count + 1), AsyncSaveDone);
+
+   return 0;
+}
+
+/** \brief Load pre-log parameter page as written by earlier versions */
+static int LoadLegacy()
 {
-   uint32_t paramAddress = GetFlashAddress();
-   PARAM_PAGE *parmPage = (PARAM_PAGE *)paramAddress;
+   PARAM_PAGE *parmPage = (PARAM_PAGE *)GetFlashAddress(0);
 
    crc_reset();
    uint32_t crc = crc_calculate_block(((uint32_t*)parmPage), (2 * NUM_PARAMS));
@@ -114,16 +423,31 @@ int parm_load()
    if (crc == parmPage->crc)
    {
       for (unsigned int idxPage = 0; idxPage < NUM_PARAMS; idxPage++)
-      {
-         Param::PARAM_NUM idx = Param::NumFromId(parmPage->data[idxPage].key);
-         if (idx != Param::PARAM_INVALID && Param::GetType((Param::PARAM_NUM)idx) == Param::TYPE_PARAM)
-         {
-            Param::SetFixed(idx, parmPage->data[idxPage].value);
-            Param::SetFlagsRaw(idx, parmPage->data[idxPage].flags);
-         }
-      }
+         LoadEntry(&parmPage->data[idxPage]);
       return 0;
    }
 
    return -1;
 }
+
+/**
+* Load parameters from flash
+*
+* @retval 0 Parameters loaded successfully
+* @retval -1 CRC error, parameters not loaded
+*/
+int parm_load()
+{
+   uint32_t end, lastCommit;
+   int page = FindActivePage(end, lastCommit);
+
+   if (page >= 0)
+   {
+      ScanPage(GetLogPage(page), true, end, lastCommit);
+      savedGeneration = Param::GetGeneration();
+      return 0;
+   }
+
+   //Legacy pages are converted to a log on the next save
+   return LoadLegacy();
+}
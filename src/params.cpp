@@ -23,9 +23,10 @@
 namespace Param
 {
 
-#define PARAM_ENTRY(category, name, unit, min, max, def, id) { category, #name, unit, FP_FROMFLT(min), FP_FROMFLT(max), FP_FROMFLT(def), id, TYPE_PARAM },
-#define TESTP_ENTRY(category, name, unit, min, max, def, id) { category, #name, unit, FP_FROMFLT(min), FP_FROMFLT(max), FP_FROMFLT(def), id, TYPE_TESTPARAM },
-#define VALUE_ENTRY(name, unit, id) { 0, #name, unit, 0, 0, 0, id, TYPE_SPOTVALUE },
+#define PARAM_ENTRY(category, name, unit, min, max, def, id) { category, #name, unit, FP_FROMFLT(min), FP_FROMFLT(max), FP_FROMFLT(def), id, TYPE_PARAM, 1 },
+#define TESTP_ENTRY(category, name, unit, min, max, def, id) { category, #name, unit, FP_FROMFLT(min), FP_FROMFLT(max), FP_FROMFLT(def), id, TYPE_TESTPARAM, 1 },
+#define VALUE_ENTRY(name, unit, id) { 0, #name, unit, 0, 0, 0, id, TYPE_SPOTVALUE, 1 },
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) { category, #name, unit, FP_FROMFLT(min), FP_FROMFLT(max), FP_FROMFLT(def), id, TYPE_PARAM, len },
 static const Attributes attribs[] =
 {
     PARAM_LIST
@@ -33,10 +34,12 @@ static const Attributes attribs[] =
 #undef PARAM_ENTRY
 #undef TESTP_ENTRY
 #undef VALUE_ENTRY
+#undef ARRAY_ENTRY
 
 #define PARAM_ENTRY(category, name, unit, min, max, def, id) FP_FROMFLT(def),
 #define TESTP_ENTRY(category, name, unit, min, max, def, id) FP_FROMFLT(def),
 #define VALUE_ENTRY(name, unit, id) 0,
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) FP_FROMFLT(def),
 static s32fp values[] =
 {
     PARAM_LIST
@@ -44,10 +47,45 @@ static s32fp values[] =
 #undef PARAM_ENTRY
 #undef TESTP_ENTRY
 #undef VALUE_ENTRY
+#undef ARRAY_ENTRY
+
+//Array elements are stored contiguously, one member per array parameter.
+//values[] additionally mirrors element 0 so that Get() stays a plain lookup
+#define PARAM_ENTRY(category, name, unit, min, max, def, id)
+#define TESTP_ENTRY(category, name, unit, min, max, def, id)
+#define VALUE_ENTRY(name, unit, id)
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) static_assert(len > 0 && len <= 255, "Length of " #name " must fit the 8 bit length attribute");
+PARAM_LIST
+#undef ARRAY_ENTRY
+
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) s32fp name[len];
+static struct
+{
+    PARAM_LIST
+} arrayStore;
+#undef ARRAY_ENTRY
+
+struct ArrayInfo
+{
+   PARAM_NUM param;
+   s32fp* data;
+};
+
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) { name, arrayStore.name },
+static const ArrayInfo arrays[] =
+{
+    PARAM_LIST
+    { PARAM_INVALID, 0 }
+};
+#undef PARAM_ENTRY
+#undef TESTP_ENTRY
+#undef VALUE_ENTRY
+#undef ARRAY_ENTRY
 
 #define PARAM_ENTRY(category, name, unit, min, max, def, id) FLAG_NONE,
 #define TESTP_ENTRY(category, name, unit, min, max, def, id) FLAG_NONE,
 #define VALUE_ENTRY(name, unit, id) FLAG_NONE,
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) FLAG_NONE,
 static uint8_t flags[] =
 {
     PARAM_LIST
@@ -55,11 +93,13 @@ static uint8_t flags[] =
 #undef PARAM_ENTRY
 #undef TESTP_ENTRY
 #undef VALUE_ENTRY
+#undef ARRAY_ENTRY
 
 //Duplicate ID check
 #define PARAM_ENTRY(category, name, unit, min, max, def, id) ITEM_##id,
 #define TESTP_ENTRY(category, name, unit, min, max, def, id) ITEM_##id,
 #define VALUE_ENTRY(name, unit, id) ITEM_##id,
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) ITEM_##id,
 enum _dupes
 {
     PARAM_LIST
@@ -67,6 +107,128 @@ enum _dupes
 #undef PARAM_ENTRY
 #undef TESTP_ENTRY
 #undef VALUE_ENTRY
+#undef ARRAY_ENTRY
+
+static uint32_t generation = 0;
+static uint32_t generations[PARAM_LAST + 1]; //Generation at which each parameter was last changed
+
+static void Touch(PARAM_NUM ParamNum)
+{
+   generations[ParamNum] = ++generation;
+}
+
+static uint32_t HashBytes(uint32_t hash, const void* data, uint32_t len)
+{
+   const uint8_t* bytes = (const uint8_t*)data;
+
+   //FNV-1a
+   for (uint32_t i = 0; i < len; i++)
+   {
+      hash ^= bytes[i];
+      hash *= 16777619;
+   }
+   return hash;
+}
+
+static uint32_t HashString(uint32_t hash, const char* str)
+{
+   if (0 == str) str = "";
+   return HashBytes(hash, str, my_strlen(str) + 1); //include terminator so "ab","c" != "a","bc"
+}
+
+static uint16_t idIndex[PARAM_LAST + 1]; //Parameter indexes sorted by unique id
+
+static bool BuildIdIndex()
+{
+   //Insertion sort, runs once and the list is usually almost sorted already
+   for (int idx = 0; idx < PARAM_LAST; idx++)
+   {
+      int pos = idx;
+
+      for (; pos > 0 && attribs[idIndex[pos - 1]].id > attribs[idx].id; pos--)
+         idIndex[pos] = idIndex[pos - 1];
+
+      idIndex[pos] = idx;
+   }
+   return true;
+}
+
+static uint8_t categories[PARAM_LAST + 1]; //Category index of each parameter, +1 avoids empty array
+static uint8_t numCategories = 0;
+
+static bool BuildCategoryIndex()
+{
+   for (int idx = 0; idx < PARAM_LAST; idx++)
+   {
+      categories[idx] = CATEGORY_NONE;
+
+      if (0 == attribs[idx].category) continue;
+
+      for (int prev = 0; prev < idx; prev++)
+      {
+         if (0 != attribs[prev].category && 0 == my_strcmp(attribs[prev].category, attribs[idx].category))
+         {
+            categories[idx] = categories[prev];
+            break;
+         }
+      }
+
+      if (CATEGORY_NONE == categories[idx] && numCategories < CATEGORY_NONE)
+         categories[idx] = numCategories++;
+   }
+   return true;
+}
+
+//Both indexes are built by the startup code before main(), so an SDO query
+//from the CAN interrupt can never see a half built index
+static const bool idIndexBuilt = BuildIdIndex();
+static const bool categoriesBuilt = BuildCategoryIndex();
+
+/** \brief Set all array elements to their default, the store only has zeros */
+static bool InitArrays()
+{
+   for (const ArrayInfo* arr = arrays; arr->param != PARAM_INVALID; arr++)
+   {
+      for (uint32_t element = 0; element < attribs[arr->param].length; element++)
+         arr->data[element] = attribs[arr->param].def;
+   }
+   return true;
+}
+
+static const bool arraysInitialized = InitArrays();
+
+static uint32_t CalcSchemaHash()
+{
+   uint32_t hash = 2166136261;
+
+   for (int idx = 0; idx < PARAM_LAST; idx++)
+   {
+      const Attributes* atr = &attribs[idx];
+      hash = HashString(hash, atr->name);
+      hash = HashString(hash, atr->unit);
+      hash = HashString(hash, atr->category);
+      hash = HashBytes(hash, &atr->min, sizeof(atr->min));
+      hash = HashBytes(hash, &atr->max, sizeof(atr->max));
+      hash = HashBytes(hash, &atr->def, sizeof(atr->def));
+      hash = HashBytes(hash, &atr->id, sizeof(atr->id));
+      hash = HashBytes(hash, &atr->type, sizeof(atr->type));
+      hash = HashBytes(hash, &atr->length, sizeof(atr->length));
+   }
+   return hash;
+}
+
+//Like the indexes above, the schema hash never changes and is computed before main()
+static const uint32_t schemaHash = CalcSchemaHash();
+
+static s32fp* FindArray(PARAM_NUM ParamNum)
+{
+   for (const ArrayInfo* arr = arrays; arr->param != PARAM_INVALID; arr++)
+   {
+      if (arr->param == ParamNum)
+         return arr->data;
+   }
+   return 0;
+}
 
 
 /**
@@ -75,13 +237,19 @@ enum _dupes
 * @param[in] ParamNum Parameter index
 * @param[in] ParamVal New value of parameter
 * @return 0 if set ok, -1 if ParamVal outside of allowed range
+* @note For array parameters this sets element 0
 */
 int Set(PARAM_NUM ParamNum, s32fp ParamVal)
 {
     char res = -1;
 
+    if (attribs[ParamNum].length > 1)
+        return SetElement(ParamNum, 0, ParamVal);
+
     if (ParamVal >= attribs[ParamNum].min && ParamVal <= attribs[ParamNum].max)
     {
+        if (values[ParamNum] != ParamVal)
+            Touch(ParamNum);
         values[ParamNum] = ParamVal;
         Change(ParamNum);
         res = 0;
@@ -141,7 +309,7 @@ bool GetBool(PARAM_NUM ParamNum)
 */
 void SetInt(PARAM_NUM ParamNum, int ParamVal)
 {
-   values[ParamNum] = FP_FROMINT(ParamVal);
+   SetFixed(ParamNum, FP_FROMINT(ParamVal));
 }
 
 /**
@@ -149,10 +317,15 @@ void SetInt(PARAM_NUM ParamNum, int ParamVal)
 *
 * @param[in] ParamNum Parameter index
 * @param[in] ParamVal New value of parameter
+* @note For array parameters this sets element 0
 */
 void SetFixed(PARAM_NUM ParamNum, s32fp ParamVal)
 {
-   values[ParamNum] = ParamVal;
+   //Spot values are written all the time and have neither elements nor a generation
+   if (TYPE_SPOTVALUE == attribs[ParamNum].type)
+      values[ParamNum] = ParamVal;
+   else
+      SetElementFixed(ParamNum, 0, ParamVal);
 }
 
 /**
@@ -163,7 +336,150 @@ void SetFixed(PARAM_NUM ParamNum, s32fp ParamVal)
 */
 void SetFloat(PARAM_NUM ParamNum, float ParamVal)
 {
-   values[ParamNum] = FP_FROMFLT(ParamVal);
+   SetFixed(ParamNum, FP_FROMFLT(ParamVal));
+}
+
+/**
+* Set an element of an array parameter
+*
+* @param[in] ParamNum Parameter index
+* @param[in] element Element index
+* @param[in] ParamVal New value of element
+* @return 0 if set ok, -1 if ParamVal outside of allowed range or element invalid
+*/
+int SetElement(PARAM_NUM ParamNum, uint32_t element, s32fp ParamVal)
+{
+   const Attributes* atr = &attribs[ParamNum];
+
+   if (element >= atr->length || ParamVal < atr->min || ParamVal > atr->max)
+      return -1;
+
+   SetElementFixed(ParamNum, element, ParamVal);
+   Change(ParamNum);
+   return 0;
+}
+
+/**
+* Set an element of an array parameter without range check and callback
+*
+* @param[in] ParamNum Parameter index
+* @param[in] element Element index, ignored if out of range
+* @param[in] ParamVal New value of element
+*/
+void SetElementFixed(PARAM_NUM ParamNum, uint32_t element, s32fp ParamVal)
+{
+   s32fp* data = FindArray(ParamNum);
+
+   if (element < attribs[ParamNum].length && GetElement(ParamNum, element) != ParamVal)
+      Touch(ParamNum);
+   if (0 == element)
+      values[ParamNum] = ParamVal;
+   if (0 != data && element < attribs[ParamNum].length)
+      data[element] = ParamVal;
+}
+
+/**
+* Check values for SetMultiple() without setting them
+*
+* @param[in] updates values to check
+* @param[in] count number of updates
+* @param[out] status UPDATE_STATUS per update, may be 0
+* @return number of invalid updates
+*/
+int CheckMultiple(const Update* updates, uint32_t count, uint8_t* status)
+{
+   int errors = 0;
+
+   for (uint32_t i = 0; i < count; i++)
+   {
+      const Update* u = &updates[i];
+      uint8_t result = UPDATE_OK;
+
+      if (u->param >= PARAM_LAST)
+         result = UPDATE_INVALID_PARAM;
+      else if (u->element >= attribs[u->param].length)
+         result = UPDATE_INVALID_ELEMENT;
+      else if (u->value < attribs[u->param].min || u->value > attribs[u->param].max)
+         result = UPDATE_OUT_OF_RANGE;
+
+      if (UPDATE_OK != result) errors++;
+      if (0 != status) status[i] = result;
+   }
+
+   return errors;
+}
+
+/**
+* Set several parameters at once, either all or none
+*
+* All values are checked first, only if all are valid they are written.
+* Change() is not called, the caller notifies once after the whole set,
+* Change(PARAM_LAST) when more than one parameter was given.
+* Disable interrupts around the call if they must not see a partial update.
+*
+* @param[in] updates values to set
+* @param[in] count number of updates
+* @param[out] status UPDATE_STATUS per update, may be 0
+* @return number of invalid updates, 0 if all were set
+*/
+int SetMultiple(const Update* updates, uint32_t count, uint8_t* status)
+{
+   int errors = CheckMultiple(updates, count, status);
+
+   if (errors > 0) return errors;
+
+   for (uint32_t i = 0; i < count; i++)
+      SetElementFixed(updates[i].param, updates[i].element, updates[i].value);
+
+   return 0;
+}
+
+/**
+* Get an element of an array parameter
+*
+* @param[in] ParamNum Parameter index
+* @param[in] element Element index
+* @return Element value, 0 if element is out of range
+*/
+s32fp GetElement(PARAM_NUM ParamNum, uint32_t element)
+{
+   uint32_t length;
+   const s32fp* data = GetArray(ParamNum, length);
+
+   return element < length ? data[element] : 0;
+}
+
+/**
+* Get direct read access to all elements of a parameter.
+* Scalar parameters are returned as array of length 1
+*
+* @param[in] ParamNum Parameter index
+* @param[out] length Number of elements
+* @return Pointer to the first element
+*/
+const s32fp* GetArray(PARAM_NUM ParamNum, uint32_t& length)
+{
+   s32fp* data = FindArray(ParamNum);
+
+   if (0 == data)
+   {
+      length = 1;
+      return &values[ParamNum];
+   }
+
+   length = attribs[ParamNum].length;
+   return data;
+}
+
+/**
+* Get number of elements of a parameter
+*
+* @param[in] ParamNum Parameter index
+* @return Number of elements, 1 for scalar parameters
+*/
+uint32_t GetLength(PARAM_NUM ParamNum)
+{
+   return attribs[ParamNum].length;
 }
 
 /**
@@ -196,18 +512,22 @@ PARAM_NUM NumFromString(const char *name)
 */
 PARAM_NUM NumFromId(uint32_t id)
 {
-    PARAM_NUM paramNum = PARAM_INVALID;
-    const Attributes *pCurAtr = attribs;
+    int low = 0, high = PARAM_LAST - 1;
 
-    for (int i = 0; i < PARAM_LAST; i++, pCurAtr++)
+    //Ids are unique (see duplicate check above) so a plain binary search will do
+    while (low <= high)
     {
-         if (pCurAtr->id == id)
-         {
-             paramNum = (PARAM_NUM)i;
-             break;
-         }
+       int mid = (low + high) / 2;
+       uint32_t midId = attribs[idIndex[mid]].id;
+
+       if (midId == id)
+          return (PARAM_NUM)idIndex[mid];
+       else if (midId < id)
+          low = mid + 1;
+       else
+          high = mid - 1;
     }
-    return paramNum;
+    return PARAM_INVALID;
 }
 
 /**
@@ -229,23 +549,28 @@ void LoadDefaults()
    for (int idx = 0; idx < PARAM_LAST; idx++, curAtr++)
    {
       if (curAtr->id > 0)
-         SetFixed((PARAM_NUM)idx, curAtr->def);
+      {
+         for (uint32_t element = 0; element < curAtr->length; element++)
+            SetElementFixed((PARAM_NUM)idx, element, curAtr->def);
+      }
    }
 }
 
 void SetFlagsRaw(PARAM_NUM param, uint8_t rawFlags)
 {
+   if (flags[param] != rawFlags)
+      Touch(param);
    flags[param] = rawFlags;
 }
 
 void SetFlag(PARAM_NUM param, PARAM_FLAG flag)
 {
-   flags[param] |= (uint8_t)flag;
+   SetFlagsRaw(param, flags[param] | (uint8_t)flag);
 }
 
 void ClearFlag(PARAM_NUM param, PARAM_FLAG flag)
 {
-   flags[param] &= (uint8_t)~flag;
+   SetFlagsRaw(param, flags[param] & (uint8_t)~flag);
 }
 
 PARAM_FLAG GetFlag(PARAM_NUM param)
@@ -266,10 +591,124 @@ uint32_t GetIdSum()
 #define PARAM_ENTRY(category, name, unit, min, max, def, id) id +
 #define TESTP_ENTRY(category, name, unit, min, max, def, id) id +
 #define VALUE_ENTRY(name, unit, id) id +
+#define ARRAY_ENTRY(category, name, unit, min, max, def, len, id) id +
    return PARAM_LIST PARAM_ID_SUM_START_OFFSET;
 #undef PARAM_ENTRY
 #undef TESTP_ENTRY
 #undef VALUE_ENTRY
+#undef ARRAY_ENTRY
+}
+
+/**
+* Get the category index of a parameter. The index is generated from the
+* order in which categories first appear in PARAM_LIST
+*
+* @param[in] param Parameter index
+* @return Category index or CATEGORY_NONE for spot values
+*/
+uint8_t GetCategory(PARAM_NUM param)
+{
+   return categories[param];
+}
+
+/**
+* Get the name of a category
+*
+* @param[in] category Category index
+* @return Category name or 0 if index is invalid
+*/
+const char* GetCategoryName(uint8_t category)
+{
+   for (int idx = 0; idx < PARAM_LAST; idx++)
+   {
+      if (categories[idx] == category)
+         return attribs[idx].category;
+   }
+   return 0;
+}
+
+uint8_t GetNumCategories()
+{
+   return numCategories;
+}
+
+/**
+* Get category index from its name
+*
+* @param[in] name Category name
+* @return Category index or CATEGORY_NONE if not found
+*/
+uint8_t CategoryFromString(const char* name)
+{
+   for (uint8_t category = 0; category < GetNumCategories(); category++)
+   {
+      if (0 == my_strcmp(GetCategoryName(category), name))
+         return category;
+   }
+   return CATEGORY_NONE;
+}
+
+/** Initialize query so that it matches all visible parameters */
+void InitQuery(Query& query)
+{
+   query.flags = QUERY_ALL;
+   query.category = CATEGORY_ALL;
+   query.first = 0;
+   query.last = PARAM_LAST - 1;
+   query.since = 0;
+}
+
+/**
+* Check whether a parameter is selected by a query
+*
+* @param[in] param Parameter index
+* @param[in] query Query to check against
+* @return true if parameter is part of the query result
+*/
+bool MatchesQuery(PARAM_NUM param, const Query& query)
+{
+   if ((flags[param] & FLAG_HIDDEN) && !(query.flags & QUERY_HIDDEN))
+      return false;
+   if (param < query.first || param > query.last)
+      return false;
+   //Spot values change all the time so they are always part of a delta
+   if (query.since > 0 && attribs[param].type != TYPE_SPOTVALUE && generations[param] <= query.since)
+      return false;
+   return query.category == CATEGORY_ALL || query.category == GetCategory(param);
+}
+
+/**
+* Get a hash over the parameter schema, i.e. names, units, categories,
+* ranges, defaults, types and IDs. Clients can cache the metadata as
+* long as the hash doesn't change
+*
+* @return FNV-1a hash of the schema
+*/
+uint32_t GetSchemaHash()
+{
+   return schemaHash;
+}
+
+/**
+* Get the current generation. It is incremented on every change
+* of a parameter value or flag
+*
+* @return current generation
+*/
+uint32_t GetGeneration()
+{
+   return generation;
+}
+
+/**
+* Get the generation at which a parameter was last changed
+*
+* @param[in] param Parameter index
+* @return generation, 0 if never changed
+*/
+uint32_t GetParamGeneration(PARAM_NUM param)
+{
+   return generations[param];
 }
 
 }
@@ -0,0 +1,191 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "paramstreamer.h"
+#include "printf.h"
+
+#define BUF_MASK (PARAMSTREAM_BUFSIZE - 1)
+
+#if (PARAMSTREAM_BUFSIZE & BUF_MASK) != 0
+#error PARAMSTREAM_BUFSIZE must be a power of 2
+#endif
+
+#if PARAMSTREAM_BUFSIZE <= PARAMSTREAM_MAX_VALUES
+#error PARAMSTREAM_BUFSIZE must hold at least one sample
+#endif
+
+volatile bool ParamStreamer::running = false;
+ParamStreamer::Format ParamStreamer::format;
+uint32_t ParamStreamer::lastValues[PARAMSTREAM_MAX_VALUES];
+uint32_t ParamStreamer::lastTick;
+uint16_t ParamStreamer::samplesToKeyframe;
+Terminal* ParamStreamer::terminal;
+Param::PARAM_NUM ParamStreamer::params[PARAMSTREAM_MAX_VALUES];
+int ParamStreamer::numParams;
+uint16_t ParamStreamer::decimation;
+uint16_t ParamStreamer::ticksToSample;
+int32_t ParamStreamer::repetitions;
+uint32_t ParamStreamer::ticks;
+uint32_t ParamStreamer::overruns;
+volatile uint32_t ParamStreamer::head;
+volatile uint32_t ParamStreamer::tail;
+uint32_t ParamStreamer::samples[PARAMSTREAM_BUFSIZE];
+
+void ParamStreamer::Start(Terminal* term, const Param::PARAM_NUM* p, int num, uint16_t dec, int32_t reps, Format fmt)
+{
+   Stop();
+
+   if (num > PARAMSTREAM_MAX_VALUES) num = PARAMSTREAM_MAX_VALUES;
+
+   for (int i = 0; i < num; i++)
+      params[i] = p[i];
+
+   numParams = num;
+   decimation = dec > 0 ? dec : 1;
+   ticksToSample = 1; //first sample right away
+   repetitions = reps;
+   format = fmt;
+   samplesToKeyframe = 0;
+   ticks = 0;
+   overruns = 0;
+   head = 0;
+   tail = 0;
+   terminal = term;
+   if (0 != term) term->SetBackgroundTask(Run);
+   running = numParams > 0 && repetitions != 0;
+}
+
+void ParamStreamer::Stop()
+{
+   running = false;
+}
+
+void ParamStreamer::Tick()
+{
+   if (!running) return;
+
+   ticks++;
+
+   if (--ticksToSample > 0) return;
+
+   ticksToSample = decimation;
+   uint32_t h = head;
+
+   if (PARAMSTREAM_BUFSIZE - (h - tail) < (uint32_t)(numParams + 1))
+   {
+      overruns++;
+      return;
+   }
+
+   samples[h & BUF_MASK] = ticks - 1; //first sample has time stamp 0
+   for (int i = 0; i < numParams; i++)
+      samples[(h + 1 + i) & BUF_MASK] = Param::Get(params[i]);
+
+   head = h + numParams + 1;
+
+   if (repetitions > 0 && --repetitions == 0)
+      running = false; //buffered samples are still printed
+}
+
+void ParamStreamer::Run(Terminal* term)
+{
+   if (term == terminal)
+      Print(term);
+}
+
+void ParamStreamer::Print(IPutChar* out)
+{
+   while (tail != head)
+   {
+      uint32_t t = tail;
+
+      if (FORMAT_DELTA == format)
+      {
+         PrintDelta(out, t);
+      }
+      else if (FORMAT_BINARY == format)
+      {
+         for (int i = 0; i <= numParams; i++)
+         {
+            uint32_t word = samples[(t + i) & BUF_MASK];
+
+            for (int b = 0; b < 32; b += 8)
+               out->PutChar(word >> b); //little endian like the MCU
+         }
+      }
+      else
+      {
+         fprintf(out, "%u", samples[t & BUF_MASK]);
+
+         for (int i = 1; i <= numParams; i++)
+            fprintf(out, ",%f", samples[(t + i) & BUF_MASK]);
+         fprintf(out, "\r\n");
+      }
+      tail = t + numParams + 1;
+   }
+}
+
+/** Keyframes carry absolute values, delta samples the difference to the
+ * previous sample. Both are zigzag and varint encoded, see header.
+ */
+void ParamStreamer::PrintDelta(IPutChar* out, uint32_t t)
+{
+   uint32_t tick = samples[t & BUF_MASK];
+   bool keyframe = 0 == samplesToKeyframe;
+
+   if (keyframe)
+   {
+      samplesToKeyframe = PARAMSTREAM_KEYFRAME_INTERVAL;
+      lastTick = 0;
+
+      for (int i = 0; i < numParams; i++)
+         lastValues[i] = 0;
+   }
+   samplesToKeyframe--;
+
+   if (keyframe)
+   {
+      out->PutChar((char)DELTA_KEYFRAME);
+      PutVarint(out, tick);
+   }
+   else
+   {
+      PutVarint(out, (tick - lastTick) << 1); //even first byte tells it apart from a keyframe
+   }
+   lastTick = tick;
+
+   for (int i = 0; i < numParams; i++)
+   {
+      uint32_t value = samples[(t + 1 + i) & BUF_MASK];
+      int32_t diff = value - lastValues[i];
+
+      PutVarint(out, (diff << 1) ^ (diff >> 31)); //zigzag, small negative numbers become small positive numbers
+      lastValues[i] = value;
+   }
+}
+
+void ParamStreamer::PutVarint(IPutChar* out, uint32_t value)
+{
+   //7 bits per byte, LSB first, MSB set on all but the last byte
+   while (value >= 0x80)
+   {
+      out->PutChar((value & 0x7F) | 0x80);
+      value >>= 7;
+   }
+   out->PutChar(value);
+}
@@ -18,18 +18,22 @@
  */
 #include "picontroller.h"
 #include "my_math.h"
+#include "fixed.h"
+
+typedef Fixed<31 - FRAC_DIGITS, FRAC_DIGITS> Fp;
 
 template<>
 int32_t PiControllerGeneric<s32fp, int32_t>::Run(s32fp curVal, int32_t feedForward)
 {
-   s32fp err = refVal - curVal;
-   esum += err;
+   Fp err = Fp::FromRaw(refVal) - Fp::FromRaw(curVal);
+   esum = (Fp::FromRaw(esum) + err).Raw();
 
    //anti windup
    esum = MIN(esum, maxSum);
    esum = MAX(esum, minSum);
 
-   int32_t y = feedForward + FP_TOINT(err * kp + (esum / frequency) * ki);
+   //Saturates instead of wrapping around for large errors or gains
+   int32_t y = feedForward + (err * kp + Fp::FromRaw(esum / frequency) * ki).ToInt();
    int32_t ylim = MAX(y, minY);
    ylim = MIN(ylim, maxY);
 
@@ -56,9 +60,9 @@ float PiControllerGeneric<float, float>::Run(float curVal, float feedForward)
 template<>
 int32_t PiControllerGeneric<s32fp, int32_t>::RunProportionalOnly(s32fp curVal)
 {
-   s32fp err = refVal - curVal;
+   Fp err = Fp::FromRaw(refVal) - Fp::FromRaw(curVal);
 
-   int32_t y = FP_TOINT(err * kp);
+   int32_t y = (err * kp).ToInt();
    int32_t ylim = MAX(y, minY);
    ylim = MIN(ylim, maxY);
 
@@ -72,8 +76,8 @@ void PiControllerGeneric<s32fp, int32_t>::SetIntegralGain(int32_t ki)
 
     if (ki != 0)
     {
-       minSum = FP_FROMINT((minY * frequency) / ABS(ki));
-       maxSum = FP_FROMINT((maxY * frequency) / ABS(ki));
+       minSum = Fp::FromInt(((int64_t)minY * frequency) / ABS(ki)).Raw();
+       maxSum = Fp::FromInt(((int64_t)maxY * frequency) / ABS(ki)).Raw();
     }
 }
 
@@ -51,6 +51,7 @@ class StringPutChar: public IPutChar
 public:
    StringPutChar(char *s) : s(s) {}
    void PutChar(char c) { *(s++) = c; }
+   void PutBuffer(const char* buf, int len) { while (len-- > 0) *(s++) = *(buf++); }
 
 private:
    char *s;
@@ -59,11 +60,12 @@ private:
 static int prints(IPutChar* put, const char *string, int width, int pad)
 {
 	int pc = 0, padchar = ' ';
+	int len = 0;
+	const char *ptr;
+
+	for (ptr = string; *ptr; ++ptr) ++len;
 
 	if (width > 0) {
-		int len = 0;
-		const char *ptr;
-		for (ptr = string; *ptr; ++ptr) ++len;
 		if (len >= width) width = 0;
 		else width -= len;
 		if (pad & PAD_ZERO) padchar = '0';
@@ -74,10 +76,8 @@ static int prints(IPutChar* put, const char *string, int width, int pad)
 			++pc;
 		}
 	}
-	for ( ; *string ; ++string) {
-		put->PutChar(*string);
-		++pc;
-	}
+	put->PutBuffer(string, len);
+	pc += len;
 	for ( ; width > 0; --width) {
 		put->PutChar(padchar);
 		++pc;
@@ -131,7 +131,7 @@ static int printi(IPutChar* put, int i, int b, int sg, int width, int pad, int l
 
 static int printfp(IPutChar* put, int i, int width, int pad)
 {
-	char print_buf[PRINT_BUF_LEN];
+	char print_buf[FP_ITOA_BUFSIZE(FP_DECIMALS)];
 
    fp_itoa(print_buf, i);
 
@@ -163,7 +163,7 @@ static int print(IPutChar* put, const char *format, va_list args )
 				width += *format - '0';
 			}
 			if( *format == 's' ) {
-				char *s = (char *)va_arg( args, int );
+				char *s = va_arg( args, char * );
 				pc += prints (put, s?s:"(null)", width, pad);
 				continue;
 			}
@@ -197,8 +197,11 @@ static int print(IPutChar* put, const char *format, va_list args )
 		}
 		else {
 		out:
-			put->PutChar(*format);
-			++pc;
+			/* emit the run of literal characters up to the next conversion in one go */
+			const char *run = format;
+			while (format[1] != 0 && format[1] != '%') ++format;
+			put->PutBuffer(run, format - run + 1);
+			pc += format - run + 1;
 		}
 	}
 	va_end( args );
@@ -0,0 +1,260 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/stm32/desig.h>
+#include "printjob.h"
+#include "fmt.h"
+
+void PrintJob::StartJson(const Param::Query& q, CanMap* m)
+{
+   query = q;
+   canMap = m;
+   state = 0;
+
+   if (query.flags & Param::QUERY_CATEGORIES)
+      type = JOB_CATEGORIES;
+   else if (query.flags & Param::QUERY_VALUES)
+      type = JOB_VALUES;
+   else
+      type = JOB_JSON;
+}
+
+void PrintJob::StartCanMap(CanMap* m)
+{
+   canMap = m;
+   state = 0;
+   type = JOB_CANMAP;
+}
+
+void PrintJob::RunBlocking(IPutChar* sink)
+{
+   out.SetBlocking(true);
+   while (!Resume(sink));
+   out.SetBlocking(false);
+}
+
+bool PrintJob::Resume(IPutChar* sink)
+{
+   out.SetSink(sink);
+
+   CR_BEGIN(state);
+   comma = ' ';
+
+   if (JOB_CANMAP == type)
+   {
+      for (message = 0, rx = false; message < MAX_MESSAGES || !rx; message++)
+      {
+         if (message == MAX_MESSAGES) //done with send map, continue with receive map
+         {
+            message = 0;
+            rx = true;
+         }
+
+         for (item = 0; item < MAX_ITEMS; item++)
+         {
+            CR_WAIT_UNTIL(state, CanMapEntry());
+            if (0 == value) break; //no more items in this message
+         }
+      }
+   }
+   else if (JOB_CATEGORIES == type)
+   {
+      CR_WAIT_UNTIL(state, Header());
+
+      for (idx = 0; idx < Param::GetNumCategories(); idx++)
+         CR_WAIT_UNTIL(state, Category());
+
+      CR_WAIT_UNTIL(state, Footer());
+   }
+   else if (JOB_NONE != type)
+   {
+      CR_WAIT_UNTIL(state, Header());
+
+      for (idx = 0; idx < Param::PARAM_LAST; idx++)
+      {
+         if (Param::MatchesQuery((Param::PARAM_NUM)idx, query))
+         {
+            CR_WAIT_UNTIL(state, EntryStart());
+
+            //Each element is a chunk of its own, so it is printed again from the same snapshot
+            for (element = 0; element < NumElements(); element++)
+               CR_WAIT_UNTIL(state, Element());
+
+            CR_WAIT_UNTIL(state, EntryEnd());
+         }
+      }
+
+      CR_WAIT_UNTIL(state, Footer());
+   }
+
+   type = JOB_NONE;
+   CR_END(state);
+}
+
+bool PrintJob::Header()
+{
+   out.StartChunk();
+
+   if (!out.IsResumedChunk())
+      value = Param::GetGeneration();
+
+   if (JOB_CATEGORIES == type)
+      out.PutChar('[');
+   else if (JOB_VALUES == type)
+      FORMAT(&out, "{\"generation\":%u", (uint32_t)value);
+   else
+      out.PutChar('{');
+
+   return out.EndChunk();
+}
+
+bool PrintJob::Footer()
+{
+   out.StartChunk();
+
+   if (JOB_CATEGORIES == type)
+   {
+      FORMAT(&out, "]\r\n");
+   }
+   else if (JOB_VALUES == type)
+   {
+      FORMAT(&out, "}\r\n");
+   }
+   else
+   {
+      uint32_t serial[3];
+
+      desig_get_unique_id(serial);
+      FORMAT(&out, "%c\r\n   \"serial\": {\"unit\":\"\",\"value\":\"%08X\",\"isparam\":false}\r\n}\r\n", comma, serial[0]);
+   }
+
+   return out.EndChunk();
+}
+
+bool PrintJob::Category()
+{
+   out.StartChunk();
+   FORMAT(&out, "%c\"%s\"", comma, Param::GetCategoryName(idx));
+
+   if (!out.EndChunk()) return false;
+
+   comma = ',';
+   return true;
+}
+
+/** \brief Number of value elements printed for the current entry */
+uint32_t PrintJob::NumElements()
+{
+   bool printValues = JOB_VALUES == type || (query.flags & Param::QUERY_META) == 0;
+   return printValues ? Param::GetLength((Param::PARAM_NUM)idx) : 0;
+}
+
+bool PrintJob::EntryStart()
+{
+   Param::PARAM_NUM param = (Param::PARAM_NUM)idx;
+   const Param::Attributes* pAtr = Param::GetAttrib(param);
+
+   out.StartChunk();
+
+   if (JOB_VALUES == type)
+      FORMAT(&out, ",\r\n\"%s\":", pAtr->name);
+   else
+      FORMAT(&out, "%c\r\n   \"%s\": {", comma, pAtr->name);
+
+   if (JOB_VALUES != type && NumElements() > 0)
+      FORMAT(&out, "\"value\":");
+
+   if (NumElements() > 1)
+      out.PutChar('[');
+
+   return out.EndChunk();
+}
+
+bool PrintJob::Element()
+{
+   out.StartChunk();
+
+   if (!out.IsResumedChunk())
+      value = Param::GetElement((Param::PARAM_NUM)idx, element);
+
+   if (element > 0)
+      out.PutChar(',');
+
+   FORMAT(&out, "%f", Fmt::Fixed(value));
+   return out.EndChunk();
+}
+
+bool PrintJob::EntryEnd()
+{
+   Param::PARAM_NUM param = (Param::PARAM_NUM)idx;
+   const Param::Attributes* pAtr = Param::GetAttrib(param);
+   bool printValues = NumElements() > 0;
+
+   out.StartChunk();
+
+   if (NumElements() > 1)
+      out.PutChar(']');
+
+   if (JOB_VALUES != type)
+   {
+      uint32_t canId;
+      uint8_t canStart;
+      int8_t canLength, offset;
+      bool isRx;
+      float canGain;
+
+      FORMAT(&out, "%s\"unit\":\"%s\",\"id\":%d,", printValues ? "," : "", pAtr->unit, pAtr->id);
+
+      if (0 != canMap && canMap->FindMap(param, canId, canStart, canLength, canGain, offset, isRx))
+      {
+         FORMAT(&out, "\"canid\":%u,\"canoffset\":%d,\"canlength\":%d,\"cangain\":%f,\"canadd\":%d,\"isrx\":%s,",
+                canId, canStart, canLength, Fmt::Fixed(FP_FROMFLT(canGain)), offset, isRx ? "true" : "false");
+      }
+
+      if (Param::GetType(param) == Param::TYPE_PARAM || Param::GetType(param) == Param::TYPE_TESTPARAM)
+      {
+         FORMAT(&out, "\"isparam\":true,\"minimum\":%f,\"maximum\":%f,\"default\":%f,\"category\":\"%s\",\"i\":%d",
+                Fmt::Fixed(pAtr->min), Fmt::Fixed(pAtr->max), Fmt::Fixed(pAtr->def), pAtr->category, idx);
+      }
+      else
+      {
+         FORMAT(&out, "\"isparam\":false");
+      }
+      out.PutChar('}');
+   }
+
+   if (!out.EndChunk()) return false;
+
+   comma = ',';
+   return true;
+}
+
+/** Print one CAN map item, sets value to 0 when there is none */
+bool PrintJob::CanMapEntry()
+{
+   uint32_t canId;
+   const CanMap::CANPOS* pos = 0 != canMap ? canMap->GetMap(rx, message, item, canId) : 0;
+
+   value = 0 != pos;
+   if (0 == pos) return true;
+
+   out.StartChunk();
+   FORMAT(&out, "can %s %s %u %d %d %f %d\r\n", rx ? "rx" : "tx", Param::GetAttrib((Param::PARAM_NUM)pos->mapParam)->name,
+          canId, pos->offsetBits, pos->numBits, Fmt::Fixed(FP_FROMFLT(pos->gain)), pos->offset);
+   return out.EndChunk();
+}
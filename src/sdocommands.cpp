@@ -39,8 +39,16 @@
 #define SDO_CMD_CLEAR_CAN     6
 
 bool SdoCommands::saveEnabled = true;
+bool SdoCommands::asyncSaveEnabled = false;
+volatile uint8_t SdoCommands::asyncSaveState = SdoCommands::SAVE_DONE;
 CanMap* SdoCommands::canMap;
 
+void SdoCommands::AsyncSaveDone(int ok, uint32_t crc)
+{
+   crc = crc;
+   asyncSaveState = ok ? SAVE_DONE : SAVE_FAILED;
+}
+
 void SdoCommands::ProcessStandardCommands(CanSdo::SdoFrame* sdoFrame)
 {
    if (sdoFrame->index == SDO_INDEX_SERIAL && sdoFrame->cmd == SDO_READ)
@@ -60,11 +68,23 @@ void SdoCommands::ProcessStandardCommands(CanSdo::SdoFrame* sdoFrame)
       case 3:
          sdoFrame->data = Param::GetIdSum();
          break;
+      case 4:
+         sdoFrame->data = Param::GetSchemaHash();
+         break;
+      case 5:
+         sdoFrame->data = Param::GetGeneration();
+         break;
       default:
          sdoFrame->cmd = SDO_ABORT;
          sdoFrame->data = SDO_ERR_INVIDX;
       }
    }
+   else if (sdoFrame->index == SDO_INDEX_COMMANDS && sdoFrame->cmd == SDO_READ && sdoFrame->subIndex == SDO_CMD_SAVE)
+   {
+      //Lets the host poll for the result of a background save
+      sdoFrame->cmd = SDO_READ_REPLY;
+      sdoFrame->data = asyncSaveState;
+   }
    else if (sdoFrame->index == SDO_INDEX_COMMANDS && sdoFrame->cmd == SDO_WRITE)
    {
       sdoFrame->cmd = SDO_WRITE_REPLY;
@@ -79,6 +99,23 @@ void SdoCommands::ProcessStandardCommands(CanSdo::SdoFrame* sdoFrame)
             parm_save();
             cm_enable_interrupts();
          }
+         else if (asyncSaveEnabled)
+         {
+            //Background save, only parameters, never erases
+            asyncSaveState = SAVE_RUNNING;
+            cm_disable_interrupts();
+            int res = parm_save_async(AsyncSaveDone);
+            cm_enable_interrupts();
+
+            if (-1 == res)
+               asyncSaveState = SAVE_FAILED;
+
+            if (res != 0)
+            {
+               sdoFrame->cmd = SDO_ABORT;
+               sdoFrame->data = SDO_ERR_GENERAL;
+            }
+         }
          else
          {
             sdoFrame->cmd = SDO_ABORT;
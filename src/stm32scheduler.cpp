@@ -18,15 +18,26 @@
  */
 #include "stm32scheduler.h"
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/dwt.h>
 
-/* return CCRc of TIMt */
-#define TIM_CCR(t,c) (*(uint32_t *)(&TIM_CCR1(t) + (c)))
+#define TICKS_PER_MS 100
+#define US_PER_TICK  (1000 / TICKS_PER_MS)
 
-const enum tim_oc_id Stm32Scheduler::ocMap[MAX_TASKS] = { TIM_OC1, TIM_OC2, TIM_OC3, TIM_OC4 };
+static_assert(MAX_TASKS <= 32, "Wheel slots are 32 bit task masks");
 
 Stm32Scheduler::Stm32Scheduler(uint32_t timer)
+   : functions(), periods(), dueTimes(), stats(), wheel(), timer(timer), now(0), nextCompare(TICKS_PER_MS), nextTask(0)
 {
-   this->timer = timer;
+   /* Cortex-M0 has no cycle counter, then time with the scheduler timer */
+   useCycles = dwt_enable_cycle_counter();
+   cyclesPerUs = rcc_ahb_frequency / 1000000;
+   tickStart = 0;
+   overrunPolicy = OVERRUN_CATCHUP;
+   maxCatchUp = 1;
+   overrunError = ERROR_NONE;
+   lateTicks = 0;
+   resetRequested = false;
+
    /* Setup timers upcounting and auto preload enable */
    timer_enable_preload(timer);
    timer_direction_up(timer);
@@ -35,53 +46,61 @@ Stm32Scheduler::Stm32Scheduler(uint32_t timer)
    /* Maximum counter value */
    timer_set_period(timer, 0xFFFF);
 
-   nextTask = 0;
+   /* Channel 1 generates the 1 ms tick */
+   timer_set_oc_mode(timer, TIM_OC1, TIM_OCM_ACTIVE);
+   timer_set_oc_value(timer, TIM_OC1, nextCompare);
+   timer_enable_irq(timer, TIM_DIER_CC1IE);
+   timer_set_counter(timer, 0);
+   timer_enable_counter(timer);
 }
 
-void Stm32Scheduler::AddTask(void (*function)(void), uint16_t period)
+int Stm32Scheduler::AddTask(void (*function)(void), uint32_t period, uint32_t offset)
 {
-   if (nextTask >= MAX_TASKS) return;
-   /* Disable timer */
-   timer_disable_counter(timer);
+   if (nextTask >= MAX_TASKS || period == 0) return -1;
 
-   timer_set_oc_mode(timer, ocMap[nextTask], TIM_OCM_ACTIVE);
-   timer_set_oc_value(timer, ocMap[nextTask], 0);
+   int task = nextTask;
 
-   /* Assign task function and period */
-   functions[nextTask] = function;
-   periods  [nextTask] = period * 100;
-
-   /* Enable interrupt for that channel */
-   timer_enable_irq(timer, TIM_DIER_CC1IE << nextTask);
-
-   /* Reset counter */
-   timer_set_counter(timer, 0);
-
-   /* Enable timer */
-   timer_enable_counter(timer);
+   functions[task] = function;
+   periods[task] = period < MAX_PERIOD ? period : MAX_PERIOD;
 
+   /* Keep the tick away while the wheel is modified */
+   timer_disable_irq(timer, TIM_DIER_CC1IE);
+   dueTimes[task] = now + 1 + (offset < MAX_PERIOD ? offset : MAX_PERIOD - 1);
+   Insert(task);
    nextTask++;
+   timer_enable_irq(timer, TIM_DIER_CC1IE);
+
+   return task;
 }
 
 void Stm32Scheduler::Run()
 {
-   for (int i = 0; i < MAX_TASKS; i++)
+   if (timer_get_flag(timer, TIM_SR_CC1IF))
    {
-      if (i < nextTask && timer_get_flag(timer, TIM_SR_CC1IF << i))
+      if (resetRequested)
       {
-         uint16_t start = timer_get_counter(timer);
-
-         TIM_CCR(timer, i) += periods[i];
-         functions[i]();
-         execTicks[i] = timer_get_counter(timer) - start;
-         timer_clear_flag(timer, TIM_SR_CC1IF << i);
-      }
-      else if (i >= nextTask)
-      {
-         //Also clear flags of unused channels, they seem to fire the interrupt as well...
-         timer_clear_flag(timer, TIM_SR_CC1IF << i);
+         for (int i = 0; i < MAX_TASKS; i++)
+            stats[i] = TaskStats();
+         lateTicks = 0;
+         resetRequested = false;
       }
+
+      StartTick();
+      Tick(true);
+
+      /* The only overrun check on the common path: is the next tick still ahead? */
+      if ((int16_t)(timer_get_counter(timer) - nextCompare) >= 0)
+         HandleOverrun();
    }
+   //Also clear flags of unused channels, they seem to fire the interrupt as well...
+   timer_clear_flag(timer, TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF);
+}
+
+void Stm32Scheduler::SetOverrunPolicy(OverrunPolicy policy, int maxCatchUp, ERROR_MESSAGE_NUM error)
+{
+   overrunPolicy = policy;
+   this->maxCatchUp = maxCatchUp;
+   overrunError = error;
 }
 
 int Stm32Scheduler::GetCpuLoad()
@@ -89,8 +108,183 @@ int Stm32Scheduler::GetCpuLoad()
    int totalLoad = 0;
    for (int i = 0; i < nextTask; i++)
    {
-      int load = (1000 * execTicks[i]) / periods[i];
+      //execution time in us, period in ms
+      int load = stats[i].execLast / periods[i];
       totalLoad += load;
    }
    return totalLoad;
 }
+
+uint32_t Stm32Scheduler::GetStatistic(int task, int stat)
+{
+   if (task < 0 || task >= nextTask) return 0;
+
+   /* Copy the record with the tick masked, the 64 bit sums can't be read atomically */
+   timer_disable_irq(timer, TIM_DIER_CC1IE);
+   TaskStats s = stats[task];
+   timer_enable_irq(timer, TIM_DIER_CC1IE);
+
+   switch (stat)
+   {
+   case STAT_PERIOD: return periods[task];
+   case STAT_RUNS: return s.runs;
+   case STAT_EXEC_MIN: return s.execMin;
+   case STAT_EXEC_MAX: return s.execMax;
+   case STAT_EXEC_MEAN: return s.runs > 0 ? s.execSum / s.runs : 0;
+   case STAT_EXEC_LAST: return s.execLast;
+   case STAT_JITTER_MAX: return s.jitterMax;
+   case STAT_JITTER_MEAN: return s.runs > 0 ? s.jitterSum / s.runs : 0;
+   case STAT_OVERRUNS: return s.overruns;
+   case STAT_SKIPPED: return s.skipped;
+   default:
+      if (stat >= STAT_HISTOGRAM && stat < STAT_LAST)
+         return s.histogram[stat - STAT_HISTOGRAM];
+      return 0;
+   }
+}
+
+/** Only requests the reset, Run() clears the statistics at the start of the
+ * next tick. So we may be called from any interrupt, e.g. an SDO request,
+ * without tearing a record that Run() is just writing */
+void Stm32Scheduler::ResetStatistics()
+{
+   resetRequested = true;
+}
+
+int Stm32Scheduler::HistogramBin(uint32_t jitterUs)
+{
+   if (jitterUs < 16) return 0;
+
+   int bin = 31 - __builtin_clz(jitterUs) - 3;
+   return bin < HIST_BINS ? bin : HIST_BINS - 1;
+}
+
+void Stm32Scheduler::StartTick()
+{
+   /* Clear first, so a tick that passes while tasks run is not lost */
+   timer_clear_flag(timer, TIM_SR_CC1IF);
+
+   /* Tasks are due at the compare match, which the ISR entry already lags */
+   if (useCycles)
+      tickStart = dwt_read_cycle_counter() - (uint16_t)(timer_get_counter(timer) - nextCompare) * US_PER_TICK * cyclesPerUs;
+   else
+      tickStart = nextCompare;
+
+   nextCompare += TICKS_PER_MS;
+   timer_set_oc_value(timer, TIM_OC1, nextCompare);
+}
+
+/** Process ticks whose compare match already passed until the next one is ahead
+ * again. Setting a compare value that is behind the counter would stall the
+ * scheduler until the counter wraps after 655 ms */
+void Stm32Scheduler::HandleOverrun()
+{
+   int caughtUp = 0;
+
+   while ((int16_t)(timer_get_counter(timer) - nextCompare) >= 0)
+   {
+      bool execute = overrunPolicy == OVERRUN_CATCHUP && caughtUp < maxCatchUp;
+
+      StartTick();
+      Tick(execute);
+      caughtUp += execute;
+      lateTicks++;
+   }
+
+   if (overrunError != ERROR_NONE)
+      ErrorMessage::Post(overrunError);
+}
+
+/** Advance the wheel by one tick and run or skip the tasks due */
+void Stm32Scheduler::Tick(bool execute)
+{
+   now++;
+
+   /* Move down the next slot of every level whose lower levels just wrapped,
+    * top down so tasks can pass through several levels in one tick */
+   for (int level = WHEEL_LEVELS - 1; level > 0; level--)
+   {
+      if ((now & ((1u << (level * WHEEL_BITS)) - 1)) == 0)
+      {
+         uint32_t* slot = &wheel[level][(now >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1)];
+         uint32_t tasks = *slot;
+
+         *slot = 0;
+         for (; tasks != 0; tasks &= tasks - 1)
+            Insert(__builtin_ctz(tasks));
+      }
+   }
+
+   uint32_t* slot = &wheel[0][now & (WHEEL_SLOTS - 1)];
+   uint32_t due = *slot;
+
+   *slot = 0;
+   for (; due != 0; due &= due - 1)
+   {
+      int task = __builtin_ctz(due);
+
+      if (execute)
+      {
+         uint32_t start = Timestamp();
+
+         functions[task]();
+         Record(task, ElapsedUs(tickStart, start), ElapsedUs(start, Timestamp()));
+      }
+      else
+      {
+         stats[task].skipped++;
+      }
+      dueTimes[task] += periods[task];
+      Insert(task);
+   }
+}
+
+/** Put task into the slot of its due time on the lowest level that reaches that far */
+void Stm32Scheduler::Insert(int task)
+{
+   uint32_t due = dueTimes[task];
+   uint32_t delta = due - now;
+   int level = 0;
+
+   while (level < WHEEL_LEVELS - 1 && delta >= (1u << ((level + 1) * WHEEL_BITS)))
+      level++;
+
+   wheel[level][(due >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1)] |= 1u << task;
+}
+
+uint32_t Stm32Scheduler::Timestamp()
+{
+   return useCycles ? dwt_read_cycle_counter() : timer_get_counter(timer);
+}
+
+uint32_t Stm32Scheduler::ElapsedUs(uint32_t from, uint32_t to)
+{
+   if (useCycles)
+      return (to - from) / cyclesPerUs;
+   //The timer is 16 bit and wraps every 655 ms
+   return (uint16_t)(to - from) * US_PER_TICK;
+}
+
+void Stm32Scheduler::Record(int task, uint32_t jitterUs, uint32_t execUs)
+{
+   TaskStats& s = stats[task];
+
+   s.runs++;
+   if (s.runs == 1 || execUs < s.execMin) s.execMin = execUs;
+   if (execUs > s.execMax) s.execMax = execUs;
+   s.execLast = execUs;
+   s.execSum += execUs;
+   if (jitterUs > s.jitterMax) s.jitterMax = jitterUs;
+   s.jitterSum += jitterUs;
+   if (execUs > periods[task] * 1000) s.overruns++;
+
+   uint16_t* bin = &s.histogram[HistogramBin(jitterUs)];
+
+   /* Halve all bins instead of saturating one, that keeps the distribution */
+   if (*bin == UINT16_MAX)
+   {
+      for (int i = 0; i < HIST_BINS; i++)
+         s.histogram[i] /= 2;
+   }
+   (*bin)++;
+}
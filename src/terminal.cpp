@@ -22,23 +22,34 @@
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
 #include "terminal.h"
 #include "printf.h"
 
-#define HWINFO_ENTRIES (sizeof(hwInfo) / sizeof(struct HwInfo))
+#define TX_MASK        (TERMINAL_TX_BUFSIZE - 1)
+#define RX_MASK        (TERMINAL_RX_BUFSIZE - 1)
+
+#if (TERMINAL_TX_BUFSIZE & TX_MASK) != 0
+#error TERMINAL_TX_BUFSIZE must be a power of 2
+#endif
+
+#if (TERMINAL_RX_BUFSIZE & RX_MASK) != 0
+#error TERMINAL_RX_BUFSIZE must be a power of 2
+#endif
 
 #ifndef USART_BAUDRATE
 #define USART_BAUDRATE 115200
 #endif // USART_BAUDRATE
 
-const Terminal::HwInfo Terminal::hwInfo[] =
+const Terminal::HwInfo Terminal::hwInfo[MAX_INTERFACES] =
 {
-   { USART1, DMA1, DMA_CHANNEL4, DMA_CHANNEL5, GPIOA, GPIO_USART1_TX, GPIOB, GPIO_USART1_RE_TX },
-   { USART2, DMA1, DMA_CHANNEL7, DMA_CHANNEL6, GPIOA, GPIO_USART2_TX, GPIOD, GPIO_USART2_RE_TX },
-   { USART3, DMA1, DMA_CHANNEL2, DMA_CHANNEL3, GPIOB, GPIO_USART3_TX, GPIOC, GPIO_USART3_PR_TX },
-   { UART4,  DMA2, DMA_CHANNEL5, DMA_CHANNEL3, GPIOC, GPIO_UART4_TX,  GPIOC, GPIO_UART4_TX },
+   { USART1, DMA1, DMA_CHANNEL4, DMA_CHANNEL5, NVIC_DMA1_CHANNEL4_IRQ,   GPIOA, GPIO_USART1_TX, GPIOB, GPIO_USART1_RE_TX },
+   { USART2, DMA1, DMA_CHANNEL7, DMA_CHANNEL6, NVIC_DMA1_CHANNEL7_IRQ,   GPIOA, GPIO_USART2_TX, GPIOD, GPIO_USART2_RE_TX },
+   { USART3, DMA1, DMA_CHANNEL2, DMA_CHANNEL3, NVIC_DMA1_CHANNEL2_IRQ,   GPIOB, GPIO_USART3_TX, GPIOC, GPIO_USART3_PR_TX },
+   { UART4,  DMA2, DMA_CHANNEL5, DMA_CHANNEL3, NVIC_DMA2_CHANNEL4_5_IRQ, GPIOC, GPIO_UART4_TX,  GPIOC, GPIO_UART4_TX },
 };
 
+Terminal* Terminal::interfaces[MAX_INTERFACES];
 Terminal* Terminal::defaultTerminal;
 
 Terminal::Terminal(uint32_t usart, const TERM_CMD* commands, bool remap, bool echo, bool allowFastUart)
@@ -49,22 +60,34 @@ Terminal::Terminal(uint32_t usart, const TERM_CMD* commands, bool remap, bool ec
    enabled(true),
    txDmaEnabled(true),
    pCurCmd(NULL),
-   lastIdx(0),
-   curBuf(0),
-   curIdx(0),
-   firstSend(true),
+   rawReceiver(NULL),
+   backgroundTask(NULL),
+   job(NULL),
+   rxTail(0),
+   rxLastHead(0),
+   rxOverruns(0),
+   lineLen(0),
    echo(echo),
+   txOverflow(TX_BLOCK),
+   txHead(0),
+   txTail(0),
+   txDmaLen(0),
+   txHighWater(0),
+   txDropped(0),
    allowFastUart(allowFastUart)
 {
    //Search info entry
    hw = hwInfo;
-   for (uint32_t i = 0; i < HWINFO_ENTRIES; i++)
+   for (int i = 0; i < MAX_INTERFACES; i++)
    {
       if (hw->usart == usart) break;
       hw++;
    }
 
-   defaultTerminal = this;
+   //printf() goes to the first terminal, assign defaultTerminal to change that
+   if (NULL == defaultTerminal)
+      defaultTerminal = this;
+   interfaces[GetIndex()] = this;
 
    gpio_set_mode(remap ? hw->port_re : hw->port, GPIO_MODE_OUTPUT_50_MHZ,
                GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, remap ? hw->pin_re : hw->pin);
@@ -84,104 +107,124 @@ Terminal::Terminal(uint32_t usart, const TERM_CMD* commands, bool remap, bool ec
    dma_set_peripheral_size(hw->dmactl, hw->dmatx, DMA_CCR_PSIZE_8BIT);
    dma_set_memory_size(hw->dmactl, hw->dmatx, DMA_CCR_MSIZE_8BIT);
    dma_enable_memory_increment_mode(hw->dmactl, hw->dmatx);
+   dma_enable_transfer_complete_interrupt(hw->dmactl, hw->dmatx);
+   nvic_enable_irq(hw->irqtx);
+   nvic_set_priority(hw->irqtx, 0xf << 4); //lowest priority
 
    dma_channel_reset(hw->dmactl, hw->dmarx);
    dma_set_peripheral_address(hw->dmactl, hw->dmarx, (uint32_t)&USART_DR(usart));
    dma_set_peripheral_size(hw->dmactl, hw->dmarx, DMA_CCR_PSIZE_8BIT);
    dma_set_memory_size(hw->dmactl, hw->dmarx, DMA_CCR_MSIZE_8BIT);
    dma_enable_memory_increment_mode(hw->dmactl, hw->dmarx);
+   dma_enable_circular_mode(hw->dmactl, hw->dmarx);
+   dma_set_memory_address(hw->dmactl, hw->dmarx, (uint32_t)rxBuf);
+   dma_set_number_of_data(hw->dmactl, hw->dmarx, TERMINAL_RX_BUFSIZE);
    dma_enable_channel(hw->dmactl, hw->dmarx);
 
-   ResetDMA();
-
    usart_enable(usart);
 }
 
-/** Run the terminal */
+/** Run the terminal
+ *
+ * Received bytes are collected from the circular DMA buffer and assembled
+ * into a line. Every complete line is executed, so commands sent back to back
+ * are processed in order without losing bytes that arrive meanwhile.
+ */
 void Terminal::Run()
 {
-   int unusedBytes = dma_get_number_of_data(hw->dmactl, hw->dmarx);
-   int currentIdx = bufSize - unusedBytes;
-
-   if (0 == unusedBytes)
-      ResetDMA();
-
-   while (echo && lastIdx < currentIdx) //echo
-      usart_send_blocking(usart, inBuf[lastIdx++]);
+   uint32_t rxHead = RxHead();
 
    if (usart_get_flag(usart, USART_SR_ORE))
-      usart_recv(usart); //Clear possible overrun
+   {
+      usart_recv(usart); //Clear overrun, the DMA didn't keep up with the UART
+      rxOverruns++;
+   }
 
-   if (currentIdx > 0)
+   while (rxTail != rxHead && NULL == job)
    {
-      if (inBuf[currentIdx - 1] == '\n' || inBuf[currentIdx - 1] == '\r')
+      char c = rxBuf[rxTail];
+      rxTail = (rxTail + 1) & RX_MASK;
+
+      if (NULL != rawReceiver)
+      {
+         rawReceiver->Receive(c);
+         continue;
+      }
+
+      if (echo)
+         PutChar(c);
+
+      if (c == '\n' || c == '\r')
       {
-         //Do not accept a new command while processing the current one
-         dma_disable_channel(hw->dmactl, hw->dmarx);
-         if (currentIdx > 1) //handle just \n quicker
+         if (lineLen > 0) //Ignore empty lines, e.g. \n after \r
          {
-            inBuf[currentIdx] = 0;
-            lastIdx = 0;
-            char *space = (char*)my_strchr(inBuf, ' ');
-
-            if (0 == *space) //No args after command, look for end of line
-            {
-               space = (char*)my_strchr(inBuf, '\n');
-               args[0] = 0;
-            }
-            else //There are arguments, copy everything behind the space
-            {
-               my_strcpy(args, space + 1);
-            }
-
-            if (0 == *space) //No \n found? try \r
-               space = (char*)my_strchr(inBuf, '\r');
-
-            *space = 0;
-            pCurCmd = NULL;
-
-            if (my_strcmp(inBuf, "enableuart") == 0)
-            {
-               EnableUart(args);
-               currentIdx = 0; //Prevent unknown command message
-            }
-            else if (my_strcmp(inBuf, "fastuart") == 0)
-            {
-               if (allowFastUart)
-                  FastUart(args);
-               else
-                  Send("fastuart not available\r\n");
-
-               currentIdx = 0;
-            }
-            else if (my_strcmp(inBuf, "echo") == 0)
-            {
-               Echo(args);
-               currentIdx = 0;
-            }
-            else
-            {
-               pCurCmd = CmdLookup(inBuf);
-            }
-
-            if (NULL != pCurCmd)
-            {
-               usart_wait_send_ready(usart);
-               pCurCmd->CmdFunc(this, args);
-            }
-            else if (currentIdx > 1 && enabled)
-            {
-               Send("Unknown command sequence\r\n");
-            }
+            inBuf[lineLen] = 0;
+            lineLen = 0;
+            ExecuteLine();
          }
-         ResetDMA();
+         rxHead = RxHead(); //More may have arrived while executing
       }
-      else if (inBuf[0] == '!' && NULL != pCurCmd)
+      else if (c == '!' && 0 == lineLen && NULL != pCurCmd)
       {
-         ResetDMA();
-         lastIdx = 0;
-         pCurCmd->CmdFunc(this, args);
+         pCurCmd->CmdFunc(this, args); //Repeat last command
+         rxHead = RxHead();
       }
+      else if (lineLen < (bufSize - 1))
+      {
+         inBuf[lineLen++] = c;
+      }
+   }
+
+   if (NULL != job && job->Resume(this))
+      job = NULL;
+
+   if (NULL != backgroundTask)
+      backgroundTask(this);
+
+   StartTx(); //Send output without line end right away, e.g. echo or binary frames
+}
+
+void Terminal::ExecuteLine()
+{
+   char *space = (char*)my_strchr(inBuf, ' ');
+   bool handled = true;
+
+   if (0 == *space) //No args after command
+      args[0] = 0;
+   else //There are arguments, copy everything behind the space
+      my_strcpy(args, space + 1);
+
+   *space = 0;
+   pCurCmd = NULL;
+
+   if (my_strcmp(inBuf, "enableuart") == 0)
+   {
+      EnableUart(args);
+   }
+   else if (my_strcmp(inBuf, "fastuart") == 0)
+   {
+      if (allowFastUart)
+         FastUart(args);
+      else
+         Send("fastuart not available\r\n");
+   }
+   else if (my_strcmp(inBuf, "echo") == 0)
+   {
+      Echo(args);
+   }
+   else
+   {
+      pCurCmd = CmdLookup(inBuf);
+      handled = false;
+   }
+
+   if (NULL != pCurCmd)
+   {
+      pCurCmd->CmdFunc(this, args);
+   }
+   else if (!handled && enabled)
+   {
+      Send("Unknown command sequence\r\n");
    }
 }
 
@@ -205,9 +248,10 @@ void Terminal::SetNodeId(uint8_t id)
 /*
  * Revision 1 hardware can only use synchronous sending as the DMA channel is
  * occupied by the encoder timer (TIM3, channel 3).
- * All other hardware can use DMA for seamless sending of data. We use double
- * buffering, so while one buffer is sent by DMA we can prepare the other
- * buffer to go next.
+ * All other hardware can use DMA for seamless sending of data. Characters are
+ * queued in a ring buffer that is sent in chained DMA transfers, the next
+ * transfer is started from the transfer complete interrupt. So PutChar() only
+ * waits when the ring is full and the overflow policy is TX_BLOCK.
 */
 void Terminal::PutChar(char c)
 {
@@ -215,58 +259,172 @@ void Terminal::PutChar(char c)
    {
       usart_send_blocking(usart, c);
    }
-   else if (c == '\n' || curIdx == (bufSize - 1))
+   else if (Enqueue(c) && c == '\n')
    {
-      outBuf[curBuf][curIdx] = c;
-      SendCurrentBuffer(curIdx + 1);
-      curIdx = 0;
+      StartTx();
    }
-   else
+}
+
+/** \brief Queue a character without waiting for room in the transmit ring
+ * \return false if the ring is full
+ */
+bool Terminal::TryPutChar(char c)
+{
+   if (!txDmaEnabled)
+   {
+      usart_send_blocking(usart, c);
+      return true;
+   }
+
+   if (txHead - txTail >= TERMINAL_TX_BUFSIZE)
+   {
+      StartTx();
+      return false;
+   }
+
+   Enqueue(c);
+   if (c == '\n')
+      StartTx();
+   return true;
+}
+
+/** \brief Queue a block of characters, same overflow handling as PutChar() */
+void Terminal::PutBuffer(const char* buf, int len)
+{
+   bool newline = false;
+
+   if (!txDmaEnabled)
    {
-      outBuf[curBuf][curIdx] = c;
-      curIdx++;
+      for (int i = 0; i < len; i++)
+         usart_send_blocking(usart, buf[i]);
+      return;
+   }
+
+   for (;;)
+   {
+      int copied = CopyToRing(buf, len, newline);
+
+      buf += copied;
+      len -= copied;
+
+      if (0 == len) break;
+
+      if (txOverflow == TX_DROP)
+      {
+         txDropped += len;
+         break;
+      }
+
+      StartTx();
+      while (txHead - txTail >= TERMINAL_TX_BUFSIZE)
+         WaitTxSpace();
    }
+
+   if (newline)
+      StartTx();
+}
+
+/** \brief Queue as much of a block as fits into the transmit ring
+ * \return number of characters queued
+ */
+int Terminal::TryPutBuffer(const char* buf, int len)
+{
+   bool newline = false;
+
+   if (!txDmaEnabled)
+   {
+      PutBuffer(buf, len);
+      return len;
+   }
+
+   int copied = CopyToRing(buf, len, newline);
+
+   if (copied < len || newline)
+      StartTx();
+   return copied;
 }
 
 void Terminal::SendBinary(const uint8_t* data, uint32_t len)
 {
-   uint32_t limitedLen = len < bufSize ? len : bufSize;
+   if (!txDmaEnabled)
+   {
+      for (uint32_t i = 0; i < len; i++)
+         usart_send_blocking(usart, data[i]);
+      return;
+   }
 
-   for (uint32_t i = 0; i < limitedLen; i++)
-      outBuf[curBuf][i] = data[i];
-   SendCurrentBuffer(limitedLen);
+   for (uint32_t i = 0; i < len; i++)
+      Enqueue(data[i]);
+   StartTx();
 }
 
 void Terminal::SendBinary(const uint32_t* data, uint32_t len)
 {
-   uint32_t limitedLen = len < (bufSize / sizeof(uint32_t)) ? len : bufSize / sizeof(uint32_t);
-   memcpy32((int*)outBuf[curBuf], (int*)data, limitedLen);
-   SendCurrentBuffer(limitedLen * sizeof(uint32_t));
+   SendBinary((const uint8_t*)data, len * sizeof(uint32_t));
 }
 
+/** \brief Start next DMA transfer from the transmit ring or mark transmitter idle
+ * Must be called from the DMA transfer complete interrupt of the TX channel
+ */
+void Terminal::HandleTxComplete()
+{
+   if (!dma_get_interrupt_flag(hw->dmactl, hw->dmatx, DMA_TCIF)) return;
+
+   dma_clear_interrupt_flags(hw->dmactl, hw->dmatx, DMA_TCIF);
+   txTail = txTail + txDmaLen;
+   txDmaLen = 0;
+   StartTx();
+}
 bool Terminal::KeyPressed()
 {
-   return usart_get_flag(usart, USART_SR_RXNE);
+   return RxHead() != rxTail;
 }
 
 void Terminal::FlushInput()
 {
-   usart_recv(usart);
+   rxTail = RxHead();
 }
 
 void Terminal::DisableTxDMA()
 {
+   FlushTx(); //Send what is still queued
    txDmaEnabled = false;
+   nvic_disable_irq(hw->irqtx);
+   dma_disable_transfer_complete_interrupt(hw->dmactl, hw->dmatx);
    dma_disable_channel(hw->dmactl, hw->dmatx);
    usart_disable_tx_dma(usart);
 }
 
-void Terminal::ResetDMA()
+/** \brief Get write position of the RX DMA in the receive ring
+ * Also detects when the DMA has overwritten data that wasn't read yet. The
+ * transfer complete flag tells us that the DMA wrapped since the last call,
+ * together with the distance travelled we know whether it passed rxTail.
+ * Unread data is discarded in that case and the overrun is counted.
+ */
+uint32_t Terminal::RxHead()
 {
-   dma_disable_channel(hw->dmactl, hw->dmarx);
-   dma_set_memory_address(hw->dmactl, hw->dmarx, (uint32_t)inBuf);
-   dma_set_number_of_data(hw->dmactl, hw->dmarx, bufSize);
-   dma_enable_channel(hw->dmactl, hw->dmarx);
+   bool wrapped = dma_get_interrupt_flag(hw->dmactl, hw->dmarx, DMA_TCIF);
+   uint32_t head = (TERMINAL_RX_BUFSIZE - dma_get_number_of_data(hw->dmactl, hw->dmarx)) & RX_MASK;
+   uint32_t unread = (rxLastHead - rxTail) & RX_MASK;
+   uint32_t written = (head - rxLastHead) & RX_MASK;
+
+   if (wrapped || head < rxLastHead)
+   {
+      dma_clear_interrupt_flags(hw->dmactl, hw->dmarx, DMA_TCIF);
+      //Wrapped without the position going backwards means a full lap
+      if (head >= rxLastHead) written += TERMINAL_RX_BUFSIZE;
+   }
+
+   rxLastHead = head;
+
+   if ((unread + written) >= TERMINAL_RX_BUFSIZE)
+   {
+      rxTail = head;
+      lineLen = 0; //Line is incomplete now
+      rxOverruns++;
+   }
+
+   return head;
 }
 
 void Terminal::EnableUart(char* arg)
@@ -302,6 +460,8 @@ void Terminal::FastUart(char *arg)
       Send(buf);
       Send("\r\n");
    }
+   FlushTx();
+   usart_wait_send_ready(usart);
    usart_set_baudrate(usart, baud);
    usart_set_stopbits(usart, USART_STOPBITS_1);
 }
@@ -344,18 +504,96 @@ void Terminal::Send(const char *str)
    SendBinary((const uint8_t*)str, my_strlen(str));
 }
 
-void Terminal::SendCurrentBuffer(uint32_t len)
+/** \brief Copy as many characters as there is room for into the transmit ring
+ * \param[out] newline set to true if a line end was copied
+ * \return number of characters copied
+ */
+int Terminal::CopyToRing(const char* buf, int len, bool& newline)
+{
+   uint32_t head = txHead;
+   uint32_t used = head - txTail;
+   int room = TERMINAL_TX_BUFSIZE - used;
+
+   if (len > room) len = room;
+
+   for (int i = 0; i < len; i++, head++)
+   {
+      txBuf[head & TX_MASK] = buf[i];
+      newline |= buf[i] == '\n';
+   }
+
+   txHead = head;
+
+   if (used + len > txHighWater)
+      txHighWater = used + len;
+   return len;
+}
+
+bool Terminal::Enqueue(char c)
 {
-   while (!dma_get_interrupt_flag(hw->dmactl, hw->dmatx, DMA_TCIF) && !firstSend);
+   uint32_t used = txHead - txTail;
 
+   if (used >= TERMINAL_TX_BUFSIZE)
+   {
+      if (txOverflow == TX_DROP)
+      {
+         txDropped++;
+         return false;
+      }
+
+      StartTx();
+      while (txHead - txTail >= TERMINAL_TX_BUFSIZE)
+         WaitTxSpace();
+      used = txHead - txTail;
+   }
+
+   txBuf[txHead & TX_MASK] = c;
+   txHead = txHead + 1;
+
+   if (used + 1 > txHighWater)
+      txHighWater = used + 1;
+   return true;
+}
+
+/** \brief Start a DMA transfer of the queued bytes if the transmitter is idle
+ * A transfer ends at the end of the ring, the rest follows in the next one.
+ */
+void Terminal::StartTx()
+{
+   if (txDmaLen > 0) return; //already running, interrupt will continue
+
+   uint32_t tail = txTail;
+   uint32_t len = txHead - tail;
+   uint32_t start = tail & TX_MASK;
+
+   if (0 == len) return;
+   if (start + len > TERMINAL_TX_BUFSIZE)
+      len = TERMINAL_TX_BUFSIZE - start;
+
+   txDmaLen = len;
    dma_disable_channel(hw->dmactl, hw->dmatx);
    dma_set_number_of_data(hw->dmactl, hw->dmatx, len);
-   dma_set_memory_address(hw->dmactl, hw->dmatx, (uint32_t)outBuf[curBuf]);
+   dma_set_memory_address(hw->dmactl, hw->dmatx, (uint32_t)&txBuf[start]);
    dma_clear_interrupt_flags(hw->dmactl, hw->dmatx, DMA_TCIF);
    dma_enable_channel(hw->dmactl, hw->dmatx);
+}
 
-   curBuf = !curBuf; //switch buffers
-   firstSend = false; //only needed once so we don't get stuck in the while loop above
+void Terminal::FlushTx()
+{
+   StartTx();
+   while (txHead != txTail)
+      WaitTxSpace();
+}
+
+/** \brief Wait for the running transfer and continue with the next one.
+ * Polls the flag with the interrupt disabled so it also works when called
+ * with interrupts masked or from an interrupt of higher priority.
+ */
+void Terminal::WaitTxSpace()
+{
+   nvic_disable_irq(hw->irqtx);
+   HandleTxComplete();
+   nvic_enable_irq(hw->irqtx);
 }
 
 //Backward compatibility for printf
@@ -363,3 +601,36 @@ extern "C" void putchar(int c)
 {
    Terminal::defaultTerminal->PutChar(c);
 }
+
+/** \brief Forward the TX DMA interrupt to the terminal using that channel
+ * @param index UART index, 0 for USART1 (DMA1 channel 4) ... 3 for UART4 (DMA2 channel 5)
+ */
+void Terminal::DmaIsr(int index)
+{
+   Terminal* term = GetInterface(index);
+
+   if (0 != term) term->HandleTxComplete();
+}
+
+/* Interrupt service routines of the TX DMA channels. They are weak so that
+ * projects which use these channels otherwise can define their own and call
+ * Terminal::DmaIsr() from there */
+extern "C" void __attribute__((weak)) dma1_channel4_isr()
+{
+   Terminal::DmaIsr(0);
+}
+
+extern "C" void __attribute__((weak)) dma1_channel7_isr()
+{
+   Terminal::DmaIsr(1);
+}
+
+extern "C" void __attribute__((weak)) dma1_channel2_isr()
+{
+   Terminal::DmaIsr(2);
+}
+
+extern "C" void __attribute__((weak)) dma2_channel4_5_isr()
+{
+   Terminal::DmaIsr(3);
+}
@@ -27,6 +27,7 @@
 #include "param_save.h"
 #include "canmap.h"
 #include "terminalcommands.h"
+#include "cansdo.h"
 
 //Some functions use the "register" keyword which C++ doesn't like
 //We can safely ignore that as we don't even use those functions
@@ -35,20 +36,59 @@
 #include <libopencm3/cm3/cortex.h>
 #pragma GCC diagnostic pop
 
-static Terminal* curTerm = NULL;
+/** Waits for the background save started by SaveParameters() and prints its result */
+class AsyncSaveReport: public Resumable
+{
+public:
+   void Start() { result = SAVE_RUNNING; }
+   static void Done(int ok, uint32_t c) { crc = c; result = ok ? SAVE_OK : SAVE_FAILED; }
+
+   bool Resume(IPutChar* out) override
+   {
+      if (SAVE_RUNNING == result) return false;
+
+      if (SAVE_OK == result)
+         fprintf(out, "Parameters stored, CRC=%x\r\n", crc);
+      else
+         fprintf(out, "Storing parameters failed\r\n");
+      return true;
+   }
+
+private:
+   enum { SAVE_RUNNING, SAVE_OK, SAVE_FAILED };
+   static volatile int result;
+   static volatile uint32_t crc;
+};
+
+volatile int AsyncSaveReport::result;
+volatile uint32_t AsyncSaveReport::crc;
+static AsyncSaveReport asyncSaveReport;
 
 CanMap* TerminalCommands::canMap;
+PrintJob TerminalCommands::jobs[Terminal::MAX_INTERFACES];
+PrintJob TerminalCommands::sdoJob;
 bool TerminalCommands::saveEnabled = true;
+bool TerminalCommands::asyncSaveEnabled = false;
 
+/** \brief Set a parameter with "set name value" or several with "set name=value name=value ..."
+ * See ParamSetMultiple() for the second form
+ */
 void TerminalCommands::ParamSet(Terminal* term, char* arg)
 {
    char *pParamVal;
    s32fp val;
    Param::PARAM_NUM idx;
+   int element;
 
    arg = my_trim(arg);
    pParamVal = (char *)my_strchr(arg, ' ');
 
+   if (*my_strchr(arg, '=') == '=' && my_strchr(arg, '=') < pParamVal)
+   {
+      ParamSetMultiple(term, arg);
+      return;
+   }
+
    if (*pParamVal == 0)
    {
       fprintf(term, "No parameter value given\r\n");
@@ -58,19 +98,40 @@ void TerminalCommands::ParamSet(Terminal* term, char* arg)
    *pParamVal = 0;
    pParamVal++;
 
-   val = fp_atoi(pParamVal, FRAC_DIGITS);
-   idx = Param::NumFromString(arg);
+   idx = ParamNameToIndex(arg, element);
 
    if (Param::PARAM_INVALID != idx)
    {
-       if (0 == Param::Set(idx, val))
-       {
-          fprintf(term, "Set OK\r\n");
-       }
-       else
-       {
-          fprintf(term, "Value out of range\r\n");
-       }
+      int result = 0;
+
+      if (element < 0) //no element given, expect one value per element
+      {
+         uint32_t length = Param::GetLength(idx);
+         char* comma;
+
+         //Elements that are not given keep their value
+         for (uint32_t i = 0; i < length && 0 == result && (i == 0 || *pParamVal != 0); i++)
+         {
+            comma = (char*)my_strchr(pParamVal, ',');
+            val = fp_atoi(pParamVal, FRAC_DIGITS);
+            result = Param::SetElement(idx, i, val);
+            pParamVal = comma + (*comma == ',');
+         }
+      }
+      else
+      {
+         val = fp_atoi(pParamVal, FRAC_DIGITS);
+         result = Param::SetElement(idx, element, val);
+      }
+
+      if (0 == result)
+      {
+         fprintf(term, "Set OK\r\n");
+      }
+      else
+      {
+         fprintf(term, "Value out of range\r\n");
+      }
    }
    else
    {
@@ -78,12 +139,116 @@ void TerminalCommands::ParamSet(Terminal* term, char* arg)
    }
 }
 
+/** \brief Set several parameters from name=value pairs, e.g. "ocurlim=100 curve=1,2,3 curve[4]=7"
+ *
+ * All values are checked before anything is set. Then they are set with
+ * interrupts disabled and Param::Change() is called once. The reply is
+ * "Set OK" or "Nothing set: " followed by one character per pair:
+ * '.' ok, 'u' unknown parameter, 'e' invalid element, 'r' out of range
+ */
+void TerminalCommands::ParamSetMultiple(Terminal* term, char* arg)
+{
+   Param::Update updates[PARAMSET_MAX_VALUES];
+   uint8_t pairOfUpdate[PARAMSET_MAX_VALUES];
+   uint8_t status[PARAMSET_MAX_VALUES];
+   char pairStatus[PARAMSET_MAX_VALUES + 1];
+   uint32_t count = 0, pairs = 0;
+   bool ok = true;
+
+   for (; *arg != 0 && pairs < PARAMSET_MAX_VALUES; pairs++)
+   {
+      char* next = (char*)my_strchr(arg, ' ');
+      char* value = (char*)my_strchr(arg, '=');
+      int element;
+
+      if (*next != 0) *next++ = 0;
+      pairStatus[pairs] = '.';
+
+      if (*value != '=')
+      {
+         pairStatus[pairs] = 'u';
+         ok = false;
+         arg = my_trim(next);
+         continue;
+      }
+
+      *value++ = 0;
+      Param::PARAM_NUM idx = ParamNameToIndex(arg, element);
+
+      if (Param::PARAM_INVALID == idx)
+      {
+         pairStatus[pairs] = 'u';
+         ok = false;
+      }
+
+      //Without element index the comma separated values go to elements 0, 1...
+      for (int i = element < 0 ? 0 : element; Param::PARAM_INVALID != idx; i++)
+      {
+         char* comma = (char*)my_strchr(value, ',');
+
+         if (count >= PARAMSET_MAX_VALUES)
+         {
+            fprintf(term, "Too many values, max %d\r\n", PARAMSET_MAX_VALUES);
+            return;
+         }
+
+         updates[count].param = idx;
+         updates[count].element = i;
+         updates[count].value = fp_atoi(value, FRAC_DIGITS);
+         pairOfUpdate[count++] = pairs;
+
+         if (element >= 0 || *comma != ',') break;
+         value = comma + 1;
+      }
+      arg = my_trim(next);
+   }
+
+   if (*arg != 0)
+   {
+      fprintf(term, "Too many values, max %d\r\n", PARAMSET_MAX_VALUES);
+      return;
+   }
+
+   if (ok)
+   {
+      cm_disable_interrupts();
+      ok = Param::SetMultiple(updates, count, status) == 0;
+      cm_enable_interrupts();
+   }
+   else
+   {
+      Param::CheckMultiple(updates, count, status);
+   }
+
+   if (ok)
+   {
+      bool single = true;
+
+      for (uint32_t i = 1; i < count; i++)
+         single &= updates[i].param == updates[0].param;
+
+      Param::Change(single ? updates[0].param : Param::PARAM_LAST);
+      fprintf(term, "Set OK\r\n");
+      return;
+   }
+
+   for (uint32_t i = 0; i < count; i++)
+   {
+      if (status[i] == Param::UPDATE_INVALID_ELEMENT)
+         pairStatus[pairOfUpdate[i]] = 'e';
+      else if (status[i] == Param::UPDATE_OUT_OF_RANGE)
+         pairStatus[pairOfUpdate[i]] = 'r';
+   }
+   pairStatus[pairs] = 0;
+   fprintf(term, "Nothing set: %s\r\n", pairStatus);
+}
+
 void TerminalCommands::ParamGet(Terminal* term, char* arg)
 {
    Param::PARAM_NUM idx;
-   s32fp val;
    char* comma;
    char orig;
+   int element;
 
    arg = my_trim(arg);
 
@@ -93,12 +258,15 @@ void TerminalCommands::ParamGet(Terminal* term, char* arg)
       orig = *comma;
       *comma = 0;
 
-      idx = Param::NumFromString(arg);
+      idx = ParamNameToIndex(arg, element);
 
       if (Param::PARAM_INVALID != idx)
       {
-         val = Param::Get(idx);
-         fprintf(term, "%f\r\n", val);
+         if (element < 0)
+            PrintElements(term, idx, "");
+         else
+            fprintf(term, "%f", Param::GetElement(idx, element));
+         fprintf(term, "\r\n");
       }
       else
       {
@@ -168,122 +336,208 @@ void TerminalCommands::ParamFlag(Terminal* term, char *arg)
    }
 }
 
+/** \brief Start streaming values in the background
+ *
+ * Usage: stream n val1,val2... [d]
+ * n is the number of samples, -1 streams until "stream stop".
+ * d takes a sample every d-th call of ParamStreamer::Tick(), default 1
+ */
 void TerminalCommands::ParamStream(Terminal* term, char *arg)
 {
-   Param::PARAM_NUM indexes[10];
-   int maxIndex = sizeof(indexes) / sizeof(Param::PARAM_NUM);
-   int repetitions = -1;
-   int curIndex = 0;
-   char* comma;
+   StartStream(term, arg, ParamStreamer::FORMAT_TEXT);
+}
+
+/** \brief Start streaming raw values in the background, arguments as ParamStream() */
+void TerminalCommands::ParamStreamBinary(Terminal* term, char *arg)
+{
+   StartStream(term, arg, ParamStreamer::FORMAT_BINARY);
+}
+
+/** \brief Start streaming delta encoded values in the background, arguments as ParamStream() */
+void TerminalCommands::ParamStreamDelta(Terminal* term, char *arg)
+{
+   StartStream(term, arg, ParamStreamer::FORMAT_DELTA);
+}
+
+void TerminalCommands::StartStream(Terminal* term, char *arg, ParamStreamer::Format format)
+{
+   Param::PARAM_NUM indexes[PARAMSTREAM_MAX_VALUES];
+   int numIndexes;
+   int repetitions;
+   int decimation = 1;
+   char* space;
 
    arg = my_trim(arg);
+
+   if (my_strcmp(arg, "stop") == 0)
+   {
+      ParamStreamer::Stop();
+      return;
+   }
+
    repetitions = my_atoi(arg);
    arg = (char*)my_strchr(arg, ' ');
 
    if (0 == *arg)
    {
-      fprintf(term, "Usage: stream n val1,val2...\r\n");
+      fprintf(term, "Usage: n val1,val2... [decimation]\r\n");
       return;
    }
    arg++; //move behind space
 
-   maxIndex = ParamNamesToIndexes(arg, indexes, maxIndex);
-   term->FlushInput();
+   space = (char*)my_strchr(arg, ' ');
 
-   while (!term->KeyPressed() && (repetitions > 0 || repetitions == -1))
+   if (0 != *space)
    {
-      comma = (char*)"";
-      for (curIndex = 0; curIndex < maxIndex; curIndex++)
-      {
-         s32fp val = Param::Get(indexes[curIndex]);
-         fprintf(term, "%s%f", comma, val);
-         comma = (char*)",";
-      }
-      fprintf(term, "\r\n");
-      if (repetitions != -1)
-         repetitions--;
+      *space = 0;
+      decimation = my_atoi(space + 1);
    }
+
+   numIndexes = ParamNamesToIndexes(arg, indexes, PARAMSTREAM_MAX_VALUES);
+   ParamStreamer::Start(term, indexes, numIndexes, decimation, repetitions, format);
 }
 
-void TerminalCommands::ParamStreamBinary(Terminal* term, char *arg)
+/** \brief Parse the arguments of the json command
+ *
+ * Arguments are space separated and can be combined:
+ * h - include hidden parameters
+ * v - values only
+ * m - metadata only
+ * l - list category names
+ * c=<name or index> - only parameters of one category
+ * r=<first>-<last> - only parameters in index range
+ * g=<generation> - only parameters changed after given generation
+ * \return false if a category name is unknown
+ */
+bool TerminalCommands::ParseQuery(char* arg, Param::Query& query)
 {
-   Param::PARAM_NUM indexes[20];
-   uint32_t buf[20];
-   int maxIndex = sizeof(indexes) / sizeof(Param::PARAM_NUM);
-   int repetitions = -1;
-   int curIndex = 0;
-
+   Param::InitQuery(query);
    arg = my_trim(arg);
-   repetitions = my_atoi(arg);
-   arg = (char*)my_strchr(arg, ' ');
 
-   if (0 == *arg)
+   while (*arg != 0)
    {
-      fprintf(term, "Usage: binstream n val1,val2...\r\n");
-      return;
-   }
-   arg++; //move behind space
+      char* next = (char*)my_strchr(arg, ' ');
+      char* value = arg + 2;
 
-   maxIndex = ParamNamesToIndexes(arg, indexes, maxIndex);
-   term->FlushInput();
+      if (*next != 0)
+         *next++ = 0;
 
-   while (!term->KeyPressed() && (repetitions > 0 || repetitions == -1))
-   {
-      for (curIndex = 0; curIndex < maxIndex; curIndex++)
+      switch (arg[0])
       {
-         s32fp val = Param::Get(indexes[curIndex]);
-         buf[curIndex] = (uint32_t)val;
+      case 'h': query.flags |= Param::QUERY_HIDDEN; break;
+      case 'v': query.flags |= Param::QUERY_VALUES; break;
+      case 'm': query.flags |= Param::QUERY_META; break;
+      case 'l': query.flags |= Param::QUERY_CATEGORIES; break;
+      case 'c':
+         if (arg[1] == '=')
+         {
+            query.category = Param::CategoryFromString(value);
+
+            //CATEGORY_NONE selects the spot values, so a typo must not end up there
+            if (query.category == CATEGORY_NONE)
+            {
+               if (*value < '0' || *value > '9')
+                  return false;
+               query.category = my_atoi(value);
+            }
+         }
+         break;
+      case 'g':
+         if (arg[1] == '=')
+            query.since = my_atoi(value);
+         break;
+      case 'r':
+         if (arg[1] == '=')
+         {
+            query.first = my_atoi(value);
+            value = (char*)my_strchr(value, '-');
+            if (*value == '-')
+               query.last = my_atoi(value + 1);
+         }
+         break;
       }
-
-      term->SendBinary(buf, maxIndex);
-
-      if (repetitions != -1)
-         repetitions--;
+      arg = my_trim(next);
    }
+   return true;
 }
 
 void TerminalCommands::PrintParamsJson(IPutChar* term, char *arg)
 {
-   arg = my_trim(arg);
+   Param::Query query;
 
-   const Param::Attributes *pAtr;
-   char comma = ' ';
-   bool printHidden = arg[0] == 'h';
+   if (ParseQuery(arg, query))
+      PrintParamsJson(term, query);
+   else
+      fprintf(term, "Unknown category\r\n");
+}
 
-   fprintf(term, "{");
-   for (uint32_t idx = 0; idx < Param::PARAM_LAST; idx++)
+/** \brief Start printing parameter JSON in the background, see above for arguments
+ * The terminal keeps serving its output while the JSON is printed. Each
+ * terminal has its own job so several terminals can print at the same time.
+ */
+void TerminalCommands::PrintParamsJson(Terminal* term, char *arg)
+{
+   Param::Query query;
+
+   if (!ParseQuery(arg, query))
    {
-      uint32_t canId;
-      uint8_t canStart;
-      int8_t canLength, offset;
-      bool isRx;
-      float canGain;
-      pAtr = Param::GetAttrib((Param::PARAM_NUM)idx);
+      fprintf(term, "Unknown category\r\n");
+      return;
+   }
 
-      if ((Param::GetFlag((Param::PARAM_NUM)idx) & Param::FLAG_HIDDEN) == 0 || printHidden)
-      {
-         fprintf(term, "%c\r\n   \"%s\": {\"unit\":\"%s\",\"id\":%d,\"value\":%f,",comma, pAtr->name, pAtr->unit, pAtr->id, Param::Get((Param::PARAM_NUM)idx));
+   PrintJob* job = &jobs[term->GetIndex()];
+   job->StartJson(query, canMap);
+   term->SetJob(job);
+}
 
-         if (canMap->FindMap((Param::PARAM_NUM)idx, canId, canStart, canLength, canGain, offset, isRx))
-         {
-            fprintf(term, "\"canid\":%d,\"canoffset\":%d,\"canlength\":%d,\"cangain\":%f,\"canadd\":%d,\"isrx\":%s,",
-                   canId, canStart, canLength, FP_FROMFLT(canGain), offset, isRx ? "true" : "false");
-         }
+/** \brief Print parameter JSON, waits when the output is full */
+void TerminalCommands::PrintParamsJson(IPutChar* term, const Param::Query& query)
+{
+   PrintJob job;
 
-         if (Param::GetType((Param::PARAM_NUM)idx) == Param::TYPE_PARAM || Param::GetType((Param::PARAM_NUM)idx) == Param::TYPE_TESTPARAM)
-         {
-            fprintf(term, "\"isparam\":true,\"minimum\":%f,\"maximum\":%f,\"default\":%f,\"category\":\"%s\",\"i\":%d}",
-                   pAtr->min, pAtr->max, pAtr->def, pAtr->category, idx);
-         }
-         else
-         {
-            fprintf(term, "\"isparam\":false}");
-         }
-         comma = ',';
-      }
-   }
-   fprintf(term, ",\r\n   \"serial\": {\"unit\":\"\",\"value\":\"%08X\",\"isparam\":false}", DESIG_UNIQUE_ID2);
-   fprintf(term, "\r\n}\r\n");
+   job.StartJson(query, canMap);
+   job.RunBlocking(term);
+}
+
+/** \brief Start printing parameter JSON to an SDO string upload
+ * Returns right away, the main loop must call CanSdo::RunPrintJob() to resume
+ * the job. So this never waits for the host, call it from the main loop when
+ * CanSdo::GetPrintRequest() asks for JSON.
+ */
+void TerminalCommands::PrintParamsJson(CanSdo* sdo, const Param::Query& query)
+{
+   sdo->SetPrintJob(0); //Stop the running upload from resuming the job while we restart it
+   sdoJob.StartJson(query, canMap);
+   sdo->SetPrintJob(&sdoJob);
+}
+
+/** \brief Print compact value only JSON, e.g. {"generation":12,"ocurlim":100,"curve":[1,2]}
+ * The generation can be passed to the next query to only receive changed values
+ */
+void TerminalCommands::PrintValuesJson(IPutChar* term, const Param::Query& query)
+{
+   Param::Query valueQuery = query;
+
+   valueQuery.flags |= Param::QUERY_VALUES;
+   valueQuery.flags &= ~Param::QUERY_CATEGORIES;
+   PrintParamsJson(term, valueQuery);
+}
+
+/** \brief Start printing value only JSON to an SDO string upload, see above */
+void TerminalCommands::PrintValuesJson(CanSdo* sdo, const Param::Query& query)
+{
+   Param::Query valueQuery = query;
+
+   valueQuery.flags |= Param::QUERY_VALUES;
+   valueQuery.flags &= ~Param::QUERY_CATEGORIES;
+   PrintParamsJson(sdo, valueQuery);
+}
+
+/** \brief Print schema hash and current generation */
+void TerminalCommands::PrintSchemaHash(Terminal* term, char *arg)
+{
+   arg = arg;
+   fprintf(term, "%08X %u\r\n", Param::GetSchemaHash(), Param::GetGeneration());
 }
 
 //cantx param id offset len gain
@@ -301,10 +555,9 @@ void TerminalCommands::MapCan(Terminal* term, char *arg)
 
    if (arg[0] == 'p')
    {
-      while (curTerm != NULL); //lock
-      curTerm = term;
-      canMap->IterateCanMap(PrintCanMap);
-      curTerm = NULL;
+      PrintJob* job = &jobs[term->GetIndex()];
+      job->StartCanMap(canMap);
+      term->SetJob(job);
       return;
    }
 
@@ -421,6 +674,29 @@ void TerminalCommands::SaveParameters(Terminal* term, char *arg)
       cm_enable_interrupts();
       fprintf(term, "Parameters stored, CRC=%x\r\n", crc);
    }
+   else if (asyncSaveEnabled)
+   {
+      //In run mode we can only append to the parameter log in the background.
+      //CAN map saving needs a page erase which stalls the CPU
+      asyncSaveReport.Start();
+      cm_disable_interrupts();
+      int res = parm_save_async(AsyncSaveReport::Done);
+      cm_enable_interrupts();
+
+      if (0 == res)
+      {
+         fprintf(term, "CANMAP not stored in run mode\r\n");
+         term->SetJob(&asyncSaveReport); //Reports the result when the save has finished
+      }
+      else if (-2 == res)
+      {
+         fprintf(term, "Previous save is still running, please try again\r\n");
+      }
+      else
+      {
+         fprintf(term, "Will not erase flash in run modes, please stop before saving!\r\n");
+      }
+   }
    else
    {
       fprintf(term, "Will not write to flash in run modes, please stop before saving!\r\n");
@@ -453,16 +729,43 @@ void TerminalCommands::Reset(Terminal* term, char *arg)
    scb_reset_system();
 }
 
-void TerminalCommands::PrintCanMap(Param::PARAM_NUM param, uint32_t canid, uint8_t offsetBits, int8_t length, float gain, int8_t offset, bool rx)
+/** \brief Look up a parameter name with optional element index, e.g. "curve[3]"
+ *
+ * \param name parameter name, the bracket is cut off
+ * \param[out] element element index or -1 if none given
+ * \return parameter index or PARAM_INVALID
+ */
+Param::PARAM_NUM TerminalCommands::ParamNameToIndex(char* name, int& element)
 {
-   const char* name = Param::GetAttrib(param)->name;
-   fprintf(curTerm, "can ");
+   char* bracket = (char*)my_strchr(name, '[');
 
-   if (rx)
-      fprintf(curTerm, "rx ");
-   else
-      fprintf(curTerm, "tx ");
-   fprintf(curTerm, "%s %d %d %d %f %d\r\n", name, canid, offsetBits, length, FP_FROMFLT(gain), offset);
+   element = -1;
+
+   if (*bracket == '[')
+   {
+      *bracket = 0;
+      element = my_atoi(bracket + 1);
+
+      if (element < 0)
+         return Param::PARAM_INVALID;
+   }
+
+   Param::PARAM_NUM idx = Param::NumFromString(name);
+
+   if (idx != Param::PARAM_INVALID && element >= (int)Param::GetLength(idx))
+      idx = Param::PARAM_INVALID;
+
+   return idx;
+}
+
+void TerminalCommands::PrintElements(IPutChar* term, Param::PARAM_NUM idx, const char* terminator)
+{
+   uint32_t length;
+   const s32fp* data = Param::GetArray(idx, length);
+
+   for (uint32_t i = 0; i < length; i++)
+      fprintf(term, i < (length - 1) ? "%f," : "%f", data[i]);
+   fprintf(term, "%s", terminator);
 }
 
 int TerminalCommands::ParamNamesToIndexes(char* names, Param::PARAM_NUM* indexes, uint32_t maxIndex)
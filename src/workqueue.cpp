@@ -0,0 +1,119 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include "workqueue.h"
+
+static_assert((WORKQUEUE_SIZE & (WORKQUEUE_SIZE - 1)) == 0, "WORKQUEUE_SIZE must be a power of 2");
+
+#define ROUND(pos) ((pos) & ~(uint32_t)(WORKQUEUE_SIZE - 1))
+
+WorkQueue::Queue WorkQueue::queues[PRIO_LAST];
+bool WorkQueue::pendSV = false;
+uint32_t WorkQueue::dropped = 0;
+
+bool WorkQueue::Post(Function function, void* arg, Priority prio)
+{
+   Queue& queue = queues[prio];
+   uint32_t pos = __atomic_load_n(&queue.in, __ATOMIC_RELAXED);
+   Item* item;
+
+   for (;;)
+   {
+      item = &queue.items[pos & (WORKQUEUE_SIZE - 1)];
+      int32_t diff = __atomic_load_n(&item->sequence, __ATOMIC_ACQUIRE) - ROUND(pos);
+
+      if (diff == 0)
+      {
+         //On failure pos is updated to the current value and we try again
+         if (__atomic_compare_exchange_n(&queue.in, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+      }
+      else if (diff < 0)
+      {
+         //Item still holds the previous round, i.e. queue is full
+         __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+         return false;
+      }
+      else
+      {
+         //An interrupt took this position in between
+         pos = __atomic_load_n(&queue.in, __ATOMIC_RELAXED);
+      }
+   }
+
+   item->function = function;
+   item->arg = arg;
+   __atomic_store_n(&item->sequence, ROUND(pos) + 1, __ATOMIC_RELEASE);
+
+   /* An item reserved before but not yet published by an interrupted Post()
+    * stops Run() early, that Post() pends PendSV again once it published */
+   if (pendSV)
+      SCB_ICSR = SCB_ICSR_PENDSVSET;
+
+   return true;
+}
+
+void WorkQueue::UsePendSV(uint8_t nvicPriority)
+{
+   nvic_set_priority(NVIC_PENDSV_IRQ, nvicPriority);
+   pendSV = true;
+   //Pick up anything posted before
+   SCB_ICSR = SCB_ICSR_PENDSVSET;
+}
+
+int WorkQueue::Run()
+{
+   int calls = 0;
+   int prio = PRIO_HIGH;
+
+   while (prio < PRIO_LAST)
+   {
+      if (Pop(queues[prio]))
+      {
+         calls++;
+         prio = PRIO_HIGH; //The call may have posted more urgent work
+      }
+      else
+      {
+         prio++;
+      }
+   }
+   return calls;
+}
+
+/** Call the oldest item of queue if there is one */
+bool WorkQueue::Pop(Queue& queue)
+{
+   uint32_t pos = queue.out;
+   Item& item = queue.items[pos & (WORKQUEUE_SIZE - 1)];
+
+   if (__atomic_load_n(&item.sequence, __ATOMIC_ACQUIRE) != ROUND(pos) + 1)
+      return false;
+
+   Function function = item.function;
+   void* arg = item.arg;
+
+   //Free the item before the call so the function can post again
+   __atomic_store_n(&item.sequence, ROUND(pos) + WORKQUEUE_SIZE, __ATOMIC_RELEASE);
+   queue.out = pos + 1;
+   function(arg);
+
+   return true;
+}
@@ -0,0 +1,150 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Flash storage benchmark on the host flash model.
+ * Reports flash operations, estimated STM32F1 flash busy time and wear for
+ * repeated parameter and CAN map saves and checks that a power loss at any
+ * flash operation of a save leaves loadable data behind.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "params.h"
+#include "param_save.h"
+#include "canmap.h"
+#include "flashsim.h"
+#include "stub_canhardware.h"
+
+//Typical STM32F103 datasheet timings
+#define WORD_PROGRAM_US 105 //two half words
+#define PAGE_ERASE_US   20000
+
+void Param::Change(Param::PARAM_NUM) {}
+
+static double EstimateMs(uint32_t words, uint32_t erases)
+{
+   return (words * WORD_PROGRAM_US + erases * PAGE_ERASE_US) / 1000.0;
+}
+
+static uint32_t TotalErases()
+{
+   uint32_t erases = 0;
+
+   for (int page = 0; page < FLASH_SIM_PAGES; page++)
+      erases += flash_sim_get_erase_count(page);
+   return erases;
+}
+
+static uint32_t MaxErases()
+{
+   uint32_t erases = 0;
+
+   for (int page = 0; page < FLASH_SIM_PAGES; page++)
+      if (flash_sim_get_erase_count(page) > erases)
+         erases = flash_sim_get_erase_count(page);
+   return erases;
+}
+
+static void BenchParamSaves(int numSaves)
+{
+   flash_sim_erase_all();
+   Param::LoadDefaults();
+   srand(1);
+
+   for (int i = 0; i < numSaves; i++)
+   {
+      Param::PARAM_NUM param = (Param::PARAM_NUM)(rand() % Param::PARAM_LAST);
+
+      if (Param::GetType(param) == Param::TYPE_PARAM)
+         Param::SetElement(param, 0, Param::GetAttrib(param)->min + rand() % 16);
+      parm_save();
+   }
+
+   printf("param saves:      %6d, words %7u, erases %4u, max erases/page %4u, est. %8.1f ms total, %6.2f ms/save\n",
+          numSaves, flash_sim_get_program_count(), TotalErases(), MaxErases(),
+          EstimateMs(flash_sim_get_program_count(), TotalErases()),
+          EstimateMs(flash_sim_get_program_count(), TotalErases()) / numSaves);
+}
+
+static void BenchCanMapSaves(int numSaves)
+{
+   CanStub canStub;
+   CanMap canMap(&canStub, false);
+
+   flash_sim_erase_all();
+
+   for (int i = 0; i < numSaves; i++)
+   {
+      canMap.Clear();
+      canMap.AddSend(Param::ocurlim, 0x100 + i % 256, 0, 16, 1);
+      canMap.Save();
+   }
+
+   printf("canmap saves:     %6d, words %7u, erases %4u, max erases/page %4u, est. %8.1f ms total, %6.2f ms/save\n",
+          numSaves, flash_sim_get_program_count(), TotalErases(), MaxErases(),
+          EstimateMs(flash_sim_get_program_count(), TotalErases()),
+          EstimateMs(flash_sim_get_program_count(), TotalErases()) / numSaves);
+}
+
+/** Cut power at every operation of a save and count how often data could be loaded afterwards */
+static void BenchParamPowerLoss(int numPreviousSaves)
+{
+   std::vector<uint8_t> image;
+   int numOperations, loadable = 0;
+
+   flash_sim_erase_all();
+   Param::LoadDefaults();
+   parm_save();
+
+   for (int i = 0; i < numPreviousSaves; i++)
+   {
+      Param::SetElement(Param::ocurlim, 0, i);
+      parm_save();
+   }
+
+   image.assign(flash_sim_get_memory(), flash_sim_get_memory() + flash_sim_get_size());
+   Param::SetElement(Param::ocurlim, 0, -1);
+   flash_sim_power_loss_after(-1);
+   parm_save();
+   numOperations = flash_sim_get_operations();
+
+   for (int k = 0; k <= numOperations; k++)
+   {
+      memcpy(flash_sim_get_memory(), image.data(), image.size());
+      Param::LoadDefaults();
+      parm_load();
+      Param::SetElement(Param::ocurlim, 0, -1);
+      flash_sim_power_loss_after(k);
+      parm_save();
+      flash_sim_power_loss_after(-1);
+      Param::LoadDefaults();
+      loadable += parm_load() == 0;
+   }
+
+   printf("param power loss: %6d cut points after %d saves, %d loadable\n", numOperations + 1, numPreviousSaves, loadable);
+}
+
+int main()
+{
+   BenchParamSaves(1000);
+   BenchCanMapSaves(100);
+   BenchParamPowerLoss(0);
+   BenchParamPowerLoss(200);
+   return 0;
+}
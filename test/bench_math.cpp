@@ -0,0 +1,318 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Fast math and number conversion benchmark on the host.
+ * Compares run time and worst error of the fastmath kernels and fp_itoa()/
+ * fp_atoi() with the implementations they replaced, which are kept here as
+ * reference.
+ * Host timings only show relative cost, on the Cortex-M the divisions in the
+ * legacy loops weigh even more.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include "fastmath.h"
+#include "my_math.h"
+#include "my_string.h"
+
+#define ITERATIONS 2000000
+
+static volatile uint32_t sink;
+
+/* Previous my_fp.c and FOC implementations */
+static u32fp legacy_fp_sqrt(u32fp rad)
+{
+   u32fp sqrt = rad >> (rad<1000?4:8);
+   u32fp sqrtl;
+   sqrt = sqrt>FP_FROMINT(1)?sqrt:FP_FROMINT(1);
+
+   do {
+      sqrtl = sqrt;
+      sqrt = (sqrt + FP_DIV(rad, sqrt)) >> 1;
+   } while ((sqrtl - sqrt) > 1);
+
+   return sqrt;
+}
+
+static s32fp legacy_log2_approx(s32fp x, int loopLimit)
+{
+   int m = 0;
+
+   if (loopLimit == 0) return FP_FROMINT(1);
+   if (x == FP_FROMINT(1)) return 0;
+
+   while (x < FP_FROMINT(2))
+   {
+      x = FP_MUL(x, x);
+      m++;
+   }
+   s32fp p = FRAC_FAC >> m;
+   return FP_MUL(p, FP_FROMINT(1) + legacy_log2_approx(x / 2, loopLimit - 1));
+}
+
+static s32fp legacy_fp_ln(unsigned int x)
+{
+   int n = 0;
+   const s32fp ln2 = FP_FROMFLT(0.6931471806);
+
+   if (x == 0) return -1;
+
+   uint32_t mask = 0xFFFFFFFF;
+   for (int i = 16; i > 0; i /= 2)
+   {
+      mask <<= i;
+      if ((x & mask) == 0)
+      {
+         n += i;
+         x <<= i;
+      }
+   }
+
+   s32fp ln = FP_FROMINT(31 - n);
+   x >>= 32 - FRAC_DIGITS - 1;
+   ln += legacy_log2_approx(x, 5);
+   return FP_MUL(ln2, ln);
+}
+
+static u32fp legacy_fp_hypot2(s32fp a, s32fp b)
+{
+   int n = 0;
+   while(a > 16383 || b > 16383 || a < -16383 || b < -16383) {
+      n++;
+      a /= 2;
+      b /= 2;
+   }
+   return legacy_fp_sqrt(FP_MUL(a,a) + FP_MUL(b,b)) << n;
+}
+
+static uint32_t legacy_foc_sqrt(uint32_t rad)
+{
+   uint32_t radshift = (rad < 10000 ? 5 : (rad < 10000000 ? 9 : (rad < 1000000000 ? 13 : 15)));
+   uint32_t sqrt = (rad >> radshift) + 1;
+   uint32_t sqrtl;
+
+   do {
+      sqrtl = sqrt;
+      sqrt = (sqrt + rad / sqrt) / 2;
+   } while ((sqrtl - sqrt) > 1);
+
+   return sqrt;
+}
+
+static int legacy_getexp(float f)
+{
+   union
+   {
+      float f;
+      struct {
+         unsigned int mantisa : 23;
+         unsigned int exponent : 8;
+         unsigned int sign : 1;
+      } parts;
+   } floatcast = { f };
+   return floatcast.parts.exponent - 127;
+}
+
+static float legacy_floatSqrt(float rad)
+{
+   int exp = legacy_getexp(rad);
+   uint32_t approx = 1 << (16 + (exp / 2 - 1));
+   float sqrt = approx > 0 ? 3.0f / 65536.0f * approx : 1;
+   float sqrtl;
+   float maxDiff = rad / 10000;
+
+   if (rad <= 0) return 0;
+
+   do {
+      sqrtl = sqrt;
+      sqrt = (sqrt + rad / sqrt) / 2;
+   } while (ABS(sqrtl - sqrt) > maxDiff);
+
+   return sqrt;
+}
+
+static char* legacy_fp_itoa(char * buf, s32fp a)
+{
+   int sign = a < 0?-1:1;
+   int32_t nat = (sign * a) >> FRAC_DIGITS;
+   uint32_t frac = ((UTOA_FRACDEC * ((sign * a) & ((1 << FRAC_DIGITS) - 1)))) >> FRAC_DIGITS;
+   char *p = buf;
+   if (sign < 0)
+   {
+      *p = '-';
+      p++;
+   }
+   p += my_ltoa(p, nat, 10);
+   *p = '.';
+   p++;
+   for (uint32_t dec = UTOA_FRACDEC / 10; dec > 1; dec /= 10)
+   {
+      if ((frac / dec) == 0)
+      {
+         *p = '0';
+         p++;
+      }
+   }
+   my_ltoa(p, frac, 10);
+   return buf;
+}
+
+static s32fp legacy_fp_atoi(const char *str, int fracDigits)
+{
+   int nat = 0;
+   int frac = 0;
+   int div = 10;
+   int sign = 1;
+   if ('-' == *str)
+   {
+      sign = -1;
+      str++;
+   }
+   for (; *str >= '0' && *str <= '9'; str++)
+   {
+      nat *= 10;
+      nat += *str - '0';
+   }
+   if (*str != 0)
+   {
+      for (str++; *str >= '0' && *str <= '9'; str++)
+      {
+         frac += (div / 2 + ((*str - '0') << fracDigits)) / div;
+         div *= 10;
+      }
+   }
+
+   return sign * ((nat << fracDigits) + frac);
+}
+
+/* Arguments spread over the whole range, so data dependent loops show */
+static uint32_t Arg(uint32_t i)
+{
+   return (i * 2654435761u) >> (i & 15);
+}
+
+template <typename F>
+static double NsPerCall(F f)
+{
+   auto start = std::chrono::steady_clock::now();
+   for (uint32_t i = 0; i < ITERATIONS; i++)
+      sink = f(i);
+   std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+   return elapsed.count() / ITERATIONS;
+}
+
+template <typename F, typename R>
+static double MaxError(F f, R ref, bool relative)
+{
+   double maxErr = 0;
+   for (uint32_t i = 1; i < ITERATIONS; i += 7)
+   {
+      double r = ref(i);
+      double err = fabs(f(i) - r);
+      maxErr = fmax(maxErr, relative ? err / fmax(r, 1) : err);
+   }
+   return maxErr;
+}
+
+static void Report(const char* name, double nsLegacy, double nsFast, double errLegacy, double errFast, const char* unit)
+{
+   printf("%-10s %8.1f ns %8.1f ns %6.2fx   %12.3g %12.3g %s\n",
+          name, nsLegacy, nsFast, nsLegacy / nsFast, errLegacy, errFast, unit);
+}
+
+int main()
+{
+   printf("kernel       legacy       fast    speedup   legacy err     fast err\n");
+
+   auto sqrtRef = [](uint32_t i) { return sqrt((double)Arg(i) * FRAC_FAC); };
+   Report("fp_sqrt",
+          NsPerCall([](uint32_t i) { return legacy_fp_sqrt(Arg(i)); }),
+          NsPerCall([](uint32_t i) { return fm_sqrt(Arg(i)); }),
+          MaxError([](uint32_t i) { return (double)legacy_fp_sqrt(Arg(i)); }, sqrtRef, false),
+          MaxError([](uint32_t i) { return (double)fm_sqrt(Arg(i)); }, sqrtRef, false), "LSB");
+
+   auto isqrtRef = [](uint32_t i) { return sqrt((double)Arg(i)); };
+   Report("FOC::sqrt",
+          NsPerCall([](uint32_t i) { return legacy_foc_sqrt(Arg(i)); }),
+          NsPerCall([](uint32_t i) { return fm_isqrt(Arg(i)); }),
+          MaxError([](uint32_t i) { return (double)legacy_foc_sqrt(Arg(i)); }, isqrtRef, false),
+          MaxError([](uint32_t i) { return (double)fm_isqrt(Arg(i)); }, isqrtRef, false), "LSB");
+
+   auto fArg = [](uint32_t i) { return (float)Arg(i) * 0.001f; };
+   auto floatRef = [fArg](uint32_t i) { return sqrt((double)fArg(i)); };
+   Report("floatSqrt",
+          NsPerCall([fArg](uint32_t i) { return (uint32_t)legacy_floatSqrt(fArg(i)); }),
+          NsPerCall([fArg](uint32_t i) { return (uint32_t)fm_sqrtf(fArg(i)); }),
+          MaxError([fArg](uint32_t i) { return (double)legacy_floatSqrt(fArg(i)); }, floatRef, true),
+          MaxError([fArg](uint32_t i) { return (double)fm_sqrtf(fArg(i)); }, floatRef, true), "rel");
+
+   auto hA = [](uint32_t i) { return (s32fp)Arg(i) >> 8; };
+   auto hB = [](uint32_t i) { return -((s32fp)Arg(i + 1) >> 9); };
+   auto hypotRef = [hA, hB](uint32_t i) { return sqrt((double)hA(i) * hA(i) + (double)hB(i) * hB(i)); };
+   Report("fp_hypot2",
+          NsPerCall([hA, hB](uint32_t i) { return legacy_fp_hypot2(hA(i), hB(i)); }),
+          NsPerCall([hA, hB](uint32_t i) { return fm_hypot2(hA(i), hB(i)); }),
+          MaxError([hA, hB](uint32_t i) { return (double)legacy_fp_hypot2(hA(i), hB(i)); }, hypotRef, false),
+          MaxError([hA, hB](uint32_t i) { return (double)fm_hypot2(hA(i), hB(i)); }, hypotRef, false), "LSB");
+
+   auto lnRef = [](uint32_t i) { return log((double)Arg(i) + 1) * FRAC_FAC; };
+   Report("fp_ln",
+          NsPerCall([](uint32_t i) { return (uint32_t)legacy_fp_ln(Arg(i) + 1); }),
+          NsPerCall([](uint32_t i) { return (uint32_t)fm_ln(Arg(i) + 1); }),
+          MaxError([](uint32_t i) { return (double)legacy_fp_ln(Arg(i) + 1); }, lnRef, false),
+          MaxError([](uint32_t i) { return (double)fm_ln(Arg(i) + 1); }, lnRef, false), "LSB");
+
+   //Worst error of the printed value in units of the last decimal
+   auto itoaErr = [](char* (*itoa)(char*, s32fp)) {
+      char buf[FP_ITOA_BUFSIZE(FP_DECIMALS)];
+      double maxErr = 0;
+      for (uint32_t i = 0; i < ITERATIONS; i += 7)
+         maxErr = fmax(maxErr, fabs(atof(itoa(buf, Arg(i) - INT32_MAX / 2)) * FRAC_FAC - (int32_t)(Arg(i) - INT32_MAX / 2)) / FRAC_FAC * 100);
+      return maxErr;
+   };
+   Report("fp_itoa",
+          NsPerCall([](uint32_t i) { char buf[FP_ITOA_BUFSIZE(FP_DECIMALS)]; return (uint32_t)legacy_fp_itoa(buf, Arg(i))[0]; }),
+          NsPerCall([](uint32_t i) { char buf[FP_ITOA_BUFSIZE(FP_DECIMALS)]; return (uint32_t)fp_itoa(buf, Arg(i))[0]; }),
+          itoaErr(legacy_fp_itoa), itoaErr(fp_itoa), "digit");
+
+   //Parse strings with up to five decimals, so every value is exact
+   static char numbers[1024][FP_ITOA_BUFSIZE(5)];
+   for (uint32_t i = 0; i < 1024; i++)
+      fp_itoa_dec(numbers[i], Arg(i) - INT32_MAX / 2, i % 6);
+   auto atoiErr = [](s32fp (*atoi)(const char*, int)) {
+      double maxErr = 0;
+      for (uint32_t i = 0; i < 1024; i++)
+         maxErr = fmax(maxErr, fabs(atoi(numbers[i], FRAC_DIGITS) - atof(numbers[i]) * FRAC_FAC));
+      return maxErr;
+   };
+   Report("fp_atoi",
+          NsPerCall([](uint32_t i) { return (uint32_t)legacy_fp_atoi(numbers[i & 1023], FRAC_DIGITS); }),
+          NsPerCall([](uint32_t i) { return (uint32_t)fp_atoi(numbers[i & 1023], FRAC_DIGITS); }),
+          atoiErr(legacy_fp_atoi), atoiErr(fp_atoi), "LSB");
+
+   printf("\nNew kernels without a previous implementation\n");
+   printf("fm_rsqrt   %8.1f ns\n", NsPerCall([](uint32_t i) { return fm_rsqrt(Arg(i)); }));
+   printf("fm_hypot3  %8.1f ns\n", NsPerCall([hA, hB](uint32_t i) { return fm_hypot3(hA(i), hB(i), hA(i + 2)); }));
+   printf("fm_log2    %8.1f ns\n", NsPerCall([](uint32_t i) { return (uint32_t)fm_log2(Arg(i) + 1); }));
+   printf("fm_exp     %8.1f ns\n", NsPerCall([](uint32_t i) { return (uint32_t)fm_exp((s32fp)(i & 0x3FF) - 200); }));
+
+   return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libopencm3/stm32/flash.h>
+#include "flashsim.h"
+
+static uint8_t* simFlash;
+static int operations = 0;
+static int powerLossAfter = -1;
+static uint32_t eraseCount[FLASH_SIM_PAGES];
+static uint32_t programCount = 0;
+static uint32_t programErrors = 0;
+static uint32_t crcValue = 0xFFFFFFFF;
+
+__attribute__((constructor)) static void flash_sim_init(void)
+{
+   const char* path = getenv("FLASH_SIM_FILE");
+
+   simFlash = (uint8_t*)mmap((void*)FLASH_BASE, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+   if (simFlash != (uint8_t*)FLASH_BASE)
+      abort(); //can't continue, all flash accesses would crash
+
+   memset(simFlash, 0xFF, FLASH_SIM_SIZE);
+
+   if (0 != path)
+      flash_sim_open(path);
+}
+
+int flash_sim_open(const char* path)
+{
+   struct stat st;
+   int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+   if (fd < 0 || fstat(fd, &st) != 0) return -1;
+
+   if (st.st_size != FLASH_SIM_SIZE)
+   {
+      uint8_t erased[FLASH_SIM_PAGE_SIZE];
+      memset(erased, 0xFF, sizeof(erased));
+      ftruncate(fd, 0);
+
+      for (int i = 0; i < FLASH_SIM_PAGES; i++)
+         write(fd, erased, sizeof(erased));
+   }
+
+   //Replaces the RAM mapping at the same address
+   void* mem = mmap((void*)FLASH_BASE, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+   close(fd);
+
+   return mem == (void*)FLASH_BASE ? 0 : -1;
+}
+
+static int flash_sim_operation_allowed(void)
+{
+   if (powerLossAfter >= 0 && operations >= powerLossAfter)
+      return 0;
+   operations++;
+   return 1;
+}
+
+void flash_sim_erase_all(void)
+{
+   memset(simFlash, 0xFF, FLASH_SIM_SIZE);
+   memset(eraseCount, 0, sizeof(eraseCount));
+   programCount = 0;
+   programErrors = 0;
+   operations = 0;
+   powerLossAfter = -1;
+}
+
+void flash_sim_power_loss_after(int numOperations)
+{
+   operations = 0;
+   powerLossAfter = numOperations;
+}
+
+int flash_sim_get_operations(void)
+{
+   return operations;
+}
+
+uint32_t flash_sim_get_erase_count(uint32_t page)
+{
+   return page < FLASH_SIM_PAGES ? eraseCount[page] : 0;
+}
+
+uint32_t flash_sim_get_program_count(void)
+{
+   return programCount;
+}
+
+uint32_t flash_sim_get_program_errors(void)
+{
+   return programErrors;
+}
+
+uint8_t* flash_sim_get_memory(void)
+{
+   return simFlash;
+}
+
+uint32_t flash_sim_get_size(void)
+{
+   return FLASH_SIM_SIZE;
+}
+
+void flash_unlock(void)
+{
+}
+
+void flash_lock(void)
+{
+}
+
+void flash_set_ws(uint32_t ws)
+{
+}
+
+/* The F1 programs half words. Writing anything but 0 to a half word
+ * that is not erased fails and leaves it unchanged */
+static void flash_sim_program_half_word(uint16_t* address, uint16_t data)
+{
+   if (*address != 0xFFFF && data != 0)
+      programErrors++;
+   else
+      *address &= data;
+}
+
+void flash_program_word(uint32_t address, uint32_t data)
+{
+   if (!flash_sim_operation_allowed()) return;
+
+   flash_sim_program_half_word((uint16_t*)(uintptr_t)address, data & 0xFFFF);
+   flash_sim_program_half_word((uint16_t*)(uintptr_t)address + 1, data >> 16);
+   programCount++;
+}
+
+void flash_erase_page(uint32_t page_address)
+{
+   uint32_t page = (page_address - FLASH_BASE) / FLASH_SIM_PAGE_SIZE;
+
+   if (!flash_sim_operation_allowed() || page >= FLASH_SIM_PAGES) return;
+
+   memset(simFlash + page * FLASH_SIM_PAGE_SIZE, 0xFF, FLASH_SIM_PAGE_SIZE);
+   eraseCount[page]++;
+}
+
+uint16_t desig_get_flash_size(void)
+{
+   return FLASH_SIM_SIZE / 1024;
+}
+
+void desig_get_unique_id(uint32_t *result)
+{
+   result[0] = 0x12345678;
+   result[1] = 0x9abcdef0;
+   result[2] = 0x0f1e2d3c;
+}
+
+/* STM32 CRC unit: CRC-32 polynomial 0x04C11DB7, initial value 0xFFFFFFFF,
+ * whole words fed MSB first, no reflection and no final XOR */
+uint32_t crc_calculate(uint32_t data)
+{
+   crcValue ^= data;
+
+   for (int i = 0; i < 32; i++)
+      crcValue = (crcValue & 0x80000000) ? (crcValue << 1) ^ 0x04C11DB7 : crcValue << 1;
+
+   return crcValue;
+}
+
+uint32_t crc_calculate_block(uint32_t *datap, int size)
+{
+   for (int i = 0; i < size; i++)
+      crc_calculate(datap[i]);
+
+   return crcValue;
+}
+
+void crc_reset(void)
+{
+   crcValue = 0xFFFFFFFF;
+}
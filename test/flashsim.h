@@ -0,0 +1,67 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLASHSIM_H
+#define FLASHSIM_H
+
+#include <stdint.h>
+
+/* Host model of STM32F1 flash and CRC unit
+ *
+ * The flash is mapped at FLASH_BASE so code that reads flash through
+ * pointers works unmodified. By default it is backed by RAM, when the
+ * environment variable FLASH_SIM_FILE is set or flash_sim_open() is called
+ * it is backed by a file so the content survives between runs.
+ * Programming can only clear bits. Programming a half word that is neither
+ * erased nor written to 0 counts as program error, like PGERR on the MCU.
+ * A power loss can be injected after a given number of erase/program
+ * operations, all later operations are dropped.
+ */
+
+#define FLASH_SIM_SIZE      (8 * 1024)
+#define FLASH_SIM_PAGE_SIZE 1024
+#define FLASH_SIM_PAGES     (FLASH_SIM_SIZE / FLASH_SIM_PAGE_SIZE)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Back simulated flash by a file, created erased if it doesn't exist
+ * @return 0 on success, -1 on error */
+int flash_sim_open(const char* path);
+/** Erase simulated flash completely, reset counters and restore power */
+void flash_sim_erase_all(void);
+/** Drop all erase/program operations after the given number, -1 to restore power */
+void flash_sim_power_loss_after(int numOperations);
+/** Number of erase/program operations executed since last power loss setup */
+int flash_sim_get_operations(void);
+/** Number of erases of a page since last flash_sim_erase_all() */
+uint32_t flash_sim_get_erase_count(uint32_t page);
+/** Number of programmed words since last flash_sim_erase_all() */
+uint32_t flash_sim_get_program_count(void);
+/** Number of attempts to program half words that were not erased */
+uint32_t flash_sim_get_program_errors(void);
+uint8_t* flash_sim_get_memory(void);
+uint32_t flash_sim_get_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASHSIM_H
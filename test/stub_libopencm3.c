@@ -17,43 +17,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "stdint.h"
+#include "stdbool.h"
 
-void flash_unlock(void)
-{
-}
-
-void flash_lock(void)
-{
-}
+//Flash and CRC unit are modelled in flashsim.c
 
-void flash_set_ws(uint32_t ws)
+void cm_disable_interrupts(void)
 {
 }
 
-void flash_program_word(uint32_t address, uint32_t data)
-{
-}
-
-void flash_erase_page(uint32_t page_address)
-{
-}
-
-uint16_t desig_get_flash_size(void)
-{
-    return 8;
-}
-
-uint32_t crc_calculate(uint32_t data)
-{
-    return 0xaa55;
-}
-
-uint32_t crc_calculate_block(uint32_t *datap, int size)
-{
-    return 0xaaaa5555;
-}
-
-void crc_reset(void)
+void cm_enable_interrupts(void)
 {
 }
 
@@ -147,3 +119,89 @@ void dma_enable_channel(uint32_t dma, uint8_t channel)
 void dma_disable_channel(uint32_t dma, uint8_t channel)
 {
 }
+
+//Timer model for the scheduler, tests set flags and advance the counter
+uint32_t rcc_apb1_frequency = 36000000;
+uint32_t stubTimerFlags;
+uint32_t stubTimerCounter;
+uint32_t stubTimerCompare;
+
+void timer_enable_preload(uint32_t timer_peripheral)
+{
+}
+
+void timer_direction_up(uint32_t timer_peripheral)
+{
+}
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value)
+{
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period)
+{
+}
+
+void timer_enable_counter(uint32_t timer_peripheral)
+{
+}
+
+void timer_disable_counter(uint32_t timer_peripheral)
+{
+}
+
+void timer_set_oc_mode(uint32_t timer_peripheral, int oc_id, int oc_mode)
+{
+}
+
+void timer_set_oc_value(uint32_t timer_peripheral, int oc_id, uint32_t value)
+{
+   stubTimerCompare = value;
+}
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+}
+
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq)
+{
+}
+
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count)
+{
+   stubTimerCounter = count;
+}
+
+uint32_t timer_get_counter(uint32_t timer_peripheral)
+{
+   return stubTimerCounter;
+}
+
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+   return (stubTimerFlags & flag) != 0;
+}
+
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag)
+{
+   stubTimerFlags &= ~flag;
+}
+
+//DWT model, the cycle counter only exists when a test enables it
+uint32_t rcc_ahb_frequency = 72000000;
+bool stubDwtPresent;
+uint32_t stubCycleCounter;
+
+bool dwt_enable_cycle_counter(void)
+{
+   return stubDwtPresent;
+}
+
+uint32_t dwt_read_cycle_counter(void)
+{
+   return stubCycleCounter;
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority)
+{
+}
@@ -18,5 +18,6 @@
  */
 
 // Minimal error message definitions for unit tests
-#define ERROR_MESSAGE_LIST
+#define ERROR_MESSAGE_LIST \
+   ERROR_MESSAGE_ENTRY(TASKOVERRUN, ERROR_DISPLAY)
 #define ERROR_BUF_SIZE 10
@@ -0,0 +1,34 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOST_PRINTF_H
+#define HOST_PRINTF_H
+
+// The libopeninv printf.h declares printf() and sprintf() without extern "C",
+// which conflicts with the host C library. Pull in the host stdio first and
+// rename libopeninv's declarations while including printf.h, so tests get
+// the real IPutChar and fprintf(IPutChar*, ...) next to the host printf().
+// Include this before any libopeninv header.
+#include <cstdio>
+#define printf libopeninv_printf
+#define sprintf libopeninv_sprintf
+#include "printf.h"
+#undef printf
+#undef sprintf
+
+#endif // HOST_PRINTF_H
@@ -23,6 +23,13 @@
 
 #define FLASH_PAGE_SIZE 1024
 
-#define CAN1_BLKNUM 2 // second to last block of 1k
+// Layout as documented in param_save.cpp, block 3 holds the bootloader pin definitions
+#define PARAM_BLKSIZE 1024
+#define PARAM_BLKNUM 1 // parameter log in blocks 1 and 2
+#define PARAM_LOG_PAGES 2
+
+#define CAN1_BLKNUM 4 // CAN map slot A
+#define CAN1_BLKNUM_B 5 // alternate CAN map slot
+#define CAN1_BLKNUM_LEGACY 2 // single CAN map page of earlier versions
 
 #endif
\ No newline at end of file
@@ -22,6 +22,8 @@
 #define PARAM_LIST \
     VALUE_ENTRY(amp,            "dig",   2013 ) \
     VALUE_ENTRY(pot,            "dig",   2015 ) \
-    PARAM_ENTRY("inverter",   ocurlim,     "A",       -65536, 65536,  100,    22  )
+    PARAM_ENTRY("inverter",   ocurlim,     "A",       -65536, 65536,  100,    22  ) \
+    ARRAY_ENTRY("inverter",   curve,       "A",       -100,   100,    5,   4, 30  ) \
+    PARAM_ENTRY("motor",      polepairs,   "",        1,      16,     2,      32  )
 
 extern const char* errorListString;
\ No newline at end of file
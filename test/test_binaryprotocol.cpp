@@ -0,0 +1,290 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_printf.h"
+
+#include "binaryprotocol.h"
+#include "canmap.h"
+#include "params.h"
+#include "my_fp.h"
+#include "stub_canhardware.h"
+#include "test.h"
+
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+class FrameSink: public IPutChar
+{
+public:
+   void PutChar(char c) { bytes.push_back((uint8_t)c); }
+   std::vector<uint8_t> bytes;
+};
+
+class BinaryProtocolTest: public UnitTest
+{
+   public:
+      explicit BinaryProtocolTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup();
+};
+
+static std::unique_ptr<CanStub> canStub;
+static std::unique_ptr<CanMap> canMap;
+static std::unique_ptr<FrameSink> sink;
+static std::unique_ptr<BinaryProtocol> proto;
+
+void BinaryProtocolTest::TestCaseSetup()
+{
+   canStub = std::make_unique<CanStub>();
+   canMap = std::make_unique<CanMap>(canStub.get(), false);
+   sink = std::make_unique<FrameSink>();
+   proto = std::make_unique<BinaryProtocol>(canMap.get(), sink.get());
+   Param::LoadDefaults();
+}
+
+static void SendRequest(std::vector<uint8_t> payload)
+{
+   uint8_t encoded[BINPROTO_MAX_PAYLOAD + 3];
+   uint16_t crc = BinaryProtocol::Crc16(payload.data(), payload.size());
+
+   payload.push_back(crc & 0xFF);
+   payload.push_back(crc >> 8);
+   uint32_t len = BinaryProtocol::CobsEncode(payload.data(), payload.size(), encoded);
+
+   for (uint32_t i = 0; i < len; i++)
+      proto->Receive(encoded[i]);
+   proto->Receive(0);
+}
+
+//Decode first frame in sink and remove it, returns payload without CRC or empty on error
+static std::vector<uint8_t> GetFrame()
+{
+   std::vector<uint8_t> payload;
+   auto end = std::find(sink->bytes.begin(), sink->bytes.end(), 0);
+
+   if (end == sink->bytes.end()) return payload;
+
+   std::vector<uint8_t> encoded(sink->bytes.begin(), end);
+   sink->bytes.erase(sink->bytes.begin(), end + 1);
+   payload.resize(encoded.size());
+   int len = BinaryProtocol::CobsDecode(encoded.data(), encoded.size(), payload.data());
+
+   if (len < 2 || BinaryProtocol::Crc16(payload.data(), len - 2) != (payload[len - 2] | (payload[len - 1] << 8)))
+      return std::vector<uint8_t>();
+
+   payload.resize(len - 2);
+   return payload;
+}
+
+static int32_t Get32(const std::vector<uint8_t>& d, int i)
+{
+   return d[i] | (d[i + 1] << 8) | (d[i + 2] << 16) | (d[i + 3] << 24);
+}
+
+static void crc16_check_value()
+{
+   ASSERT(BinaryProtocol::Crc16((const uint8_t*)"123456789", 9) == 0x29B1);
+}
+
+static void cobs_roundtrip()
+{
+   const uint8_t data[] = { 0x11, 0x22, 0x00, 0x33, 0x00 };
+   const uint8_t expected[] = { 0x03, 0x11, 0x22, 0x02, 0x33, 0x01 };
+   uint8_t encoded[8], decoded[8];
+
+   uint32_t len = BinaryProtocol::CobsEncode(data, sizeof(data), encoded);
+   ASSERT(len == sizeof(expected) && memcmp(encoded, expected, len) == 0);
+   ASSERT(BinaryProtocol::CobsDecode(encoded, len, decoded) == sizeof(data));
+   ASSERT(memcmp(decoded, data, sizeof(data)) == 0);
+}
+
+static void cobs_long_run()
+{
+   uint8_t data[300], encoded[310], decoded[310];
+
+   for (int i = 0; i < 300; i++) data[i] = i % 255 + 1; //no zeros
+
+   uint32_t len = BinaryProtocol::CobsEncode(data, sizeof(data), encoded);
+   ASSERT(len == 302);
+   ASSERT(BinaryProtocol::CobsDecode(encoded, len, decoded) == 300);
+   ASSERT(memcmp(decoded, data, sizeof(data)) == 0);
+}
+
+static void hello_reports_schema()
+{
+   SendRequest({ 7, BinaryProtocol::CMD_HELLO });
+   std::vector<uint8_t> reply = GetFrame();
+
+   ASSERT(reply.size() == 14);
+   ASSERT(reply[0] == 7 && reply[1] == (BinaryProtocol::CMD_HELLO | BinaryProtocol::CMD_REPLY));
+   ASSERT(reply[2] == BinaryProtocol::STATUS_OK && reply[3] == BINPROTO_VERSION);
+   ASSERT((uint32_t)Get32(reply, 4) == Param::GetSchemaHash());
+}
+
+static void get_by_index_and_uid()
+{
+   Param::SetInt(Param::ocurlim, 42);
+   SendRequest({ 1, BinaryProtocol::CMD_GET, Param::ocurlim, 0, Param::polepairs, 0 });
+   std::vector<uint8_t> reply = GetFrame();
+
+   ASSERT(reply.size() == 11 && reply[2] == BinaryProtocol::STATUS_OK);
+   ASSERT(Get32(reply, 3) == FP_FROMINT(42));
+   ASSERT(Get32(reply, 7) == FP_FROMINT(2));
+
+   SendRequest({ 2, BinaryProtocol::CMD_GET_UID, 22, 0 });
+   reply = GetFrame();
+   ASSERT(reply.size() == 7 && Get32(reply, 3) == FP_FROMINT(42));
+}
+
+static void set_by_uid_stops_at_error()
+{
+   s32fp val = FP_FROMINT(7);
+   s32fp tooBig = FP_FROMINT(17);
+
+   SendRequest({ 3, BinaryProtocol::CMD_SET_UID,
+                 22, 0, (uint8_t)val, (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24),
+                 32, 0, (uint8_t)tooBig, (uint8_t)(tooBig >> 8), (uint8_t)(tooBig >> 16), (uint8_t)(tooBig >> 24) });
+   std::vector<uint8_t> reply = GetFrame();
+
+   ASSERT(reply.size() == 4 && reply[2] == BinaryProtocol::STATUS_OUT_OF_RANGE);
+   ASSERT(reply[3] == 1);
+   ASSERT(Param::GetInt(Param::ocurlim) == 7);
+   ASSERT(Param::GetInt(Param::polepairs) == 2);
+}
+
+static void set_spot_value_rejected()
+{
+   SendRequest({ 4, BinaryProtocol::CMD_SET, Param::amp, 0, 0, 0, 0, 0 });
+   std::vector<uint8_t> reply = GetFrame();
+
+   ASSERT(reply.size() == 4 && reply[2] == BinaryProtocol::STATUS_READ_ONLY);
+}
+
+extern int paramChangeCalls;
+extern Param::PARAM_NUM lastParamChange;
+
+static void AddSetItem(std::vector<uint8_t>& req, uint16_t uid, uint8_t element, s32fp val)
+{
+   req.insert(req.end(), { (uint8_t)uid, (uint8_t)(uid >> 8), element,
+                           (uint8_t)val, (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24) });
+}
+
+static void set_multi_is_atomic()
+{
+   std::vector<uint8_t> req = { 6, BinaryProtocol::CMD_SET_MULTI };
+   std::vector<uint8_t> reply;
+
+   AddSetItem(req, 22, 0, FP_FROMINT(7));
+   AddSetItem(req, 32, 0, FP_FROMINT(17));
+   AddSetItem(req, 2013, 0, 0);
+   paramChangeCalls = 0;
+   SendRequest(req);
+   reply = GetFrame();
+
+   ASSERT(reply.size() == 6 && reply[2] == BinaryProtocol::STATUS_OUT_OF_RANGE);
+   ASSERT(reply[3] == BinaryProtocol::STATUS_OK && reply[4] == BinaryProtocol::STATUS_OUT_OF_RANGE);
+   ASSERT(reply[5] == BinaryProtocol::STATUS_READ_ONLY);
+   ASSERT(Param::GetInt(Param::ocurlim) == 100);
+   ASSERT(paramChangeCalls == 0);
+
+   req.resize(2);
+   AddSetItem(req, 22, 0, FP_FROMINT(7));
+   AddSetItem(req, 30, 2, FP_FROMINT(-3));
+   AddSetItem(req, 32, 0, FP_FROMINT(5));
+   SendRequest(req);
+   reply = GetFrame();
+
+   ASSERT(reply.size() == 6 && reply[2] == BinaryProtocol::STATUS_OK);
+   ASSERT(Param::GetInt(Param::ocurlim) == 7 && Param::GetInt(Param::polepairs) == 5);
+   ASSERT(Param::GetElement(Param::curve, 2) == FP_FROMINT(-3));
+   ASSERT(paramChangeCalls == 1 && lastParamChange == Param::PARAM_LAST);
+}
+
+static void read_range_clipped()
+{
+   SendRequest({ 5, BinaryProtocol::CMD_READ_RANGE, 0, 0, 100 });
+   std::vector<uint8_t> reply = GetFrame();
+
+   ASSERT(reply.size() == 3 + 4 * Param::PARAM_LAST);
+   ASSERT(Get32(reply, 3 + 4 * Param::polepairs) == FP_FROMINT(2));
+}
+
+static void bad_crc_dropped()
+{
+   std::vector<uint8_t> frame = { 0x05, 1, BinaryProtocol::CMD_READ_RANGE, 0x12, 0x34, 0 };
+
+   for (uint8_t b: frame) proto->Receive(b);
+
+   ASSERT(sink->bytes.empty());
+   ASSERT(proto->GetFrameErrors() == 1);
+}
+
+static void subscribe_with_divider()
+{
+   SendRequest({ 6, BinaryProtocol::CMD_SUBSCRIBE, 2, 0, Param::polepairs, 0 });
+   ASSERT(GetFrame()[2] == BinaryProtocol::STATUS_OK);
+
+   proto->Task();
+   ASSERT(sink->bytes.empty());
+   proto->Task();
+   std::vector<uint8_t> stream = GetFrame();
+   ASSERT(stream.size() == 6 && stream[1] == BinaryProtocol::CMD_STREAM);
+   ASSERT(Get32(stream, 2) == FP_FROMINT(2));
+
+   SendRequest({ 7, BinaryProtocol::CMD_SUBSCRIBE, 1, 0 });
+   GetFrame();
+   proto->Task();
+   ASSERT(sink->bytes.empty());
+}
+
+static void map_add_and_get()
+{
+   float gain = 0.5f;
+   uint8_t g[4];
+   memcpy(g, &gain, 4);
+
+   SendRequest({ 8, BinaryProtocol::CMD_MAP_ADD, 1, 0x23, 0x01, 0, 0, 22, 0, 8, 16, g[0], g[1], g[2], g[3], 0xFF });
+   ASSERT(GetFrame()[2] == BinaryProtocol::STATUS_OK);
+
+   SendRequest({ 9, BinaryProtocol::CMD_MAP_GET, 1, 0, 0 });
+   std::vector<uint8_t> reply = GetFrame();
+   ASSERT(reply.size() == 16 && reply[2] == BinaryProtocol::STATUS_OK);
+   ASSERT(Get32(reply, 3) == 0x123);
+   ASSERT(reply[7] == 22 && reply[9] == 8 && reply[10] == 16 && reply[15] == 0xFF);
+   ASSERT(memcmp(&reply[11], g, 4) == 0);
+
+   SendRequest({ 10, BinaryProtocol::CMD_MAP_GET, 1, 0, 1 });
+   ASSERT(GetFrame()[2] == BinaryProtocol::STATUS_MAP_ERROR);
+}
+
+REGISTER_TEST(
+   BinaryProtocolTest,
+   crc16_check_value,
+   cobs_roundtrip,
+   cobs_long_run,
+   hello_reports_schema,
+   get_by_index_and_uid,
+   set_by_uid_stops_at_error,
+   set_spot_value_rejected,
+   set_multi_is_atomic,
+   read_range_clipped,
+   bad_crc_dropped,
+   subscribe_with_divider,
+   map_add_and_get
+);
@@ -20,6 +20,9 @@
 #include "canmap.h"
 #include "params.h"
 #include "stub_canhardware.h"
+#include "flashsim.h"
+#include "hwdefs.h"
+#include <libopencm3/stm32/flash.h>
 #include "test.h"
 
 #include <array>
@@ -29,6 +32,8 @@
 #include <iterator>
 #include <memory>
 #include <string>
+#include <vector>
+#include <cstring>
 
 class CanMapTest : public UnitTest
 {
@@ -42,9 +47,14 @@ public:
 std::unique_ptr<CanStub> canStub;
 std::unique_ptr<CanMap>  canMap;
 
+// Records calls so tests can check change notification
+int paramChangeCalls = 0;
+Param::PARAM_NUM lastParamChange = Param::PARAM_INVALID;
+
 void Param::Change(Param::PARAM_NUM paramNum)
 {
-    // Dummy stub
+    paramChangeCalls++;
+    lastParamChange = paramNum;
 }
 
 void CanMapTest::TestCaseSetup()
@@ -660,6 +670,133 @@ static void create_and_delete_complex_map_once()
 }
 
 
+
+// ---------------------------------------------------------------------------
+// A/B flash slots
+// ---------------------------------------------------------------------------
+
+static uint32_t LoadedCanId()
+{
+    uint32_t id = 0;
+    uint8_t start;
+    int8_t length, offset;
+    float gain;
+    bool rx;
+    CanMap loaded(canStub.get(), true);
+
+    if (!loaded.FindMap(Param::ocurlim, id, start, length, gain, offset, rx))
+        return 0;
+    return id;
+}
+
+static void save_and_load_alternates_slots()
+{
+    flash_sim_erase_all();
+    canMap->AddSend(Param::ocurlim, 0x100, 0, 16, 1);
+    canMap->Save();
+    ASSERT(LoadedCanId() == 0x100);
+
+    canMap->Clear();
+    canMap->AddSend(Param::ocurlim, 0x200, 0, 16, 1);
+    canMap->Save();
+    ASSERT(LoadedCanId() == 0x200);
+
+    canMap->Clear();
+    canMap->AddSend(Param::ocurlim, 0x300, 0, 16, 1);
+    canMap->Save();
+    ASSERT(LoadedCanId() == 0x300);
+}
+
+struct IterateResult
+{
+    int count;
+    uint32_t lastId;
+    bool lastRx;
+};
+
+static void CountItems(void* context, Param::PARAM_NUM, uint32_t canId, uint8_t, int8_t, float, int8_t, bool rx)
+{
+    IterateResult* result = (IterateResult*)context;
+    result->count++;
+    result->lastId = canId;
+    result->lastRx = rx;
+}
+
+static void iterate_passes_context()
+{
+    IterateResult first = { 0, 0, false }, second = { 0, 0, false };
+
+    canMap->AddSend(Param::ocurlim, 0x100, 0, 16, 1);
+    canMap->AddSend(Param::amp, 0x100, 16, 16, 1);
+    canMap->AddRecv(Param::ocurlim, 0x200, 0, 16, 1);
+
+    canMap->IterateCanMap(CountItems, &first);
+    canMap->IterateCanMap(CountItems, &second);
+
+    ASSERT(first.count == 3 && second.count == 3);
+    ASSERT(first.lastId == 0x200 && first.lastRx);
+}
+
+static void power_loss_during_save_keeps_previous_map()
+{
+    std::vector<uint8_t> image;
+    int numOperations;
+
+    flash_sim_erase_all();
+    canMap->AddSend(Param::ocurlim, 0x100, 0, 16, 1);
+    canMap->Save();
+    canMap->Save(); //Both slots hold 0x100 so the next save has to erase
+    image.assign(flash_sim_get_memory(), flash_sim_get_memory() + flash_sim_get_size());
+
+    canMap->Clear();
+    canMap->AddSend(Param::ocurlim, 0x200, 0, 16, 1);
+    flash_sim_power_loss_after(-1);
+    canMap->Save();
+    numOperations = flash_sim_get_operations();
+
+    for (int k = 0; k <= numOperations; k++)
+    {
+        memcpy(flash_sim_get_memory(), image.data(), image.size());
+        flash_sim_power_loss_after(k);
+        canMap->Save();
+        flash_sim_power_loss_after(-1);
+
+        uint32_t id = LoadedCanId();
+        ASSERT(k < numOperations ? (id == 0x100 || id == 0x200) : id == 0x200);
+    }
+}
+
+static uint32_t* CanMapPage(int blkNum)
+{
+    return (uint32_t*)(FLASH_BASE + flash_sim_get_size() - blkNum * FLASH_PAGE_SIZE);
+}
+
+static void legacy_page_is_moved_to_slots()
+{
+    flash_sim_erase_all();
+    canMap->AddSend(Param::ocurlim, 0x100, 0, 16, 1);
+    canMap->Save();
+
+    //Turn slot A into a map written by an earlier version in the legacy page
+    memcpy(CanMapPage(CAN1_BLKNUM_LEGACY), CanMapPage(CAN1_BLKNUM), FLASH_PAGE_SIZE);
+    memset(CanMapPage(CAN1_BLKNUM), 0xFF, FLASH_PAGE_SIZE);
+    uint32_t* legacy = CanMapPage(CAN1_BLKNUM_LEGACY);
+    for (int i = FLASH_PAGE_SIZE / 4 - 1; i >= 0; i--)
+    {
+        if (legacy[i] != 0xFFFFFFFF)
+        {
+            legacy[i] = 0xFFFFFFFF; //sequence number is the last word written
+            break;
+        }
+    }
+
+    ASSERT(LoadedCanId() == 0x100);
+
+    //Parameter log takes over the legacy page, the map must survive
+    memset(CanMapPage(CAN1_BLKNUM_LEGACY), 0xFF, FLASH_PAGE_SIZE);
+    ASSERT(LoadedCanId() == 0x100);
+}
+
 #if CAN_SIGNED
 
 static void receive_map_little_endian_negative_number_16_bit_in_first_word()
@@ -1221,4 +1358,8 @@ REGISTER_TEST(
     get_map_at_max_messages_returns_null,
     remove_at_max_messages_is_safe,
     send_map_by_index_sends_only_selected_message,
+    save_and_load_alternates_slots,
+    power_loss_during_save_keeps_previous_map,
+    legacy_page_is_moved_to_slots,
+    iterate_passes_context,
     RECEIVE_TESTS);
@@ -16,15 +16,10 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-// Pull in system stdio *first* so printf/sprintf get C linkage.  The libopeninv
-// printf.h re-declares them without extern "C", which conflicts on modern hosts.
-// Declaring IPutChar ourselves and setting the include guard prevents printf.h
-// from being processed a second time, avoiding the linkage mismatch.
-#include <cstdio>
-class IPutChar { public: virtual void PutChar(char c) = 0; };
-#define PRINTF_H_INCLUDED
+#include "host_printf.h"
 
 #include "cansdo.h"
+#include "stm32scheduler.h"
 #include "canmap.h"
 #include "params.h"
 #include "my_fp.h"
@@ -33,6 +28,8 @@ class IPutChar { public: virtual void PutChar(char c) = 0; };
 
 #include <memory>
 #include <cstdint>
+#include <cstring>
+#include <string>
 
 class CanSdoTest : public UnitTest
 {
@@ -377,6 +374,42 @@ static void sdo_write_error_time_aborts()
     ASSERT(GetReply()->data == SDO_ERR_INVIDX);
 }
 
+// ---------------------------------------------------------------------------
+// Scheduler task statistics SDO (index 0x51tt)
+// ---------------------------------------------------------------------------
+
+static void StatsTask() {}
+
+static void sdo_read_task_stats()
+{
+    Stm32Scheduler sch(TIM2);
+    sch.AddTask(StatsTask, 10);
+    sch.AddTask(StatsTask, 100);
+    canSdo->SetScheduler(&sch);
+
+    SendSdoRequest(SDO_READ, 0x5101, Stm32Scheduler::STAT_PERIOD, 0);
+    ASSERT(GetReply()->cmd == SDO_READ_REPLY);
+    ASSERT(GetReply()->data == 100);
+
+    SendSdoRequest(SDO_READ, 0x5102, Stm32Scheduler::STAT_PERIOD, 0);
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_INVIDX);
+
+    SendSdoRequest(SDO_READ, 0x5100, Stm32Scheduler::STAT_LAST, 0);
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+
+    SendSdoRequest(SDO_WRITE, 0x5100, 0, 0);
+    ASSERT(GetReply()->cmd == SDO_WRITE_REPLY);
+    canSdo->SetScheduler(nullptr);
+}
+
+static void sdo_task_stats_without_scheduler_go_to_user_space()
+{
+    SendSdoRequest(SDO_READ, 0x5100, 0, 0);
+
+    ASSERT(canSdo->GetPendingUserspaceSdo() != nullptr);
+}
+
 // ---------------------------------------------------------------------------
 // Unknown SDO index goes to user space
 // ---------------------------------------------------------------------------
@@ -411,6 +444,65 @@ static void sdo_reply_sent_via_send_sdo_reply()
     ASSERT(GetReply()->cmd == SDO_WRITE_REPLY);
 }
 
+// ---------------------------------------------------------------------------
+// Deferred processing via WorkQueue
+// ---------------------------------------------------------------------------
+
+static void sdo_deferred_reply_sent_from_work_queue()
+{
+    canSdo->SetDeferred(true);
+    canStub->m_canId = 0;
+    Param::SetFloat(Param::ocurlim, 42.0f);
+    SendSdoRequest(SDO_READ, 0x2000, Param::ocurlim, 0);
+
+    ASSERT(canStub->m_canId == 0);
+    ASSERT(WorkQueue::Run() == 1);
+    ASSERT(canStub->m_canId == SdoRepId);
+    ASSERT(GetReply()->cmd == SDO_READ_REPLY);
+    ASSERT(GetReply()->data == (uint32_t)Param::Get(Param::ocurlim));
+}
+
+static void sdo_deferred_second_request_aborts()
+{
+    canSdo->SetDeferred(true);
+    SendSdoRequest(SDO_WRITE, 0x2000, Param::ocurlim, FP_FROMINT(10));
+    SendSdoRequest(SDO_WRITE, 0x2000, Param::ocurlim, FP_FROMINT(20));
+
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_GENERAL);
+    WorkQueue::Run();
+    ASSERT(Param::GetInt(Param::ocurlim) == 10);
+    ASSERT(GetReply()->cmd == SDO_WRITE_REPLY);
+}
+
+static void sdo_deferred_put_buffer_does_not_wait_for_main_loop()
+{
+    char text[80];
+
+    memset(text, 'a', sizeof(text));
+    canSdo->SetDeferred(true);
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    WorkQueue::Run();
+
+    // Would spin forever, the requests that drain the buffer are processed by WorkQueue::Run()
+    canSdo->PutBuffer(text, sizeof(text));
+    ASSERT(canSdo->TryPutBuffer(text, 1) == 1); //discarded
+
+    // The host learns that the upload is incomplete
+    SendSdoRequest(SDO_REQUEST_SEGMENT, 0, 0, 0);
+    WorkQueue::Run();
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_GENERAL);
+
+    // Next upload starts over
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    WorkQueue::Run();
+    canSdo->PutBuffer("x", 1);
+    SendSdoRequest(SDO_REQUEST_SEGMENT, 0, 0, 0);
+    WorkQueue::Run();
+    ASSERT(GetReply()->cmd == (SDO_SIZE_SPECIFIED | (6 << 1)));
+}
+
 // ---------------------------------------------------------------------------
 // Node ID change
 // ---------------------------------------------------------------------------
@@ -528,6 +620,254 @@ static void sdo_write_param_flags_invalid_index()
 // Test registration
 // ---------------------------------------------------------------------------
 
+// ---------------------------------------------------------------------------
+// Array parameter transfer via SDO index 0x2300
+// ---------------------------------------------------------------------------
+
+// Send a request with all 8 raw bytes given, for segment transfers
+static void SendSdoSegment(const uint8_t bytes[8])
+{
+    uint32_t frame[2];
+    memcpy(frame, bytes, 8);
+    canStub->HandleRx(SdoReqId, frame, 8);
+}
+
+static void sdo_upload_array()
+{
+    uint8_t seg[8] = { SDO_REQUEST_SEGMENT };
+    uint8_t received[16];
+    int numReceived = 0;
+
+    for (int i = 0; i < 4; i++)
+        Param::SetElement(Param::curve, i, FP_FROMINT(i + 1));
+
+    SendSdoRequest(SDO_READ, 0x2300, Param::curve, 0);
+    ASSERT(GetReply()->cmd == (SDO_RESPONSE_UPLOAD | SDO_SIZE_SPECIFIED));
+    ASSERT(GetReply()->data == 16);
+
+    for (int segment = 0; segment < 3; segment++)
+    {
+        seg[0] = SDO_REQUEST_SEGMENT | (segment & 1 ? SDO_TOGGLE_BIT : 0);
+        SendSdoSegment(seg);
+        uint8_t* reply = (uint8_t*)canStub->m_data.data();
+        int unused = (reply[0] >> 1) & 7;
+
+        ASSERT((reply[0] & SDO_TOGGLE_BIT) == (seg[0] & SDO_TOGGLE_BIT));
+        for (int i = 1; i <= 7 - unused; i++)
+            received[numReceived++] = reply[i];
+
+        ASSERT(((reply[0] & SDO_SEGMENT_LAST) != 0) == (segment == 2));
+    }
+
+    ASSERT(numReceived == 16);
+    for (int i = 0; i < 4; i++)
+    {
+        s32fp val;
+        memcpy(&val, &received[i * 4], 4);
+        ASSERT(val == FP_FROMINT(i + 1));
+    }
+}
+
+static void sdo_download_array()
+{
+    s32fp values[4] = { FP_FROMINT(-3), FP_FROMINT(10), FP_FROMINT(20), FP_FROMINT(99) };
+    uint8_t* src = (uint8_t*)values;
+    uint8_t seg[8];
+
+    SendSdoRequest(SDO_REQUEST_DOWNLOAD | SDO_SIZE_SPECIFIED, 0x2300, Param::curve, 16);
+    ASSERT(GetReply()->cmd == SDO_WRITE_REPLY);
+
+    for (int segment = 0, pos = 0; segment < 3; segment++)
+    {
+        int n = segment < 2 ? 7 : 2;
+        seg[0] = (segment & 1 ? SDO_TOGGLE_BIT : 0) | ((7 - n) << 1) | (segment == 2 ? SDO_SEGMENT_LAST : 0);
+        memset(&seg[1], 0, 7);
+        memcpy(&seg[1], &src[pos], n);
+        pos += n;
+        SendSdoSegment(seg);
+        ASSERT(GetReply()->cmd == (SDO_RESPONSE_DOWNLOAD | (seg[0] & SDO_TOGGLE_BIT)));
+    }
+
+    for (int i = 0; i < 4; i++)
+        ASSERT(Param::GetElement(Param::curve, i) == values[i]);
+    ASSERT(Param::Get(Param::curve) == values[0]);
+}
+
+static void sdo_download_array_wrong_size()
+{
+    SendSdoRequest(SDO_REQUEST_DOWNLOAD | SDO_SIZE_SPECIFIED, 0x2300, Param::curve, 12);
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_LENGTH);
+}
+
+static void sdo_download_array_out_of_range()
+{
+    s32fp values[2] = { FP_FROMINT(1), FP_FROMINT(200) };
+    uint8_t seg[8] = { 0 };
+
+    SendSdoRequest(SDO_REQUEST_DOWNLOAD | SDO_SIZE_SPECIFIED, 0x2300, Param::curve, 16);
+    memcpy(&seg[1], values, 7);
+    SendSdoSegment(seg);
+    seg[0] = SDO_TOGGLE_BIT;
+    memcpy(&seg[1], ((uint8_t*)values) + 7, 1);
+    SendSdoSegment(seg);
+
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_RANGE);
+    ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMINT(1));
+    ASSERT(Param::GetElement(Param::curve, 1) == FP_FROMINT(5));
+}
+
+static void sdo_array_segment_in_wrong_direction_aborts()
+{
+    uint8_t seg[8] = { 0 };
+    s32fp before = Param::GetElement(Param::curve, 0);
+
+    // Upload started, but the client sends a download segment
+    SendSdoRequest(SDO_READ, 0x2300, Param::curve, 0);
+    seg[1] = 0x55;
+    SendSdoSegment(seg);
+
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_CMD);
+    ASSERT(Param::GetElement(Param::curve, 0) == before);
+
+    // Download started, but the client requests an upload segment
+    SendSdoRequest(SDO_REQUEST_DOWNLOAD | SDO_SIZE_SPECIFIED, 0x2300, Param::curve, 16);
+    seg[0] = SDO_REQUEST_SEGMENT;
+    SendSdoSegment(seg);
+
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_CMD);
+}
+
+static void sdo_array_index_high_byte_selects_parameter()
+{
+    // 0x2301 addresses parameters 256 to 511, we don't have that many
+    SendSdoRequest(SDO_READ, 0x2301, Param::curve, 0);
+    ASSERT(GetReply()->cmd == SDO_ABORT);
+    ASSERT(GetReply()->data == SDO_ERR_INVIDX);
+}
+
+static void sdo_read_strings_after_array_upload()
+{
+    SendSdoRequest(SDO_READ, 0x2300, Param::curve, 0);
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    canSdo->PutChar('x');
+    SendSdoRequest(SDO_REQUEST_SEGMENT, 0, 0, 0);
+
+    ASSERT(((uint8_t*)canStub->m_data.data())[1] == 'x');
+}
+
+static void sdo_try_put_buffer_stops_when_full()
+{
+    const char text[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+
+    // The print buffer holds 64 characters, the rest must be offered again
+    ASSERT(canSdo->TryPutBuffer(text, sizeof(text) - 1) == 64);
+    ASSERT(canSdo->TryPutBuffer(text, 1) == 0);
+    ASSERT(canSdo->GetPrintRequest() == -1);
+
+    SendSdoRequest(SDO_REQUEST_SEGMENT, 0, 0, 0);
+    ASSERT(memcmp(&((uint8_t*)canStub->m_data.data())[1], "0123456", 7) == 0);
+    ASSERT(canSdo->TryPutBuffer(text + 64, 8) == 7);
+}
+
+// Produces 100 characters in as many steps as the print buffer requires
+class TextJob: public Resumable
+{
+public:
+    TextJob() : pos(0) { for (int i = 0; i < 100; i++) text[i] = 'a' + i % 26; }
+    bool Resume(IPutChar* out) override
+    {
+        pos += out->TryPutBuffer(text + pos, 100 - pos);
+        return pos == 100;
+    }
+    char text[100];
+    int pos;
+};
+
+static void sdo_print_job_is_resumed_per_segment()
+{
+    TextJob job;
+    std::string received;
+    uint8_t toggle = 0;
+
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    canSdo->SetPrintJob(&job);
+    ASSERT(canSdo->GetPrintRequest() == -1);
+
+    for (int i = 0; i < 20; i++)
+    {
+        bool jobRunning = job.pos < 100;
+
+        canStub->m_data.fill(0xAA);
+        SendSdoRequest(SDO_REQUEST_SEGMENT | toggle, 0, 0, 0);
+        // The job is not resumed from the receive interrupt, the main loop answers
+        ASSERT(!jobRunning || canStub->m_data[0] == 0xAA);
+        canSdo->RunPrintJob();
+        uint8_t* bytes = (uint8_t*)canStub->m_data.data();
+        int len = 7;
+
+        if (bytes[0] & SDO_SIZE_SPECIFIED)
+            len = 7 - ((bytes[0] >> 1) & 7);
+
+        received.append((char*)&bytes[1], len);
+        toggle ^= SDO_TOGGLE_BIT;
+
+        if (bytes[0] & SDO_SIZE_SPECIFIED) break;
+    }
+
+    ASSERT(received == std::string(job.text, 100));
+}
+
+static void sdo_put_char_discards_after_timeout()
+{
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    canSdo->TriggerTimeout(1000);
+    canSdo->PutChar('x');
+    canSdo->PutBuffer("yz", 2);
+
+    // Nothing was queued, so the first segment is the last and empty
+    SendSdoRequest(SDO_REQUEST_SEGMENT, 0, 0, 0);
+    ASSERT(((uint8_t*)canStub->m_data.data())[0] == (SDO_SIZE_SPECIFIED | (7 << 1)));
+}
+
+static void sdo_string_query_applies_to_next_transfer()
+{
+    SendSdoRequest(SDO_WRITE, 0x5005, 0, Param::QUERY_VALUES);
+    ASSERT(GetReply()->cmd == SDO_WRITE_REPLY);
+    SendSdoRequest(SDO_WRITE, 0x5005, 1, 1);
+    SendSdoRequest(SDO_WRITE, 0x5005, 2, 2 | (5 << 16));
+    SendSdoRequest(SDO_WRITE, 0x5005, 4, 77);
+
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    const Param::Query& query = canSdo->GetPrintQuery();
+    ASSERT(query.flags == Param::QUERY_VALUES);
+    ASSERT(query.category == 1);
+    ASSERT(query.first == 2 && query.last == 5);
+    ASSERT(query.since == 77);
+
+    SendSdoRequest(SDO_READ, 0x5001, 0, 0);
+    ASSERT(canSdo->GetPrintQuery().flags == Param::QUERY_ALL);
+    ASSERT(canSdo->GetPrintQuery().category == CATEGORY_ALL);
+}
+
+static void sdo_string_query_num_categories()
+{
+    SendSdoRequest(SDO_READ, 0x5005, 3, 0);
+    ASSERT(GetReply()->cmd == SDO_READ_REPLY);
+    ASSERT(GetReply()->data == Param::GetNumCategories());
+}
+
+static void sdo_commands_index_goes_to_user_space()
+{
+    SendSdoRequest(SDO_WRITE, 0x5002, 0, 0);
+    ASSERT(canSdo->GetPendingUserspaceSdo() != 0);
+}
+
 REGISTER_TEST(
     CanSdoTest,
     sdo_read_param,
@@ -551,8 +891,13 @@ REGISTER_TEST(
     sdo_read_error_time,
     sdo_write_error_num_aborts,
     sdo_write_error_time_aborts,
+    sdo_read_task_stats,
+    sdo_task_stats_without_scheduler_go_to_user_space,
     sdo_unknown_index_goes_to_user_space,
     sdo_reply_sent_via_send_sdo_reply,
+    sdo_deferred_reply_sent_from_work_queue,
+    sdo_deferred_second_request_aborts,
+    sdo_deferred_put_buffer_does_not_wait_for_main_loop,
     sdo_request_ignored_for_wrong_node_id,
     sdo_request_processed_after_set_node_id,
     sdo_read_strings_initiates_print_request,
@@ -560,5 +905,18 @@ REGISTER_TEST(
     sdo_write_and_read_param_flags,
     sdo_write_param_flags_clear,
     sdo_read_param_flags_invalid_index,
-    sdo_write_param_flags_invalid_index
+    sdo_write_param_flags_invalid_index,
+    sdo_upload_array,
+    sdo_download_array,
+    sdo_download_array_wrong_size,
+    sdo_download_array_out_of_range,
+    sdo_array_segment_in_wrong_direction_aborts,
+    sdo_array_index_high_byte_selects_parameter,
+    sdo_read_strings_after_array_upload,
+    sdo_try_put_buffer_stops_when_full,
+    sdo_print_job_is_resumed_per_segment,
+    sdo_put_char_discards_after_timeout,
+    sdo_string_query_applies_to_next_transfer,
+    sdo_string_query_num_categories,
+    sdo_commands_index_goes_to_user_space
 );
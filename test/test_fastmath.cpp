@@ -0,0 +1,163 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Accuracy sweeps of the fast math kernels against double precision */
+#include <math.h>
+#include <stdint.h>
+#include "fastmath.h"
+#include "test.h"
+
+class FastMathTest: public UnitTest
+{
+   public:
+      FastMathTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+};
+
+static bool IsFloorSqrt(uint64_t x, uint64_t r)
+{
+   return r * r <= x && (r + 1) * (r + 1) > x;
+}
+
+static void TestIsqrt()
+{
+   bool exact = true;
+
+   for (uint32_t r = 0; r < 65536; r++)
+   {
+      uint32_t sq = r * r;
+      exact = exact && fm_isqrt(sq) == r && (r == 0 || fm_isqrt(sq - 1) == r - 1);
+   }
+   for (uint64_t x = 0; x <= UINT32_MAX; x += 65521)
+      exact = exact && IsFloorSqrt(x, fm_isqrt(x));
+
+   ASSERT(exact);
+   ASSERT(fm_isqrt(UINT32_MAX) == 65535);
+}
+
+static void TestSqrt()
+{
+   bool exact = true;
+
+   for (uint64_t x = 0; x <= UINT32_MAX; x += 7919)
+      exact = exact && IsFloorSqrt(x << FRAC_DIGITS, fm_sqrt(x));
+
+   ASSERT(exact);
+   ASSERT(fm_sqrt(FP_FROMINT(4)) == FP_FROMINT(2));
+   ASSERT(fm_sqrt(FP_FROMFLT(2.25)) == FP_FROMFLT(1.5));
+   ASSERT(fm_sqrt(UINT32_MAX) == 370727); //sqrt(134217728) = 11585.2
+   ASSERT(fp_sqrt(FP_FROMINT(9)) == FP_FROMINT(3));
+}
+
+static void TestRsqrt()
+{
+   double maxErr = 0;
+
+   for (uint64_t x = 1; x <= UINT32_MAX; x += 7919)
+   {
+      double ref = FRAC_FAC / sqrt((double)x / FRAC_FAC);
+      maxErr = fmax(maxErr, fabs(fm_rsqrt(x) - ref));
+   }
+
+   ASSERT(maxErr <= 0.5001);
+   ASSERT(fm_rsqrt(FP_FROMINT(4)) == FP_FROMFLT(0.5));
+   ASSERT(fm_rsqrt(0) == UINT32_MAX);
+}
+
+static void TestHypot()
+{
+   bool exact = true;
+   double maxRelErr = 0;
+
+   for (int32_t a = -20000; a <= 20000; a += 37)
+   {
+      for (int32_t b = -20000; b <= 20000; b += 1009)
+      {
+         exact = exact && IsFloorSqrt((uint64_t)a * a + (uint64_t)b * b, fm_hypot2(a, b));
+         exact = exact && IsFloorSqrt((uint64_t)a * a + (uint64_t)b * b + 100, fm_hypot3(a, b, 10));
+      }
+   }
+   //Above 2^24 the sum of squares is scaled down, check relative error there
+   for (int64_t a = 1 << 24; a <= INT32_MAX; a += 999983)
+   {
+      int32_t b = (int32_t)(a / 3);
+      double ref = sqrt((double)a * a + (double)b * b);
+      maxRelErr = fmax(maxRelErr, fabs(fm_hypot2(-a, b) - ref) / ref);
+      ref = sqrt((double)a * a + 2.0 * b * b);
+      maxRelErr = fmax(maxRelErr, fabs(fm_hypot3(a, b, -b) - ref) / ref);
+   }
+
+   ASSERT(exact);
+   ASSERT(maxRelErr < 1.0 / (1 << 23));
+   ASSERT(fm_hypot2(FP_FROMINT(3), FP_FROMINT(-4)) == FP_FROMINT(5));
+   ASSERT(fm_hypot3(FP_FROMINT(2), FP_FROMINT(3), FP_FROMINT(6)) == FP_FROMINT(7));
+   ASSERT(3037000499u - fm_hypot2(INT32_MIN, INT32_MIN) < (3037000499u >> 23));
+}
+
+static void TestLog()
+{
+   double maxErr2 = 0, maxErrLn = 0;
+
+   for (uint64_t x = 1; x <= UINT32_MAX; x += 4999 + x / 16)
+   {
+      maxErr2 = fmax(maxErr2, fabs(fm_log2(x) - log2((double)x) * FRAC_FAC));
+      maxErrLn = fmax(maxErrLn, fabs(fm_ln(x) - log((double)x) * FRAC_FAC));
+   }
+   for (uint32_t x = 1; x < 5000; x++)
+   {
+      maxErr2 = fmax(maxErr2, fabs(fm_log2(x) - log2((double)x) * FRAC_FAC));
+      maxErrLn = fmax(maxErrLn, fabs(fm_ln(x) - log((double)x) * FRAC_FAC));
+   }
+
+   ASSERT(maxErr2 < 1);
+   ASSERT(maxErrLn < 1);
+   ASSERT(fm_log2(1024) == FP_FROMINT(10));
+   ASSERT(fm_log2(0) == INT32_MIN);
+   ASSERT(fp_ln(1) == 0);
+}
+
+static void TestExp()
+{
+   double maxErr = 0;
+
+   for (s32fp x = FP_FROMINT(-6); x < FP_FROMFLT(18.0); x++)
+   {
+      double ref = exp((double)x / FRAC_FAC) * FRAC_FAC;
+      maxErr = fmax(maxErr, fabs(fm_exp(x) - ref) / (ref * (1.0 / 4096) + 0.5));
+   }
+
+   ASSERT(maxErr <= 1);
+   ASSERT(fm_exp(0) == FP_FROMINT(1));
+   ASSERT(fm_exp(FP_FROMINT(19)) == INT32_MAX);
+   ASSERT(fm_exp(FP_FROMINT(-100)) == 0);
+}
+
+static void TestSqrtf()
+{
+   double maxRelErr = 0;
+
+   for (float x = 1e-30f; x < 1e30f; x *= 1.0001f)
+      maxRelErr = fmax(maxRelErr, fabs(fm_sqrtf(x) - sqrt((double)x)) / sqrt((double)x));
+
+   ASSERT(maxRelErr < 1.0 / (1 << 20));
+   ASSERT(fm_sqrtf(0) == 0);
+   ASSERT(fm_sqrtf(-1) == 0);
+}
+
+//This line registers the test
+REGISTER_TEST(FastMathTest, TestIsqrt, TestSqrt, TestRsqrt, TestHypot, TestLog, TestExp, TestSqrtf);
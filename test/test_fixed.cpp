@@ -0,0 +1,84 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fixed.h"
+#include "my_fp.h"
+#include "test.h"
+
+class FixedTest: public UnitTest
+{
+   public:
+      FixedTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+};
+
+typedef Fixed<26, 5> Fp;
+typedef Fixed<1, 15> Q15;
+typedef Fixed<16, 15> Q16_15;
+
+//Constants and conversions are resolved by the compiler
+static_assert(Fp::FromInt(3).Raw() == FP_FROMINT(3), "FromInt");
+static_assert(Fp::FromFloat(2.5).Raw() == FP_FROMFLT(2.5), "FromFloat");
+static_assert(Q15::FromFloat(0.57735026919).Raw() == 18919, "FromFloat rounds");
+static_assert(Q15::FromFloat(-0.5).Raw() == -16384, "FromFloat negative");
+static_assert(Fp(Q15::FromFloat(0.5)).Raw() == 16, "Narrowing conversion");
+static_assert(Q16_15(Fp::FromFloat(-1.25)).Raw() == -40960, "Widening conversion");
+static_assert(Q15(Fp::FromInt(5)) == Q15::Max(), "Conversion saturates");
+static_assert(Mul<Fp>(Q15::FromFloat(0.5), Fp::FromInt(7)) == Fp::FromFloat(3.5), "Mixed multiply");
+
+static void TestArithmetic()
+{
+   Fp a = Fp::FromFloat(5.5);
+   Fp b = Fp::FromFloat(2.03125);
+
+   ASSERT((a * b).Raw() == FP_MUL(a.Raw(), b.Raw()));
+   ASSERT((a / b).Raw() == FP_DIV(a.Raw(), b.Raw()));
+   ASSERT((a + b) == Fp::FromFloat(7.53125));
+   ASSERT((b - a) == Fp::FromFloat(-3.46875));
+   ASSERT((a * 3).ToInt() == 16);
+   ASSERT((-a).ToInt() == -6); //rounds towards minus infinity like FP_TOINT
+   ASSERT((-a / 2) == Fp::FromFloat(-2.75));
+}
+
+static void TestWideningMultiply()
+{
+   //Product of raw values is above 2^31, FP_MUL() wraps here
+   Fp a = Fp::FromInt(3000);
+   Fp b = Fp::FromInt(1000);
+
+   ASSERT((a * b) == Fp::FromInt(3000000));
+   ASSERT(Mul<Q16_15>(Q15::FromFloat(0.75), Q16_15::FromInt(40000)) == Q16_15::FromInt(30000));
+   ASSERT(Div<Q16_15>(Fp::FromInt(3), Fp::FromInt(4)) == Q16_15::FromFloat(0.75));
+}
+
+static void TestSaturation()
+{
+   Fp big = Fp::FromInt(50000000);
+
+   ASSERT(big + big == Fp::Max());
+   ASSERT(-big - big == Fp::Min());
+   ASSERT(big * big == Fp::Max());
+   ASSERT(big * -1000 == Fp::Min());
+   ASSERT(Fp::FromInt(1) / Fp() == Fp::Max());
+   ASSERT(Fp::FromInt(-1) / 0 == Fp::Min());
+   ASSERT(Q15::FromFloat(3.0) == Q15::Max());
+   ASSERT(-Fp::Min() == Fp::Max());
+}
+
+//This line registers the test
+REGISTER_TEST(FixedTest, TestArithmetic, TestWideningMultiply, TestSaturation);
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/crc.h>
+#include "flashsim.h"
+#include "test.h"
+
+class FlashSimTest: public UnitTest
+{
+   public:
+      FlashSimTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup() { flash_sim_erase_all(); }
+};
+
+static volatile uint32_t* Word(uint32_t offset)
+{
+   return (volatile uint32_t*)(FLASH_BASE + offset);
+}
+
+static void crc_matches_stm32_unit()
+{
+   uint32_t data[2] = { 0x12345678, 0 };
+
+   crc_reset();
+   ASSERT(crc_calculate(0x12345678) == 0xDF8A8A2B);
+   crc_reset();
+   ASSERT(crc_calculate_block(data, 1) == 0xDF8A8A2B);
+}
+
+static void program_only_clears_bits()
+{
+   flash_program_word(FLASH_BASE + 8, 0x12345678);
+   ASSERT(*Word(8) == 0x12345678);
+   ASSERT(flash_sim_get_program_errors() == 0);
+
+   //Overwriting with non-zero fails like on the MCU, writing 0 is allowed
+   flash_program_word(FLASH_BASE + 8, 0x00005678);
+   ASSERT(*Word(8) == 0x00005678);
+   ASSERT(flash_sim_get_program_errors() == 1);
+   ASSERT(flash_sim_get_program_count() == 2);
+}
+
+static void erase_counts_wear_per_page()
+{
+   flash_program_word(FLASH_BASE + FLASH_SIM_PAGE_SIZE, 0);
+   flash_erase_page(FLASH_BASE + FLASH_SIM_PAGE_SIZE);
+   flash_erase_page(FLASH_BASE + FLASH_SIM_PAGE_SIZE);
+
+   ASSERT(*Word(FLASH_SIM_PAGE_SIZE) == 0xFFFFFFFF);
+   ASSERT(flash_sim_get_erase_count(0) == 0);
+   ASSERT(flash_sim_get_erase_count(1) == 2);
+}
+
+static void power_loss_drops_later_operations()
+{
+   flash_sim_power_loss_after(1);
+   flash_program_word(FLASH_BASE, 0);
+   flash_program_word(FLASH_BASE + 4, 0);
+   flash_erase_page(FLASH_BASE);
+
+   ASSERT(*Word(0) == 0);
+   ASSERT(*Word(4) == 0xFFFFFFFF);
+   ASSERT(flash_sim_get_operations() == 1);
+}
+
+REGISTER_TEST(
+   FlashSimTest,
+   crc_matches_stm32_unit,
+   program_only_clears_bits,
+   erase_counts_wear_per_page,
+   power_loss_drops_later_operations
+);
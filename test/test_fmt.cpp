@@ -0,0 +1,84 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_printf.h"
+
+#include "fmt.h"
+#include "test.h"
+#include <string>
+
+class FmtSink: public IPutChar
+{
+public:
+   FmtSink(): calls(0) {}
+   void PutChar(char c) { str += c; calls++; }
+   void PutBuffer(const char* buf, int len) { str.append(buf, len); calls++; }
+   std::string str;
+   int calls;
+};
+
+class FmtTest: public UnitTest
+{
+   public:
+      explicit FmtTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+};
+
+static void same_output_as_printf()
+{
+   FmtSink fmt, legacy;
+   int8_t neg = -12;
+   uint16_t id = 42;
+   uint32_t hex = 0xab;
+   int32_t upper = 0x1f;
+
+   FORMAT(&fmt, "%s=%d %5d|%-4x|%04X %c %f 100%%\r\n", "val", neg, id, hex, upper, 'z', Fmt::Fixed(FP_FROMINT(3)));
+   fprintf(&legacy, "%s=%d %5d|%-4x|%04X %c %f 100%%\r\n", "val", neg, id, hex, upper, 'z', FP_FROMINT(3));
+
+   ASSERT(fmt.str == "val=-12    42|ab  |001F z 3.00 100%\r\n");
+   ASSERT(fmt.str == legacy.str);
+}
+
+static void negative_and_extreme_values()
+{
+   FmtSink sink;
+
+   FORMAT(&sink, "%d %05d %u %X %f", (int32_t)-2147483647 - 1, -42, 4294967295u, 0xDEADBEEFu, Fmt::Fixed(FP_FROMFLT(-1.5)));
+
+   ASSERT(sink.str == "-2147483648 -0042 4294967295 DEADBEEF -1.50");
+}
+
+static void literal_runs_in_one_call()
+{
+   FmtSink sink;
+
+   FORMAT(&sink, "{\"name\":\"%s\",\"unit\":\"%s\"}", "ocurlim", "A");
+
+   ASSERT(sink.str == "{\"name\":\"ocurlim\",\"unit\":\"A\"}");
+   ASSERT(sink.calls == 5);
+
+   sink.str.clear();
+   FORMAT(&sink, "no conversions\r\n");
+   ASSERT(sink.str == "no conversions\r\n");
+}
+
+REGISTER_TEST(
+   FmtTest,
+   same_output_as_printf,
+   negative_and_extreme_values,
+   literal_runs_in_one_call
+);
@@ -24,6 +24,7 @@
 #include "sine_core.h"
 #include "test.h"
 #include "string.h"
+#include <stdio.h>
 
 class FPTest: public UnitTest
 {
@@ -42,15 +43,67 @@ static void TestItoa()
 {
    char buf[10];
    ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(2.03125)), "2.03") == 0);
-   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(-2.125)), "-2.12") == 0);
-   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(2.15624)), "2.12") == 0);
-   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(2.15625)), "2.15") == 0);
+   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(-2.125)), "-2.13") == 0);
+   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(2.15624)), "2.13") == 0);
+   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(2.15625)), "2.16") == 0);
+   ASSERT(strcmp(fp_itoa(buf, FP_FROMFLT(9.99)), "9.97") == 0);
+   ASSERT(strcmp(fp_itoa(buf, -1), "-0.03") == 0);
+}
+
+static void TestItoaDecimals()
+{
+   char buf[FP_ITOA_BUFSIZE(FP_MAX_DECIMALS)];
+   ASSERT(strcmp(fp_itoa_dec(buf, FP_FROMFLT(2.03125), 5), "2.03125") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, FP_FROMFLT(2.03125), 9), "2.031250000") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, FP_FROMFLT(9.96875), 1), "10.0") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, FP_FROMFLT(-9.5), 0), "-10") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, -1, 1), "0.0") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, INT32_MIN, 2), "-67108864.00") == 0);
+   ASSERT(strcmp(fp_itoa_dec(buf, INT32_MAX, 5), "67108863.96875") == 0);
+}
+
+/* Five decimals show every s32fp exactly, compare with the C library */
+static void TestItoaExact()
+{
+   char buf[FP_ITOA_BUFSIZE(5)];
+   char ref[32];
+   bool equal = true;
+
+   for (int64_t a = INT32_MIN; a <= INT32_MAX; a += 4093)
+   {
+      snprintf(ref, sizeof(ref), "%.5f", (double)a / FRAC_FAC);
+      equal = equal && strcmp(fp_itoa_dec(buf, a, 5), ref) == 0;
+   }
+   ASSERT(equal);
 }
 
 static void TestAtoi()
 {
    ASSERT(fp_atoi("-2.5", 5) == FP_FROMFLT(-2.5));
    ASSERT(fp_atoi("2.155", 5) == FP_FROMFLT(2.16));
+   ASSERT(fp_atoi("0.015625", 5) == 1); //exactly half way, rounds up
+   ASSERT(fp_atoi("0.015624999", 5) == 0);
+   ASSERT(fp_atoi("0.9999999999", 5) == FP_FROMINT(1));
+   ASSERT(fp_atoi("1.0000152587890625", 16) == 65537);
+   ASSERT(fp_atoi("-67108864", 5) == INT32_MIN);
+   ASSERT(fp_atoi("12", 5) == FP_FROMINT(12));
+}
+
+/* Printing with 2 or more decimals and parsing again gives the same value */
+static void TestRoundTrip()
+{
+   char buf[FP_ITOA_BUFSIZE(FP_MAX_DECIMALS)];
+   bool equal = true;
+
+   for (int decimals = 2; decimals <= FP_MAX_DECIMALS; decimals++)
+   {
+      for (int64_t a = INT32_MIN; a <= INT32_MAX; a += 65521 + decimals)
+         equal = equal && fp_atoi(fp_itoa_dec(buf, a, decimals), FRAC_DIGITS) == a;
+   }
+   for (s32fp a = -100000; a <= 100000; a++)
+      equal = equal && fp_atoi(fp_itoa(buf, a), FRAC_DIGITS) == a;
+
+   ASSERT(equal);
 }
 
 static void TestMedian3()
@@ -63,6 +116,6 @@ static void TestMedian3()
 }
 
 //This line registers the test
-REGISTER_TEST(FPTest, TestMacros, TestItoa, TestAtoi, TestMedian3);
+REGISTER_TEST(FPTest, TestMacros, TestItoa, TestItoaDecimals, TestItoaExact, TestAtoi, TestRoundTrip, TestMedian3);
 
 
@@ -0,0 +1,299 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/crc.h>
+#include "params.h"
+#include "param_save.h"
+#include "hwdefs.h"
+#include "my_fp.h"
+#include "flashsim.h"
+#include "flashwriter.h"
+#include "test.h"
+#include <string.h>
+#include <vector>
+
+class ParamSaveTest: public UnitTest
+{
+   public:
+      ParamSaveTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup();
+};
+
+void ParamSaveTest::TestCaseSetup()
+{
+   flash_sim_erase_all();
+   Param::LoadDefaults();
+}
+
+static uint32_t* LogPage(int page)
+{
+   return (uint32_t*)(FLASH_BASE + flash_sim_get_size() - (PARAM_BLKNUM + page) * PARAM_BLKSIZE);
+}
+
+static int Reboot()
+{
+   Param::LoadDefaults();
+   return parm_load();
+}
+
+static void load_fails_on_empty_flash()
+{
+   ASSERT(Reboot() != 0);
+}
+
+static void save_and_load()
+{
+   Param::Set(Param::ocurlim, FP_FROMINT(42));
+   Param::SetElement(Param::curve, 2, FP_FROMINT(-7));
+   Param::Set(Param::polepairs, FP_FROMINT(4));
+   Param::SetFlag(Param::polepairs, Param::FLAG_HIDDEN);
+   parm_save();
+
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(42));
+   ASSERT(Param::GetElement(Param::curve, 2) == FP_FROMINT(-7));
+   ASSERT(Param::GetElement(Param::curve, 3) == FP_FROMINT(5));
+   ASSERT(Param::Get(Param::polepairs) == FP_FROMINT(4));
+   ASSERT(Param::GetFlag(Param::polepairs) == Param::FLAG_HIDDEN);
+}
+
+static void save_appends_only_changed()
+{
+   parm_save();
+   Param::Set(Param::ocurlim, FP_FROMINT(43));
+   flash_sim_power_loss_after(-1);
+   parm_save();
+
+   //One record and one commit of two words each
+   ASSERT(flash_sim_get_operations() == 4);
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(43));
+}
+
+static void unchecked_set_is_saved()
+{
+   parm_save();
+   //Like CAN receive and application code, no range check and no Change() call
+   Param::SetFixed(Param::ocurlim, FP_FROMINT(77));
+   Param::SetInt(Param::polepairs, 5);
+   Param::SetFloat(Param::curve, -3.0f);
+   parm_save();
+
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(77));
+   ASSERT(Param::GetInt(Param::polepairs) == 5);
+   ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMINT(-3));
+}
+
+static void save_without_change_writes_nothing()
+{
+   parm_save();
+   flash_sim_power_loss_after(-1);
+   parm_save();
+   ASSERT(flash_sim_get_operations() == 0);
+}
+
+static void full_log_is_compacted_to_next_page()
+{
+   parm_save();
+   ASSERT(LogPage(1)[0] == 0xFFFFFFFF);
+
+   for (int i = 0; i < 100; i++)
+   {
+      Param::Set(Param::ocurlim, FP_FROMINT(i));
+      parm_save();
+   }
+
+   ASSERT(LogPage(1)[0] != 0xFFFFFFFF);
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(99));
+   ASSERT(Param::Get(Param::polepairs) == FP_FROMINT(2));
+}
+
+static void power_loss_during_append()
+{
+   std::vector<uint8_t> image;
+   int numOperations;
+
+   Param::Set(Param::ocurlim, FP_FROMINT(1));
+   parm_save();
+   image.assign(flash_sim_get_memory(), flash_sim_get_memory() + flash_sim_get_size());
+
+   Param::Set(Param::ocurlim, FP_FROMINT(2));
+   Param::SetElement(Param::curve, 1, FP_FROMINT(9));
+   flash_sim_power_loss_after(-1);
+   parm_save();
+   numOperations = flash_sim_get_operations();
+
+   for (int k = 0; k <= numOperations; k++)
+   {
+      memcpy(flash_sim_get_memory(), image.data(), image.size());
+      Reboot();
+      Param::Set(Param::ocurlim, FP_FROMINT(2));
+      Param::SetElement(Param::curve, 1, FP_FROMINT(9));
+      flash_sim_power_loss_after(k);
+      parm_save();
+      flash_sim_power_loss_after(-1);
+
+      ASSERT(Reboot() == 0);
+      bool isOld = Param::Get(Param::ocurlim) == FP_FROMINT(1) && Param::GetElement(Param::curve, 1) == FP_FROMINT(5);
+      bool isNew = Param::Get(Param::ocurlim) == FP_FROMINT(2) && Param::GetElement(Param::curve, 1) == FP_FROMINT(9);
+      ASSERT(k < numOperations ? (isOld || isNew) : isNew);
+   }
+}
+
+static void power_loss_during_compaction()
+{
+   std::vector<uint8_t> image;
+   int numOperations;
+   int value = 0;
+
+   //Fill first page until the next save compacts into the second page
+   parm_save();
+   do
+   {
+      image.assign(flash_sim_get_memory(), flash_sim_get_memory() + flash_sim_get_size());
+      Param::Set(Param::ocurlim, FP_FROMINT(++value));
+      flash_sim_power_loss_after(-1);
+      parm_save();
+   } while (LogPage(1)[0] == 0xFFFFFFFF);
+
+   numOperations = flash_sim_get_operations();
+
+   for (int k = 0; k <= numOperations; k++)
+   {
+      memcpy(flash_sim_get_memory(), image.data(), image.size());
+      Reboot();
+      Param::Set(Param::ocurlim, FP_FROMINT(value));
+      flash_sim_power_loss_after(k);
+      parm_save();
+      flash_sim_power_loss_after(-1);
+
+      ASSERT(Reboot() == 0);
+      s32fp loaded = Param::Get(Param::ocurlim);
+      ASSERT(k < numOperations ? (loaded == FP_FROMINT(value - 1) || loaded == FP_FROMINT(value)) : loaded == FP_FROMINT(value));
+   }
+}
+
+static void legacy_page_is_loaded_and_converted()
+{
+   const uint32_t numEntries = (PARAM_BLKSIZE - 8) / 8;
+   uint32_t* page = LogPage(0);
+
+   //Legacy page: key, 0xFF filler, flags, value, CRC after last entry
+   page[0] = 22 | (0xFF << 16) | (0 << 24);
+   page[1] = FP_FROMINT(77);
+   crc_reset();
+   page[numEntries * 2] = crc_calculate_block(page, numEntries * 2);
+
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(77));
+
+   parm_save();
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(77));
+}
+
+static void legacy_page_survives_power_loss_during_migration()
+{
+   const uint32_t numEntries = (PARAM_BLKSIZE - 8) / 8;
+   uint32_t* page = LogPage(0);
+   std::vector<uint8_t> image;
+   int numOperations;
+
+   page[0] = 22 | (0xFF << 16) | (0 << 24);
+   page[1] = FP_FROMINT(77);
+   crc_reset();
+   page[numEntries * 2] = crc_calculate_block(page, numEntries * 2);
+   image.assign(flash_sim_get_memory(), flash_sim_get_memory() + flash_sim_get_size());
+
+   Reboot();
+   flash_sim_power_loss_after(-1);
+   parm_save();
+   numOperations = flash_sim_get_operations();
+   //Snapshot went to the other page, legacy page is untouched
+   ASSERT(page[1] == (uint32_t)FP_FROMINT(77));
+
+   for (int k = 0; k <= numOperations; k++)
+   {
+      memcpy(flash_sim_get_memory(), image.data(), image.size());
+      Reboot();
+      flash_sim_power_loss_after(k);
+      parm_save();
+      flash_sim_power_loss_after(-1);
+
+      ASSERT(Reboot() == 0);
+      ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(77));
+   }
+}
+
+static int asyncOk;
+static uint32_t asyncCrc;
+
+static void AsyncSaveDone(int ok, uint32_t crc)
+{
+   asyncOk = ok;
+   asyncCrc = crc;
+}
+
+static void async_save_leaves_crc_unit_alone()
+{
+   uint32_t* page = LogPage(0);
+   int start = 2, end;
+
+   parm_save();
+   while (page[start] != 0xFFFFFFFF) start += 2;
+   Param::Set(Param::ocurlim, FP_FROMINT(55));
+   asyncOk = -1;
+   ASSERT(parm_save_async(AsyncSaveDone) == 0);
+
+   //Main loop is in the middle of a CRC when FlashWriter completes the save
+   crc_reset();
+   crc_calculate(0x12345678);
+   FlashWriter::Flush();
+   uint32_t crc = crc_calculate(0x9abcdef0);
+
+   crc_reset();
+   crc_calculate(0x12345678);
+   ASSERT(crc == crc_calculate(0x9abcdef0));
+   ASSERT(asyncOk == 1);
+
+   //Reported CRC is the one of the CRC unit over the written batch
+   for (end = start; page[end] != 0xFFFFFFFF; end += 2);
+   crc_reset();
+   ASSERT(asyncCrc == crc_calculate_block(&page[start], end - start));
+
+   ASSERT(Reboot() == 0);
+   ASSERT(Param::Get(Param::ocurlim) == FP_FROMINT(55));
+}
+
+REGISTER_TEST(
+   ParamSaveTest,
+   load_fails_on_empty_flash,
+   save_and_load,
+   save_appends_only_changed,
+   unchecked_set_is_saved,
+   save_without_change_writes_nothing,
+   full_log_is_compacted_to_next_page,
+   power_loss_during_append,
+   power_loss_during_compaction,
+   legacy_page_is_loaded_and_converted,
+   legacy_page_survives_power_loss_during_migration,
+   async_save_leaves_crc_unit_alone
+);
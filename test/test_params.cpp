@@ -0,0 +1,263 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "params.h"
+#include "my_fp.h"
+#include "test.h"
+#include <string.h>
+
+class ParamsTest: public UnitTest
+{
+   public:
+      ParamsTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup();
+};
+
+void ParamsTest::TestCaseSetup()
+{
+   Param::LoadDefaults();
+}
+
+static void array_defaults()
+{
+   uint32_t length;
+   const s32fp* data = Param::GetArray(Param::curve, length);
+
+   ASSERT(length == 4);
+   ASSERT(Param::GetLength(Param::curve) == 4);
+   for (uint32_t i = 0; i < length; i++)
+      ASSERT(data[i] == FP_FROMINT(5));
+}
+
+static void scalar_is_array_of_one()
+{
+   uint32_t length;
+   const s32fp* data = Param::GetArray(Param::ocurlim, length);
+
+   ASSERT(length == 1);
+   ASSERT(data[0] == Param::Get(Param::ocurlim));
+   ASSERT(Param::GetElement(Param::ocurlim, 0) == Param::Get(Param::ocurlim));
+}
+
+static void array_set_element()
+{
+   ASSERT(Param::SetElement(Param::curve, 2, FP_FROMINT(42)) == 0);
+   ASSERT(Param::GetElement(Param::curve, 2) == FP_FROMINT(42));
+   ASSERT(Param::GetElement(Param::curve, 1) == FP_FROMINT(5));
+}
+
+static void array_element_zero_mirrors_value()
+{
+   ASSERT(Param::SetElement(Param::curve, 0, FP_FROMINT(-7)) == 0);
+   ASSERT(Param::Get(Param::curve) == FP_FROMINT(-7));
+   ASSERT(Param::Set(Param::curve, FP_FROMINT(8)) == 0);
+   ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMINT(8));
+}
+
+static void array_set_without_range_check()
+{
+   //As done by CAN receive for a mapped array
+   Param::SetFixed(Param::curve, FP_FROMINT(3));
+   ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMINT(3));
+   Param::SetInt(Param::curve, 4);
+   ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMINT(4));
+   Param::SetFloat(Param::curve, 1.5f);
+   ASSERT(Param::GetElement(Param::curve, 0) == FP_FROMFLT(1.5));
+   ASSERT(Param::Get(Param::curve) == FP_FROMFLT(1.5));
+   ASSERT(Param::GetElement(Param::curve, 1) == FP_FROMINT(5));
+}
+
+static void array_set_element_out_of_range()
+{
+   ASSERT(Param::SetElement(Param::curve, 1, FP_FROMINT(101)) != 0);
+   ASSERT(Param::SetElement(Param::curve, 4, FP_FROMINT(1)) != 0);
+   ASSERT(Param::GetElement(Param::curve, 1) == FP_FROMINT(5));
+   ASSERT(Param::GetElement(Param::curve, 4) == 0);
+}
+
+static void category_index()
+{
+   ASSERT(Param::GetNumCategories() == 2);
+   ASSERT(Param::GetCategory(Param::ocurlim) == 0);
+   ASSERT(Param::GetCategory(Param::curve) == 0);
+   ASSERT(Param::GetCategory(Param::polepairs) == 1);
+   ASSERT(Param::GetCategory(Param::amp) == CATEGORY_NONE);
+   ASSERT(strcmp(Param::GetCategoryName(1), "motor") == 0);
+   ASSERT(Param::GetCategoryName(2) == 0);
+   ASSERT(Param::CategoryFromString("inverter") == 0);
+   ASSERT(Param::CategoryFromString("foo") == CATEGORY_NONE);
+}
+
+static void query_category_and_range()
+{
+   Param::Query query;
+
+   Param::InitQuery(query);
+   ASSERT(Param::MatchesQuery(Param::amp, query));
+   ASSERT(Param::MatchesQuery(Param::polepairs, query));
+
+   query.category = 1;
+   ASSERT(!Param::MatchesQuery(Param::amp, query));
+   ASSERT(!Param::MatchesQuery(Param::ocurlim, query));
+   ASSERT(Param::MatchesQuery(Param::polepairs, query));
+
+   Param::InitQuery(query);
+   query.first = Param::ocurlim;
+   query.last = Param::curve;
+   ASSERT(!Param::MatchesQuery(Param::pot, query));
+   ASSERT(Param::MatchesQuery(Param::ocurlim, query));
+   ASSERT(Param::MatchesQuery(Param::curve, query));
+   ASSERT(!Param::MatchesQuery(Param::polepairs, query));
+}
+
+static void query_hidden()
+{
+   Param::Query query;
+
+   Param::InitQuery(query);
+   Param::SetFlag(Param::ocurlim, Param::FLAG_HIDDEN);
+   ASSERT(!Param::MatchesQuery(Param::ocurlim, query));
+   query.flags |= Param::QUERY_HIDDEN;
+   ASSERT(Param::MatchesQuery(Param::ocurlim, query));
+   Param::ClearFlag(Param::ocurlim, Param::FLAG_HIDDEN);
+}
+
+static void generation_bumped_on_change()
+{
+   uint32_t gen = Param::GetGeneration();
+
+   Param::Set(Param::ocurlim, FP_FROMINT(10));
+   ASSERT(Param::GetGeneration() == gen + 1);
+   ASSERT(Param::GetParamGeneration(Param::ocurlim) == gen + 1);
+
+   //Same value again and out of range values don't count as change
+   Param::Set(Param::ocurlim, FP_FROMINT(10));
+   Param::Set(Param::ocurlim, FP_FROMINT(100000));
+   ASSERT(Param::GetGeneration() == gen + 1);
+
+   Param::SetElement(Param::curve, 3, FP_FROMINT(1));
+   ASSERT(Param::GetParamGeneration(Param::curve) == gen + 2);
+
+   Param::SetFlag(Param::polepairs, Param::FLAG_HIDDEN);
+   ASSERT(Param::GetParamGeneration(Param::polepairs) == gen + 3);
+   Param::ClearFlag(Param::polepairs, Param::FLAG_HIDDEN);
+}
+
+static void query_changed_since()
+{
+   Param::Query query;
+
+   Param::InitQuery(query);
+   query.since = Param::GetGeneration();
+   ASSERT(!Param::MatchesQuery(Param::ocurlim, query));
+   ASSERT(Param::MatchesQuery(Param::amp, query));
+
+   Param::Set(Param::ocurlim, FP_FROMINT(11));
+   ASSERT(Param::MatchesQuery(Param::ocurlim, query));
+   ASSERT(!Param::MatchesQuery(Param::polepairs, query));
+}
+
+static void unchecked_setters_count_as_change()
+{
+   Param::Query query;
+
+   Param::InitQuery(query);
+   query.since = Param::GetGeneration();
+
+   Param::SetFixed(Param::ocurlim, FP_FROMINT(12));
+   ASSERT(Param::MatchesQuery(Param::ocurlim, query));
+   query.since = Param::GetGeneration();
+   Param::SetInt(Param::polepairs, 3);
+   ASSERT(Param::MatchesQuery(Param::polepairs, query));
+   query.since = Param::GetGeneration();
+   Param::SetFloat(Param::curve, 2.5f);
+   ASSERT(Param::MatchesQuery(Param::curve, query));
+   ASSERT(!Param::MatchesQuery(Param::ocurlim, query));
+
+   //Spot values change all the time and don't advance the generation
+   uint32_t generation = Param::GetGeneration();
+   Param::SetFixed(Param::amp, FP_FROMINT(5));
+   ASSERT(Param::GetGeneration() == generation);
+}
+
+static void schema_hash_stable()
+{
+   uint32_t hash = Param::GetSchemaHash();
+
+   ASSERT(hash != 0);
+   Param::Set(Param::ocurlim, FP_FROMINT(12));
+   ASSERT(Param::GetSchemaHash() == hash);
+}
+
+static void num_from_id()
+{
+   for (int i = 0; i < Param::PARAM_LAST; i++)
+      ASSERT(Param::NumFromId(Param::GetAttrib((Param::PARAM_NUM)i)->id) == i);
+
+   ASSERT(Param::NumFromId(0) == Param::PARAM_INVALID);
+   ASSERT(Param::NumFromId(23) == Param::PARAM_INVALID);
+   ASSERT(Param::NumFromId(2014) == Param::PARAM_INVALID);
+   ASSERT(Param::NumFromId(100000) == Param::PARAM_INVALID);
+}
+
+static void set_multiple_all_or_nothing()
+{
+   uint8_t status[4];
+   Param::Update good[] = {
+      { Param::ocurlim, 0, FP_FROMINT(50) },
+      { Param::curve, 3, FP_FROMINT(9) },
+      { Param::polepairs, 0, FP_FROMINT(4) }
+   };
+   Param::Update bad[] = {
+      { Param::ocurlim, 0, FP_FROMINT(60) },
+      { Param::curve, 4, FP_FROMINT(1) },
+      { Param::polepairs, 0, FP_FROMINT(17) },
+      { Param::PARAM_INVALID, 0, 0 }
+   };
+
+   ASSERT(Param::SetMultiple(bad, 4, status) == 3);
+   ASSERT(status[0] == Param::UPDATE_OK && status[1] == Param::UPDATE_INVALID_ELEMENT);
+   ASSERT(status[2] == Param::UPDATE_OUT_OF_RANGE && status[3] == Param::UPDATE_INVALID_PARAM);
+   ASSERT(Param::GetInt(Param::ocurlim) == 100);
+
+   uint32_t generation = Param::GetGeneration();
+   ASSERT(Param::SetMultiple(good, 3, 0) == 0);
+   ASSERT(Param::GetInt(Param::ocurlim) == 50);
+   ASSERT(Param::GetElement(Param::curve, 3) == FP_FROMINT(9));
+   ASSERT(Param::GetInt(Param::polepairs) == 4);
+   ASSERT(Param::GetParamGeneration(Param::polepairs) > generation);
+}
+
+REGISTER_TEST(
+   ParamsTest,
+   array_defaults,
+   scalar_is_array_of_one,
+   array_set_element,
+   array_element_zero_mirrors_value,
+   array_set_without_range_check,
+   array_set_element_out_of_range,
+   category_index,
+   query_category_and_range,
+   query_hidden,
+   generation_bumped_on_change,
+   query_changed_since,
+   unchecked_setters_count_as_change,
+   schema_hash_stable,
+   num_from_id,
+   set_multiple_all_or_nothing
+);
@@ -0,0 +1,160 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_printf.h"
+
+#include "paramstreamer.h"
+#include "params.h"
+#include "my_fp.h"
+#include "test.h"
+#include <string>
+
+class StringSink: public IPutChar
+{
+public:
+   void PutChar(char c) { str += c; }
+   std::string str;
+};
+
+class ParamStreamerTest: public UnitTest
+{
+   public:
+      explicit ParamStreamerTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup() { Param::LoadDefaults(); ParamStreamer::Stop(); }
+};
+
+static const Param::PARAM_NUM streamParams[] = { Param::ocurlim, Param::polepairs };
+
+static void text_with_timestamp_and_decimation()
+{
+   StringSink sink;
+
+   ParamStreamer::Start(0, streamParams, 2, 2, -1, ParamStreamer::FORMAT_TEXT);
+   for (int i = 0; i < 5; i++) ParamStreamer::Tick();
+   ParamStreamer::Print(&sink);
+
+   ASSERT(sink.str == "0,100.00,2.00\r\n2,100.00,2.00\r\n4,100.00,2.00\r\n");
+}
+
+static void repetitions_end_stream()
+{
+   StringSink sink;
+
+   ParamStreamer::Start(0, streamParams, 1, 1, 2, ParamStreamer::FORMAT_TEXT);
+   for (int i = 0; i < 5; i++) ParamStreamer::Tick();
+   ParamStreamer::Print(&sink);
+
+   ASSERT(sink.str == "0,100.00\r\n1,100.00\r\n");
+   ASSERT(!ParamStreamer::IsRunning());
+}
+
+static void binary_sample_layout()
+{
+   StringSink sink;
+
+   ParamStreamer::Start(0, streamParams + 1, 1, 1, 1, ParamStreamer::FORMAT_BINARY);
+   ParamStreamer::Tick();
+   ParamStreamer::Print(&sink);
+
+   ASSERT(sink.str.size() == 8);
+   ASSERT(sink.str.compare(0, 4, std::string(4, '\0')) == 0);
+   ASSERT((uint8_t)sink.str[5] == (FP_FROMINT(2) >> 8));
+}
+
+static void overrun_drops_samples()
+{
+   Param::PARAM_NUM many[PARAMSTREAM_MAX_VALUES];
+   StringSink sink;
+
+   for (int i = 0; i < PARAMSTREAM_MAX_VALUES; i++) many[i] = Param::ocurlim;
+
+   ParamStreamer::Start(0, many, PARAMSTREAM_MAX_VALUES, 1, -1, ParamStreamer::FORMAT_BINARY);
+   for (int i = 0; i < 20; i++) ParamStreamer::Tick();
+
+   ASSERT(ParamStreamer::GetOverruns() == 20 - PARAMSTREAM_BUFSIZE / (PARAMSTREAM_MAX_VALUES + 1));
+   ParamStreamer::Print(&sink);
+   ASSERT(sink.str.size() == 4 * (PARAMSTREAM_MAX_VALUES + 1) * (PARAMSTREAM_BUFSIZE / (PARAMSTREAM_MAX_VALUES + 1)));
+}
+
+static uint32_t ReadVarint(const std::string& s, size_t& pos)
+{
+   uint32_t value = 0;
+
+   for (int shift = 0; ; shift += 7)
+   {
+      uint8_t b = s[pos++];
+      value |= (b & 0x7F) << shift;
+      if (b < 0x80) return value;
+   }
+}
+
+static void delta_roundtrip_and_size()
+{
+   StringSink sink;
+   const int numSamples = 120;
+   int32_t expected[numSamples];
+
+   ParamStreamer::Start(0, streamParams, 1, 1, -1, ParamStreamer::FORMAT_DELTA);
+
+   for (int i = 0; i < numSamples; i++)
+   {
+      expected[i] = FP_FROMINT(100) + (i % 7) - 3; //a few LSB of noise
+      Param::SetFixed(Param::ocurlim, expected[i]);
+      ParamStreamer::Tick();
+      ParamStreamer::Print(&sink);
+   }
+
+   size_t pos = 0;
+   uint32_t tick = 0;
+   int32_t value = 0;
+   bool ok = true;
+
+   for (int i = 0; i < numSamples; i++)
+   {
+      bool keyframe = (uint8_t)sink.str[pos] == ParamStreamer::DELTA_KEYFRAME;
+
+      if (keyframe)
+      {
+         pos++;
+         tick = ReadVarint(sink.str, pos);
+         value = 0;
+      }
+      else
+      {
+         tick += ReadVarint(sink.str, pos) >> 1;
+      }
+      ok &= (i % PARAMSTREAM_KEYFRAME_INTERVAL == 0) == keyframe;
+      uint32_t zz = ReadVarint(sink.str, pos);
+      value += (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+      ok &= tick == (uint32_t)i && value == expected[i];
+   }
+
+   ASSERT(ok);
+   ASSERT(pos == sink.str.size());
+   //raw binary takes 8 bytes per sample
+   ASSERT(sink.str.size() * 3.5 < numSamples * 8);
+}
+
+REGISTER_TEST(
+   ParamStreamerTest,
+   text_with_timestamp_and_decimation,
+   repetitions_end_stream,
+   binary_sample_layout,
+   overrun_drops_samples,
+   delta_roundtrip_and_size
+);
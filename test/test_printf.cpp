@@ -0,0 +1,65 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_printf.h"
+
+#include "my_fp.h"
+#include "test.h"
+#include <string>
+
+class CountingSink: public IPutChar
+{
+public:
+   CountingSink(): calls(0) {}
+   void PutChar(char c) { str += c; calls++; }
+   void PutBuffer(const char* buf, int len) { str.append(buf, len); calls++; }
+   std::string str;
+   int calls;
+};
+
+class PrintfTest: public UnitTest
+{
+   public:
+      explicit PrintfTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+};
+
+static void conversions_and_padding()
+{
+   CountingSink sink;
+
+   fprintf(&sink, "%s=%d %5d|%-4x|%04X %c %f 100%%\r\n", "val", -12, 42, 0xab, 0x1f, 'z', FP_FROMINT(3));
+
+   ASSERT(sink.str == "val=-12    42|ab  |001F z 3.00 100%\r\n");
+}
+
+static void literal_runs_in_one_call()
+{
+   CountingSink sink;
+
+   fprintf(&sink, "{\"name\":\"%s\",\"unit\":\"%s\"}", "ocurlim", "A");
+
+   ASSERT(sink.str == "{\"name\":\"ocurlim\",\"unit\":\"A\"}");
+   //3 literal runs, 2 strings, one trailing run
+   ASSERT(sink.calls == 5);
+}
+
+REGISTER_TEST(
+   PrintfTest,
+   conversions_and_padding,
+   literal_runs_in_one_call
+);
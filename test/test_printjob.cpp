@@ -0,0 +1,179 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "host_printf.h"
+
+#include "printjob.h"
+#include "params.h"
+#include "stub_canhardware.h"
+#include "test.h"
+#include <string>
+
+/** Sink that accepts a limited number of characters per round, like a full UART ring */
+class ThrottledSink: public IPutChar
+{
+public:
+   ThrottledSink(): room(0) {}
+   void PutChar(char c) { str += c; }
+   bool TryPutChar(char c)
+   {
+      if (room == 0) return false;
+      room--;
+      str += c;
+      return true;
+   }
+   std::string str;
+   int room;
+};
+
+class PrintJobTest: public UnitTest
+{
+   public:
+      explicit PrintJobTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup() { Param::LoadDefaults(); }
+};
+
+static std::string RunThrottled(PrintJob& job, int room, int& rounds)
+{
+   ThrottledSink sink;
+
+   rounds = 0;
+   do
+   {
+      sink.room = room;
+      rounds++;
+   } while (!job.Resume(&sink) && rounds < 100000);
+
+   return sink.str;
+}
+
+static void json_resumed_equals_blocking()
+{
+   CanStub can;
+   CanMap canMap(&can, false);
+   Param::Query query;
+   PrintJob job;
+   ThrottledSink blockingSink;
+   int rounds;
+
+   canMap.AddSend(Param::ocurlim, 0x123, 0, 16, 1.0, 0);
+   Param::InitQuery(query);
+   job.StartJson(query, &canMap);
+   job.RunBlocking(&blockingSink);
+
+   ASSERT(blockingSink.str.find("\"ocurlim\": {\"value\":100.00") != std::string::npos);
+   ASSERT(blockingSink.str.find("\"canid\":291") != std::string::npos);
+
+   job.StartJson(query, &canMap);
+   std::string resumed = RunThrottled(job, 7, rounds);
+
+   ASSERT(resumed == blockingSink.str);
+   ASSERT(rounds > 1);
+   ASSERT(!job.IsRunning());
+}
+
+static void value_changing_while_resumed()
+{
+   Param::Query query;
+   PrintJob job;
+   ThrottledSink sink;
+
+   Param::InitQuery(query);
+   query.flags = Param::QUERY_VALUES;
+   job.StartJson(query, 0);
+
+   //Print until we are somewhere in the middle
+   sink.room = 40;
+   ASSERT(!job.Resume(&sink));
+   Param::SetInt(Param::ocurlim, 123);
+
+   while (!job.Resume(&sink))
+      sink.room = 3;
+
+   //Each entry is printed once and consistently, either with old or new value
+   size_t pos = sink.str.find("\"ocurlim\":");
+   ASSERT(sink.str.find("\"ocurlim\":", pos + 1) == std::string::npos);
+   ASSERT(sink.str.compare(pos, 16, "\"ocurlim\":100.00") == 0 || sink.str.compare(pos, 16, "\"ocurlim\":123.00") == 0);
+   ASSERT(sink.str.compare(sink.str.size() - 3, 3, "}\r\n") == 0);
+}
+
+static void array_changing_while_resumed()
+{
+   Param::Query query;
+   PrintJob job;
+   ThrottledSink sink;
+   int round = 0;
+
+   Param::InitQuery(query);
+   query.flags = Param::QUERY_VALUES;
+   job.StartJson(query, 0);
+
+   //Change the number of digits of all elements between every round
+   do
+   {
+      for (uint32_t i = 0; i < 4; i++)
+         Param::SetElementFixed(Param::curve, i, FP_FROMINT((round & 1) ? 100 : 5));
+      sink.room = 3;
+      round++;
+   } while (!job.Resume(&sink));
+
+   size_t pos = sink.str.find("\"curve\":[");
+   ASSERT(pos != std::string::npos);
+   pos += 9;
+
+   //Every element is printed completely with either value
+   for (int i = 0; i < 4; i++)
+   {
+      size_t end = sink.str.find(i < 3 ? ',' : ']', pos);
+      std::string element = sink.str.substr(pos, end - pos);
+      ASSERT(element == "5.00" || element == "100.00");
+      pos = end + 1;
+   }
+}
+
+static void canmap_resumed_equals_blocking()
+{
+   CanStub can;
+   CanMap canMap(&can, false);
+   PrintJob job;
+   ThrottledSink blockingSink;
+   int rounds;
+
+   canMap.AddSend(Param::ocurlim, 0x123, 0, 16, 1.0, 0);
+   canMap.AddSend(Param::polepairs, 0x123, 16, 8, 1.0, 0);
+   canMap.AddRecv(Param::ocurlim, 0x200, 8, 8, 1.0, 3);
+
+   job.StartCanMap(&canMap);
+   job.RunBlocking(&blockingSink);
+
+   ASSERT(blockingSink.str ==
+          "can tx ocurlim 291 0 16 1.00 0\r\n"
+          "can tx polepairs 291 16 8 1.00 0\r\n"
+          "can rx ocurlim 512 8 8 1.00 3\r\n");
+
+   job.StartCanMap(&canMap);
+   ASSERT(RunThrottled(job, 5, rounds) == blockingSink.str);
+}
+
+REGISTER_TEST(
+   PrintJobTest,
+   json_resumed_equals_blocking,
+   value_changing_while_resumed,
+   array_changing_while_resumed,
+   canmap_resumed_equals_blocking
+);
@@ -0,0 +1,362 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/timer.h>
+#include <vector>
+#include "stm32scheduler.h"
+#include "errormessage.h"
+#include "test.h"
+
+extern "C" uint32_t stubTimerFlags;
+extern "C" uint32_t stubTimerCounter;
+extern "C" uint32_t stubTimerCompare;
+extern "C" uint32_t stubCycleCounter;
+extern "C" bool stubDwtPresent;
+
+class SchedulerTest: public UnitTest
+{
+   public:
+      SchedulerTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup();
+};
+
+static Stm32Scheduler* scheduler;
+static uint32_t tick;
+static std::vector<uint32_t> calls[MAX_TASKS];
+static std::vector<int> order;
+
+//Task n takes n * 10 us, 72 cycles per us
+#define TASK(n) static void Task##n() { calls[n].push_back(tick); order.push_back(n); stubTimerCounter += n; stubCycleCounter += n * 720; }
+TASK(0) TASK(1) TASK(2) TASK(3) TASK(4) TASK(5) TASK(6) TASK(7) TASK(8) TASK(9) TASK(10) TASK(11)
+
+static void (*const tasks[])(void) = { Task0, Task1, Task2, Task3, Task4, Task5, Task6, Task7, Task8, Task9, Task10, Task11 };
+
+void SchedulerTest::TestCaseSetup()
+{
+   delete scheduler;
+   scheduler = new Stm32Scheduler(TIM2);
+   tick = 0;
+   order.clear();
+   for (int i = 0; i < MAX_TASKS; i++)
+      calls[i].clear();
+}
+
+static void RunTicks(uint32_t n)
+{
+   for (uint32_t i = 0; i < n; i++)
+   {
+      tick++;
+      //ISR is entered right at the compare match of this tick
+      stubTimerCounter = tick * 100;
+      stubTimerFlags |= TIM_SR_CC1IF;
+      scheduler->Run();
+   }
+}
+
+/** Enter the ISR right at the compare match the scheduler set up last */
+static void RunNextTick()
+{
+   tick++;
+   stubTimerCounter = stubTimerCompare;
+   stubTimerFlags |= TIM_SR_CC1IF;
+   scheduler->Run();
+}
+
+static bool CalledEvery(int task, uint32_t first, uint32_t period, uint32_t until)
+{
+   if (calls[task].size() != (until - first) / period + 1) return false;
+
+   for (uint32_t i = 0; i < calls[task].size(); i++)
+   {
+      if (calls[task][i] != first + i * period) return false;
+   }
+   return true;
+}
+
+static void TwelveTasks()
+{
+   static const uint32_t periods[] = { 1, 2, 5, 10, 10, 20, 33, 50, 100, 250, 1000, 3000 };
+   bool allPeriodic = true;
+
+   for (int i = 0; i < 12; i++)
+      scheduler->AddTask(tasks[i], periods[i]);
+
+   RunTicks(10000);
+
+   for (int i = 0; i < 12; i++)
+      allPeriodic = allPeriodic && CalledEvery(i, 1, periods[i], 10000);
+   ASSERT(allPeriodic);
+}
+
+static void PhaseOffset()
+{
+   scheduler->AddTask(Task0, 10);
+   scheduler->AddTask(Task1, 10, 5);
+
+   RunTicks(100);
+
+   ASSERT(CalledEvery(0, 1, 10, 100));
+   ASSERT(CalledEvery(1, 6, 10, 100));
+}
+
+static void SameTickInOrderAdded()
+{
+   scheduler->AddTask(Task3, 10);
+   scheduler->AddTask(Task2, 5);
+   scheduler->AddTask(Task1, 1);
+
+   RunTicks(10);
+
+   //Tick 1 runs all three, tick 6 runs the 5 ms and 1 ms task
+   ASSERT(order[0] == 3 && order[1] == 2 && order[2] == 1);
+   ASSERT(order.size() == 10 + 2 + 1);
+   ASSERT(order[7] == 2 && order[8] == 1);
+}
+
+static void LongPeriods()
+{
+   //Pass through all wheel levels
+   scheduler->AddTask(Task0, 40000, 1234);
+   scheduler->AddTask(Task1, Stm32Scheduler::MAX_PERIOD);
+   scheduler->AddTask(Task2, 1025, 31);
+
+   RunTicks(2 * Stm32Scheduler::MAX_PERIOD + 10);
+
+   ASSERT(CalledEvery(0, 1235, 40000, tick));
+   ASSERT(CalledEvery(1, 1, Stm32Scheduler::MAX_PERIOD, tick));
+   ASSERT(CalledEvery(2, 32, 1025, tick));
+}
+
+static void AddWhileRunning()
+{
+   scheduler->AddTask(Task0, 7);
+   RunTicks(1000);
+   scheduler->AddTask(Task1, 3);
+   RunTicks(1000);
+
+   ASSERT(CalledEvery(0, 1, 7, 2000));
+   ASSERT(CalledEvery(1, 1001, 3, 2000));
+}
+
+static void CpuLoadOfAllTasks()
+{
+   //Tasks advance the counter by their number, i.e. 10 us each
+   scheduler->AddTask(Task5, 1);
+   scheduler->AddTask(Task6, 2);
+   scheduler->AddTask(Task8, 4);
+   scheduler->AddTask(Task10, 5);
+   scheduler->AddTask(Task11, 10);
+
+   RunTicks(20);
+
+   //50 + 30 + 20 + 20 + 11 per mille
+   ASSERT(scheduler->GetCpuLoad() == 131);
+}
+
+static void VaryingTask()
+{
+   //0, 10, 20 us
+   stubTimerCounter += tick % 3;
+}
+
+static void SlowTask()
+{
+   stubTimerCounter += 150;
+}
+
+static void ExecutionTimes()
+{
+   ASSERT(scheduler->AddTask(VaryingTask, 1) == 0);
+   ASSERT(scheduler->AddTask(Task9, 2) == 1);
+
+   RunTicks(6);
+
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 6);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_EXEC_MIN) == 0);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_EXEC_MAX) == 20);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_EXEC_MEAN) == 10);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_EXEC_LAST) == 0);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_OVERRUNS) == 0);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_EXEC_MAX) == 90);
+   ASSERT(scheduler->GetStatistic(2, Stm32Scheduler::STAT_RUNS) == 0);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_LAST) == 0);
+}
+
+static void JitterAndHistogram()
+{
+   scheduler->AddTask(Task3, 1);
+   scheduler->AddTask(Task2, 2);
+
+   RunTicks(10);
+
+   //Task2 always starts after Task3 took 30 us
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_JITTER_MAX) == 0);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_HISTOGRAM) == 10);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_RUNS) == 5);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_EXEC_MEAN) == 20);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_JITTER_MAX) == 30);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_JITTER_MEAN) == 30);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_HISTOGRAM) == 0);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_HISTOGRAM + 1) == 5);
+
+   //Reset takes effect with the next tick, which records fresh values right away
+   scheduler->ResetStatistics();
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_RUNS) == 5);
+   RunTicks(2);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 2);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_RUNS) == 1);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_HISTOGRAM + 1) == 1);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_PERIOD) == 2);
+}
+
+static void Overruns()
+{
+   scheduler->SetOverrunPolicy(Stm32Scheduler::OVERRUN_SKIP);
+   scheduler->AddTask(SlowTask, 1);
+   scheduler->AddTask(SlowTask, 2);
+
+   for (int i = 0; i < 4; i++)
+      RunNextTick();
+
+   //1.5 ms is an overrun for the 1 ms task but not for the 2 ms task
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_OVERRUNS) == 4);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_EXEC_MAX) == 1500);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_OVERRUNS) == 0);
+}
+
+static int stallRun;
+
+/** Takes 3.5 ms on its third run, i.e. the three following ticks are missed */
+static void StallOnce()
+{
+   order.push_back(++stallRun);
+   stubTimerCounter += stallRun == 3 ? 350 : 1;
+}
+
+static void OverrunSetup(Stm32Scheduler::OverrunPolicy policy, int maxCatchUp)
+{
+   stallRun = 0;
+   scheduler->SetOverrunPolicy(policy, maxCatchUp);
+   scheduler->AddTask(StallOnce, 1);
+   scheduler->AddTask(Task0, 2);
+
+   for (int i = 0; i < 3; i++)
+      RunNextTick();
+}
+
+static void OverrunSkipsMissedTicks()
+{
+   OverrunSetup(Stm32Scheduler::OVERRUN_SKIP, 0);
+
+   //Compare went to 7 ms, the next one after the counter at 6.5 ms
+   ASSERT(stubTimerCompare == 700);
+   ASSERT(scheduler->GetLateTicks() == 3);
+   ASSERT(order.size() == 5); //3 StallOnce, 2 Task0
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_SKIPPED) == 3);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_SKIPPED) == 1);
+
+   //Releases stay in phase: tick 7 runs both
+   RunNextTick();
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 4);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_RUNS) == 3);
+}
+
+static void OverrunCatchesUpAtMostN()
+{
+   OverrunSetup(Stm32Scheduler::OVERRUN_CATCHUP, 2);
+
+   ASSERT(stubTimerCompare == 700);
+   ASSERT(scheduler->GetLateTicks() == 3);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 5);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_SKIPPED) == 1);
+   //Catch up runs started 2.5 and 1.5 ms late
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_JITTER_MAX) == 2500);
+}
+
+static void OverrunCatchUpDefault()
+{
+   stallRun = 0;
+   scheduler->AddTask(StallOnce, 1);
+
+   for (int i = 0; i < 3; i++)
+      RunNextTick();
+
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 4);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_SKIPPED) == 2);
+}
+
+static void OverrunPostsError()
+{
+   ErrorMessage::UnpostAll();
+   ErrorMessage::SetTime(1);
+   stallRun = 0;
+   scheduler->SetOverrunPolicy(Stm32Scheduler::OVERRUN_SKIP, 0, ERR_TASKOVERRUN);
+   scheduler->AddTask(StallOnce, 1);
+
+   RunNextTick();
+   RunNextTick();
+   ASSERT(ErrorMessage::GetLastError() != ERR_TASKOVERRUN);
+   RunNextTick();
+   ASSERT(ErrorMessage::GetLastError() == ERR_TASKOVERRUN);
+   ErrorMessage::UnpostAll();
+   ErrorMessage::SetTime(0);
+}
+
+static void HistogramBins()
+{
+   ASSERT(Stm32Scheduler::HistogramBin(0) == 0);
+   ASSERT(Stm32Scheduler::HistogramBin(15) == 0);
+   ASSERT(Stm32Scheduler::HistogramBin(16) == 1);
+   ASSERT(Stm32Scheduler::HistogramBin(31) == 1);
+   ASSERT(Stm32Scheduler::HistogramBin(32) == 2);
+   ASSERT(Stm32Scheduler::HistogramBin(1023) == 6);
+   ASSERT(Stm32Scheduler::HistogramBin(1024) == 7);
+   ASSERT(Stm32Scheduler::HistogramBin(100000) == 7);
+}
+
+static void HistogramHalvesWhenFull()
+{
+   scheduler->AddTask(Task0, 1);
+
+   RunTicks(65536);
+
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_HISTOGRAM) == 32768);
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_RUNS) == 65536);
+}
+
+static void CycleCounter()
+{
+   stubDwtPresent = true;
+   delete scheduler;
+   scheduler = new Stm32Scheduler(TIM2);
+   stubDwtPresent = false;
+   scheduler->AddTask(Task3, 1);
+   scheduler->AddTask(Task2, 1);
+
+   RunTicks(4);
+
+   ASSERT(scheduler->GetStatistic(0, Stm32Scheduler::STAT_EXEC_MAX) == 30);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_EXEC_MAX) == 20);
+   ASSERT(scheduler->GetStatistic(1, Stm32Scheduler::STAT_JITTER_MAX) == 30);
+}
+
+//This line registers the test
+REGISTER_TEST(SchedulerTest, TwelveTasks, PhaseOffset, SameTickInOrderAdded, LongPeriods, AddWhileRunning, CpuLoadOfAllTasks,
+              ExecutionTimes, JitterAndHistogram, Overruns, HistogramBins, HistogramHalvesWhenFull, CycleCounter,
+              OverrunSkipsMissedTicks, OverrunCatchesUpAtMostN, OverrunCatchUpDefault, OverrunPostsError);
@@ -0,0 +1,139 @@
+/*
+ * This file is part of the libopeninv project.
+ *
+ * Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include "workqueue.h"
+#include "test.h"
+
+class WorkQueueTest: public UnitTest
+{
+   public:
+      WorkQueueTest(const std::list<VoidFunction>* cases): UnitTest(cases) {}
+      virtual void TestCaseSetup();
+};
+
+static std::vector<int> calls;
+static int values[WORKQUEUE_SIZE * 2];
+
+static void Record(void* arg)
+{
+   calls.push_back(*(int*)arg);
+}
+
+void WorkQueueTest::TestCaseSetup()
+{
+   WorkQueue::Run();
+   calls.clear();
+   for (int i = 0; i < WORKQUEUE_SIZE * 2; i++)
+      values[i] = i;
+}
+
+static void RunsInOrderPosted()
+{
+   WorkQueue::Post(Record, &values[1]);
+   WorkQueue::Post(Record, &values[2]);
+   WorkQueue::Post(Record, &values[3]);
+
+   ASSERT(calls.empty());
+   ASSERT(WorkQueue::Run() == 3);
+   ASSERT(calls == std::vector<int>({ 1, 2, 3 }));
+   ASSERT(WorkQueue::Run() == 0);
+}
+
+static void HighestPriorityFirst()
+{
+   WorkQueue::Post(Record, &values[1], WorkQueue::PRIO_LOW);
+   WorkQueue::Post(Record, &values[2], WorkQueue::PRIO_NORMAL);
+   WorkQueue::Post(Record, &values[3], WorkQueue::PRIO_HIGH);
+   WorkQueue::Post(Record, &values[4], WorkQueue::PRIO_NORMAL);
+
+   WorkQueue::Run();
+   ASSERT(calls == std::vector<int>({ 3, 2, 4, 1 }));
+}
+
+static void PostUrgent(void* arg)
+{
+   Record(arg);
+   WorkQueue::Post(Record, &values[9], WorkQueue::PRIO_HIGH);
+}
+
+static void PostedWorkPreemptsLowerLevels()
+{
+   WorkQueue::Post(PostUrgent, &values[1], WorkQueue::PRIO_NORMAL);
+   WorkQueue::Post(Record, &values[2], WorkQueue::PRIO_NORMAL);
+
+   ASSERT(WorkQueue::Run() == 3);
+   ASSERT(calls == std::vector<int>({ 1, 9, 2 }));
+}
+
+static void FullQueueDrops()
+{
+   uint32_t dropped = WorkQueue::GetDropped();
+   bool allQueued = true;
+
+   for (int i = 0; i < WORKQUEUE_SIZE; i++)
+      allQueued = allQueued && WorkQueue::Post(Record, &values[i]);
+
+   ASSERT(allQueued);
+   ASSERT(!WorkQueue::Post(Record, &values[WORKQUEUE_SIZE]));
+   ASSERT(WorkQueue::GetDropped() == dropped + 1);
+   //Other levels are independent
+   ASSERT(WorkQueue::Post(Record, &values[WORKQUEUE_SIZE + 1], WorkQueue::PRIO_LOW));
+   ASSERT(WorkQueue::Run() == WORKQUEUE_SIZE + 1);
+   ASSERT(calls.back() == WORKQUEUE_SIZE + 1);
+}
+
+static void Repost(void* arg)
+{
+   Record(arg);
+   if (calls.size() < 3)
+      WorkQueue::Post(Repost, arg);
+}
+
+static void FunctionCanPostItself()
+{
+   WorkQueue::Post(Repost, &values[5]);
+
+   ASSERT(WorkQueue::Run() == 3);
+   ASSERT(calls == std::vector<int>({ 5, 5, 5 }));
+}
+
+static void WrapsAround()
+{
+   bool inOrder = true;
+
+   //Many rounds with the queue filled to different levels
+   for (int round = 0; round < 100; round++)
+   {
+      int n = round % WORKQUEUE_SIZE + 1;
+
+      calls.clear();
+      for (int i = 0; i < n; i++)
+         WorkQueue::Post(Record, &values[i], WorkQueue::PRIO_HIGH);
+      WorkQueue::Run();
+
+      inOrder = inOrder && (int)calls.size() == n;
+      for (int i = 0; i < (int)calls.size(); i++)
+         inOrder = inOrder && calls[i] == i;
+   }
+   ASSERT(inOrder);
+}
+
+//This line registers the test
+REGISTER_TEST(WorkQueueTest, RunsInOrderPosted, HighestPriorityFirst, PostedWorkPreemptsLowerLevels, FullQueueDrops,
+              FunctionCanPostItself, WrapsAround);
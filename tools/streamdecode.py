@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# This file is part of the libopeninv project.
+#
+# Copyright (C) 2025 Johannes Huebner <dev@johanneshuebner.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+"""Decode the delta stream format of ParamStreamer (terminal command deltastream).
+
+Usage: streamdecode.py <number of values> [file]
+Reads the raw byte stream from file or stdin and prints one CSV line
+"tick,value1,value2..." per sample with values scaled to float.
+"""
+import sys
+
+KEYFRAME = 0xA5
+FRAC_DIGITS = 5
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise IndexError
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return value & 0xFFFFFFFF, pos
+
+
+def unzigzag(n):
+    return (n >> 1) ^ -(n & 1)
+
+
+def to_s32(n):
+    n &= 0xFFFFFFFF
+    return n - (1 << 32) if n & 0x80000000 else n
+
+
+def decode(data, num_values):
+    """Yield (tick, [values]) tuples, values are raw s32fp"""
+    pos = 0
+    tick = None
+    values = [0] * num_values
+
+    while pos < len(data):
+        keyframe = data[pos] == KEYFRAME
+
+        if not keyframe and tick is None:
+            pos += 1
+            continue  # wait for first keyframe
+
+        try:
+            if keyframe:
+                tick, pos = read_varint(data, pos + 1)
+                values = [0] * num_values
+            else:
+                delta, pos = read_varint(data, pos)
+                tick = (tick + (delta >> 1)) & 0xFFFFFFFF
+            for i in range(num_values):
+                diff, pos = read_varint(data, pos)
+                values[i] = to_s32(values[i] + unzigzag(diff))
+        except IndexError:
+            return  # incomplete last sample
+
+        yield tick, list(values)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    num_values = int(sys.argv[1])
+    stream = open(sys.argv[2], "rb") if len(sys.argv) > 2 else sys.stdin.buffer
+    scale = 1 << FRAC_DIGITS
+
+    for tick, values in decode(stream.read(), num_values):
+        print(",".join([str(tick)] + ["%g" % (v / scale) for v in values]))
+
+
+if __name__ == "__main__":
+    main()